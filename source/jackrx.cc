@@ -208,7 +208,7 @@ void Jackrx::setloop (double bw)
 void Jackrx::capture (int nframes)
 {
     int    i, j, k1, k2;
-    float  *p, *q;
+    float  *p, *q0, *q1, *q2, *q3;
 
     // Read from audio queue and resample.
     // The while loop takes care of wraparound.
@@ -241,12 +241,30 @@ void Jackrx::capture (int nframes)
         // number of frames consumed.
         _audioq->rd_commit (k1);
     }
-    // Deinterleave _buff to outputs.
-    for (j = 0; j < _nchan; j++)
+    // Deinterleave _buff to outputs, four channels
+    // at a time so each pass over _buff reads fewer
+    // cache lines when there are many channels.
+    for (j = 0; j + 4 <= _nchan; j += 4)
     {
         p = _buff + j;
-        q = (float *)(jack_port_get_buffer (_ports [j], nframes));
-        for (i = 0; i < _bsize; i++) q [i] = p [i * _nchan];
+        q0 = (float *)(jack_port_get_buffer (_ports [j], nframes));
+        q1 = (float *)(jack_port_get_buffer (_ports [j + 1], nframes));
+        q2 = (float *)(jack_port_get_buffer (_ports [j + 2], nframes));
+        q3 = (float *)(jack_port_get_buffer (_ports [j + 3], nframes));
+        for (i = 0; i < _bsize; i++)
+        {
+            q0 [i] = p [0];
+            q1 [i] = p [1];
+            q2 [i] = p [2];
+            q3 [i] = p [3];
+            p += _nchan;
+        }
+    }
+    for (; j < _nchan; j++)
+    {
+        p = _buff + j;
+        q0 = (float *)(jack_port_get_buffer (_ports [j], nframes));
+        for (i = 0; i < _bsize; i++) q0 [i] = p [i * _nchan];
     }       
 }
 
@@ -22,9 +22,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "jacktx.h"
+#include "sampconv.h"
 #include "timers.h"
 
 
+// Peak level below which a channel is silent, as the bits of a float.
+// This is 2^-24, less than the resolution of 24-bit samples.
+#define SILENCE 0x33800000
+
+
 Jacktx::Jacktx (const char *jname, const char*jserv, int nchan) :
     _client (0),
     _nchan (nchan),     
@@ -33,7 +39,9 @@ Jacktx::Jacktx (const char *jname, const char*jserv, int nchan) :
     _packq (0),
     _timeq (0),
     _infoq (0),
-    _nettx (0)
+    _nettx (0),
+    _subsq (4 * Netdata::MAXCHAN / 32),
+    _subs (false)
 {
     init (jname, jserv);
 }
@@ -130,14 +138,45 @@ void Jacktx::start (Lfq_packdata   *packq,
                     Lfq_int32      *infoq, 
 		    Nettx          *nettx,
 		    int             sform,
-                    int             npack)
+                    int             npack,
+		    Opusenc        *openc,
+		    int             shold,
+		    int             gsize,
+		    bool            seqnum)
 {
+    int  i;
+
     _packq = packq;
     _timeq = timeq;
     _infoq = infoq;
     _nettx = nettx;
     _sform = sform;
     _npack = npack;
+    // If gsize is given the groups can be received separately,
+    // and each needs its own timed packet.
+    if (gsize > 0)
+    {
+	_ngrp = (_nchan + gsize - 1) / gsize;
+	_gsize = gsize;
+	_gtime = true;
+    }
+    else
+    {
+	_ngrp = Netdata::ngroups (_nchan);
+	_gsize = Netdata::groupsize (_nchan);
+	_gtime = false;
+    }
+    for (i = 0; i < _ngrp; i++)
+    {
+	_encode [i] = Netdata::encoder (sform, gchan (i));
+	_cmask [i] = ~(uint64_t) 0;
+    }
+    _openc = openc;
+    _shold = openc ? 0 : shold;
+    _seqnum = openc ? false : seqnum;
+    _nextsn = 0;
+    for (i = 0; i < _nchan; i++) _silent [i] = 0;
+    for (i = 0; i < Netdata::MAXCHAN / 64; i++) _smask [i] = ~(uint64_t) 0;
     _count = 0;
     _first = true;
     _tnext = 0;
@@ -146,6 +185,25 @@ void Jacktx::start (Lfq_packdata   *packq,
 }
 
 
+// A mask is taken by the Jack thread only when it is complete.
+// If the queue is full the request is lost, the receiver sends
+// it again.
+//
+void Jacktx::subscribe (const uint64_t *smask)
+{
+    int       i;
+    uint64_t  m;
+
+    if (_subsq.wr_avail () < Netdata::MAXCHAN / 32) return;
+    for (i = 0; i < Netdata::MAXCHAN / 64; i++)
+    {
+	m = smask ? smask [i] : ~(uint64_t) 0;
+	_subsq.wr_int32 (m >> 32);
+	_subsq.wr_int32 (m);
+    }
+}
+
+
 void Jacktx::report (int state)
 {
     if (_infoq->wr_avail () > 0) _infoq->wr_int32 (state);
@@ -167,8 +225,9 @@ void Jacktx::jack_buffsize (int bsize)
 
 int Jacktx::jack_process (int nframes)
 {
-    int             i, j, bdiff, bstep;
+    int             i, j, k, g, bdiff, bstep;
     int             dtime, nskip, flags, nfram;
+    uint64_t        m;
     jack_time_t     t0, t1;
     jack_nframes_t  ft;
     float           usecs;
@@ -192,7 +251,7 @@ int Jacktx::jack_process (int nframes)
             if (_packq->wr_avail () > 0)
 	    {
    	        D = _packq->wr_datap ();
-	        D->init_audio_data (Netdata::FL_SUSP, _sform, _nchan, 0, 0, 0); 
+	        D->init_audio_data (Netdata::FL_SUSP, _sform, _gsize, 0, 0, 0); 
 	        _packq->wr_commit ();
 		_nettx->trigger ();
 	    }
@@ -239,6 +298,7 @@ int Jacktx::jack_process (int nframes)
     {
 	_first = false;
 	nskip = 0;
+	if (_openc) _openc->reset ();
     }
     else
     {
@@ -247,6 +307,8 @@ int Jacktx::jack_process (int nframes)
     }
     _tnext = t1;
     _count += nskip;
+    // Samples waiting for an Opus frame are lost after a gap.
+    if (_openc && nskip) _openc->reset ();
 
     // Send periodic timestamp.
     _tscnt += _bsize;
@@ -265,29 +327,96 @@ int Jacktx::jack_process (int nframes)
 	inp [i] = (float *)(jack_port_get_buffer (_ports [i], nframes));
     }
 
+    if (_openc) return send_opus (inp, dtime);
+
+    // Take the last channel subscription.
+    while (_subsq.rd_avail () >= Netdata::MAXCHAN / 32)
+    {
+	for (i = 0; i < Netdata::MAXCHAN / 64; i++)
+	{
+	    m = (uint32_t) _subsq.rd_int32 ();
+	    _smask [i] = (m << 32) | (uint32_t) _subsq.rd_int32 ();
+	}
+	_subs = true;
+    }
+
+    // Leave out inactive or unsubscribed channels if enabled.
+    if (_shold || _subs) find_active (inp);
+
     // Bresenham algo to divide period in packets.
-    // The first packet of a period has valid time.
+    // Frames of more than MAXPCHAN channels are sent
+    // as one packet for each group of channels.
+    // The first packet of a period has valid time,
+    // or that of each group if _gtime is set.
     bdiff = 0;
     bstep = _bsize / _npack;
-    flags = Netdata::FL_TIMED;
     for (j = 0; j < _npack; j++)
     {
+	nfram = bstep;
+	if (bdiff < 0) nfram++; // Bresenham algo.
+	for (g = 0; g < _ngrp; g++)
+	{
+	    if (_packq->wr_avail () > 0)
+	    {
+		// Create and send an audio data packet.
+		D = _packq->wr_datap ();
+		k = g * _gsize;
+		flags = ((j == 0) && ((g == 0) || _gtime)) ? Netdata::FL_TIMED : 0;
+		D->init_audio_data (flags, _sform, gchan (g), _count, nfram, flags ? dtime : 0);
+		if (_ngrp > 1) D->set_group (k, _nchan);
+		if (_shold || (_subs && (_cmask [g] != gmask (g)))) D->set_cmask (_cmask [g]);
+		if (_seqnum) D->set_seqnum (_nextsn++);
+		(D->*_encode [g]) (0, nfram, inp + k);
+		_packq->wr_commit ();
+	    }
+	    else
+	    {
+		// Transmit queue is full.
+		_state = TERM;
+		report (_state);
+		return 0;
+	    }
+	}
+	for (i = 0; i < _nchan; i++) inp [i] += nfram;
+	_count += nfram;
+	// Update Bresenham algo.
+	bdiff += nfram * _npack - _bsize;
+    }
+    // All packets for this period are sent together.
+    _nettx->trigger ();
+
+    return 0; 
+}
+
+
+// Opus frames have a fixed size, so the number of packets in a period
+// varies. Samples are collected by the encoder until it has a complete
+// frame, and the remaining ones are used for the next period. As for
+// the other formats, the first packet sent in a period is timed. The
+// Opus frame size is never more than the period, so there always is
+// one, and the start of the period is at the offset given by the
+// number of samples collected before.
+//
+int Jacktx::send_opus (float * const *inp, int dtime)
+{
+    int       i, k, n, flags, toffs, fsize;
+    Netdata  *D;
+
+    fsize = _openc->fsize ();
+    flags = Netdata::FL_TIMED;
+    toffs = _openc->fill ();
+    for (i = 0; i < _bsize; i += k)
+    {
+	k = _openc->write (inp, i, _bsize - i);
+	if (_openc->fill () < fsize) break;
 	if (_packq->wr_avail () > 0)
 	{
-	    // Create and send an audio data packet.
 	    D = _packq->wr_datap ();
-	    nfram = bstep;
-    	    if (bdiff < 0) nfram++; // Bresenham algo.
-	    D->init_audio_data (flags, _sform, _nchan, _count, nfram, dtime);
-	    for (i = 0; i < _nchan; i++)
-  	    { 
-                D->put_audio (i, 0, nfram, inp [i], 1);
-		inp [i] += nfram;
-	    }
+	    D->init_audio_data (flags, _sform, _nchan, _count + i + k - fsize, fsize, dtime);
+	    // An empty packet makes the receiver use loss concealment.
+	    n = _openc->encode (D->opus_data (), D->opus_maxsize ());
+	    D->set_opus (flags ? toffs : 0, (n > 0) ? n : 0);
 	    _packq->wr_commit ();
-	    _nettx->trigger ();
-	    _count += nfram;
-	    // Only used in first packet of each period.
 	    dtime = 0;
 	    flags = 0;
 	}
@@ -298,9 +427,46 @@ int Jacktx::jack_process (int nframes)
  	    report (_state);
 	    return 0;
 	}
-	// Update Bresenham algo.
-	bdiff += nfram * _npack - _bsize;
     }
+    _count += _bsize;
+    _nettx->trigger ();
+    return 0;
+}
 
-    return 0; 
+
+// Find the channels to send. A channel is left out if it is not in the
+// receiver's subscription. If the hold time is set it is also left out
+// if its port is not connected, or if it has been silent for at least
+// the hold time, and is sent again as soon as it is not. The channels
+// that are sent are moved to the start of their group in 'inp', in the
+// same order.
+//
+void Jacktx::find_active (float **inp)
+{
+    int       c, g, i, j, k;
+    uint64_t  m;
+
+    for (g = 0; g < _ngrp; g++)
+    {
+	k = g * _gsize;
+	for (i = j = 0, m = 0; i < gchan (g); i++)
+	{
+	    c = k + i;
+	    if (! ((_smask [c >> 6] >> (c & 63)) & 1)) continue;
+	    if (_shold)
+	    {
+		if (! jack_port_connected (_ports [c])) _silent [c] = _shold;
+		else if (sconv->peak (inp [c], _bsize) > SILENCE) _silent [c] = 0;
+		else if (_silent [c] < _shold) _silent [c] += _bsize;
+		if (_silent [c] >= _shold) continue;
+	    }
+	    m |= (uint64_t) 1 << i;
+	    inp [k + j++] = inp [c];
+	}
+	if (m != _cmask [g])
+	{
+	    _cmask [g] = m;
+	    _encode [g] = Netdata::encoder (_sform, j);
+	}
+    }
 }
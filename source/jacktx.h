@@ -26,6 +26,7 @@
 #include "lfqueue.h"
 #include "netdata.h"
 #include "nettx.h"
+#include "opuscodec.h"
 
 
 class Jacktx
@@ -43,7 +44,16 @@ public:
                 Lfq_int32    *infoq,
 		Nettx        *nettx,
 		int           sform,
-		int           npack);
+		int           npack,
+		Opusenc      *openc,
+		int           shold,
+		int           gsize,
+		bool          seqnum);
+
+    // Send only the channels in 'smask', see Netdata::get_subscr (),
+    // or all of them if it is null. May be called by another thread,
+    // and is used from the next period. Opus streams are not affected.
+    void subscribe (const uint64_t *smask);
 
     const char *jname (void) const { return _jname; }
     int fsamp (void) const { return _fsamp; }
@@ -62,6 +72,10 @@ private:
     void jack_freewheel (int freew);
     void jack_latency (jack_latency_callback_mode_t jlcm);
     int  jack_process (int nframes);
+    int  send_opus (float * const *inp, int dtime);
+    void find_active (float **inp);
+    int  gchan (int g) const { return (g < _ngrp - 1) ? _gsize : _nchan - g * _gsize; }
+    uint64_t gmask (int g) const { return (gchan (g) < 64) ? ((uint64_t) 1 << gchan (g)) - 1 : ~(uint64_t) 0; }
 
 
     jack_client_t  *_client;
@@ -75,6 +89,16 @@ private:
     int             _freew;
     int             _sform;
     int             _npack;
+    int             _ngrp;   // Number of channel groups.
+    int             _gsize;  // Channels in each group except the last.
+    bool            _gtime;  // First packet of each group is timed.
+    Netdata::Encoder _encode [Netdata::MAXGROUP];
+    Opusenc        *_openc;
+    int             _shold;
+    int             _silent [Netdata::MAXCHAN];
+    uint64_t        _cmask [Netdata::MAXGROUP];
+    bool            _seqnum;  // Data packets are numbered, for striping.
+    uint32_t        _nextsn;
     int             _count;
     int             _tscnt;
     bool            _first;
@@ -83,6 +107,9 @@ private:
     Lfq_timedata   *_timeq;
     Lfq_int32      *_infoq;
     Nettx          *_nettx;
+    Lfq_int32       _subsq;  // Subscriptions, as pairs of 32-bit words.
+    uint64_t        _smask [Netdata::MAXCHAN / 64];
+    bool            _subs;   // Channels are selected by _smask.
 
 
     static void jack_static_shutdown (void *arg);
@@ -136,6 +136,12 @@ public:
     int       rd_avail (void) const { return _nwr - _nrd; } 
     Netdata  *rd_datap (void) { return _data [_nrd & _mask]; }
     void      rd_commit (void) { _nrd++; }
+    // Idem, for element k after the read pointer.
+    Netdata  *rd_datap (int k) { return _data [(_nrd + k) & _mask]; }
+    void      rd_commit (int k) { _nrd += k; }
+    int       rd_index (int k) const { return (_nrd + k) & _mask; }
+    // Any element, by index.
+    Netdata  *datap (int i) { return _data [i]; }
 
 private:
 
@@ -209,6 +215,9 @@ public:
     int     wr_linav (void) const { return _nfram - (_nwr & _mask); }
     float  *wr_datap (void) { return _data + _nchan * (_nwr & _mask); }
     void    wr_commit (int k) { _nwr += k; }
+    // Idem, for frames written 'k' frames ahead of the write pointer.
+    int     wr_linav (int k) const { return _nfram - ((_nwr + k) & _mask); }
+    float  *wr_datap (int k) { return _data + _nchan * ((_nwr + k) & _mask); }
 
     int     rd_avail (void) const { return _nwr - _nrd; } 
     int     rd_linav (void) const { return _nfram - (_nrd & _mask); }
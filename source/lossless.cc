@@ -0,0 +1,274 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2013-2016 Fons Adriaensen <fons@linuxaudio.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+#include <string.h>
+#include "lossless.h"
+
+
+#define R24 8388607
+
+// Largest useful Rice parameter. Prediction errors of 24-bit samples
+// are less than 2^26 in magnitude, so mapped errors fit in 28 bits.
+#define KMAX 27
+
+
+// Map signed to unsigned: 0, -1, 1, -2, 2,...
+static inline uint32_t zmap (int32_t e)
+{
+    return ((uint32_t) e << 1) ^ (uint32_t)(e >> 31);
+}
+
+
+static inline int32_t zunmap (uint32_t u)
+{
+    return (int32_t)((u >> 1) ^ (0 - (u & 1)));
+}
+
+
+// Fixed polynomial predictors.
+static inline int32_t predict (int order, int32_t x1, int32_t x2, int32_t x3)
+{
+    switch (order)
+    {
+    case 1: return x1;
+    case 2: return 2 * x1 - x2;
+    case 3: return 3 * (x1 - x2) + x3;
+    }
+    return 0;
+}
+
+
+// Order used for sample i, during the first ones.
+static inline int warm (int order, int i)
+{
+    return (i < order) ? i : order;
+}
+
+
+void Lossless_enc::reset (void)
+{
+    _nsamp = 0;
+    _x1 = _x2 = _x3 = 0;
+    _sum [0] = _sum [1] = _sum [2] = _sum [3] = 0;
+}
+
+
+void Lossless_enc::analyse (const int32_t *src, int nsamp)
+{
+    int       i, j;
+    int32_t   x, x1, x2, x3;
+    uint64_t  s0, s1, s2, s3;
+
+    x1 = _x1;
+    x2 = _x2;
+    x3 = _x3;
+    // The first sample of a block is sent as is if the order is not
+    // zero, the next ones use the highest order available.
+    for (i = 0; (i < nsamp) && (_nsamp + i < 3); i++)
+    {
+	x = src [i];
+	_sum [0] += zmap (x);
+	for (j = 1; (j < 4) && (_nsamp + i); j++)
+	{
+	    _sum [j] += zmap (x - predict (warm (j, _nsamp + i), x1, x2, x3));
+	}
+	x3 = x2;
+	x2 = x1;
+	x1 = x;
+    }
+    s0 = _sum [0];
+    s1 = _sum [1];
+    s2 = _sum [2];
+    s3 = _sum [3];
+    for (; i < nsamp; i++)
+    {
+	x = src [i];
+	s0 += zmap (x);
+	s1 += zmap (x - x1);
+	s2 += zmap (x - 2 * x1 + x2);
+	s3 += zmap (x - 3 * (x1 - x2) - x3);
+	x3 = x2;
+	x2 = x1;
+	x1 = x;
+    }
+    _sum [0] = s0;
+    _sum [1] = s1;
+    _sum [2] = s2;
+    _sum [3] = s3;
+    _x1 = x1;
+    _x2 = x2;
+    _x3 = x3;
+    _nsamp += nsamp;
+}
+
+
+int Lossless_enc::select (void)
+{
+    int       k, m, n;
+    uint64_t  b, best;
+
+    // Rice coding a value u takes (u >> k) + k + 1 bits, and the sum
+    // of u >> k is never more than the sum of u shifted by k. So this
+    // is an upper bound of the size, which is used to find the best
+    // parameters.
+    best = 24 * (uint64_t) _nsamp;
+    _order = VERBATIM;
+    _kpar = 0;
+    for (n = 0; n < 4; n++)
+    {
+	m = (n && _nsamp) ? 1 : 0;
+	for (k = 0; k <= KMAX; k++)
+	{
+	    b = 24 * m + (uint64_t)(_nsamp - m) * (k + 1) + (_sum [n] >> k);
+	    if (b < best)
+	    {
+		best = b;
+		_order = n;
+		_kpar = k;
+	    }
+	}
+    }
+    return 1 + (int)((best + 7) / 8);
+}
+
+
+void Lossless_enc::start (unsigned char *dst)
+{
+    _dst = dst;
+    _ptr = dst;
+    *_ptr++ = (_order << 5) | _kpar;
+    _acc = 0;
+    _nbit = 0;
+    _nsamp = 0;
+    _x1 = _x2 = _x3 = 0;
+}
+
+
+void Lossless_enc::encode (const int32_t *src, int nsamp)
+{
+    int       i, k, q;
+    int32_t   x;
+    uint32_t  u;
+
+    k = _kpar;
+    for (i = 0; i < nsamp; i++)
+    {
+	x = src [i];
+	if ((_order == VERBATIM) || (_order && (_nsamp + i == 0))) putbits (x & 0xFFFFFF, 24);
+	else
+	{
+	    u = zmap (x - predict (warm (_order, _nsamp + i), _x1, _x2, _x3));
+	    q = u >> k;
+	    if (q + k < 32) putbits ((1u << k) | (u & ((1u << k) - 1)), q + k + 1);
+	    else
+	    {
+		for (; q >= 32; q -= 32) putbits (0, 32);
+		putbits (1, q + 1);
+		putbits (u & ((1u << k) - 1), k);
+	    }
+	}
+	_x3 = _x2;
+	_x2 = _x1;
+	_x1 = x;
+    }
+    _nsamp += nsamp;
+}
+
+
+int Lossless_enc::finish (void)
+{
+    if (_nbit) *_ptr++ = _acc << (8 - _nbit);
+    _nbit = 0;
+    return _ptr - _dst;
+}
+
+
+int Lossless_dec::start (const unsigned char *src, int size)
+{
+    _nsamp = 0;
+    _x1 = _x2 = _x3 = 0;
+    _acc = 0;
+    _nbit = 0;
+    _fail = true;
+    if (size < 1) return -1;
+    _order = src [0] >> 5;
+    _kpar = src [0] & 31;
+    if ((_order > 3) && (_order != Lossless_enc::VERBATIM)) return -1;
+    if (_kpar > KMAX) return -1;
+    _ptr = src + 1;
+    _end = src + size;
+    _fail = false;
+    return 0;
+}
+
+
+void Lossless_dec::decode (int32_t *dst, int nsamp)
+{
+    int       i, z;
+    int32_t   x;
+    int64_t   y;
+    uint32_t  q, u;
+
+    for (i = 0; (i < nsamp) && ! _fail; i++)
+    {
+	refill ();
+	if ((_order == Lossless_enc::VERBATIM) || (_order && (_nsamp == 0)))
+	{
+	    if (_nbit < 24) break;
+	    x = (int32_t)(getbits (24) << 8) >> 8;
+	}
+	else
+	{
+	    // Count zeros up to the next one bit.
+	    q = 0;
+	    while (_acc == 0)
+	    {
+		if (_ptr == _end) break;
+		q += _nbit;
+		_nbit = 0;
+		refill ();
+	    }
+	    if (_acc == 0) break;
+	    z = __builtin_clzll (_acc);
+	    q += z;
+	    _acc <<= z;
+	    _acc <<= 1;
+	    _nbit -= z + 1;
+	    refill ();
+	    if (_nbit < _kpar) break;
+	    u = (q << _kpar) | getbits (_kpar);
+	    // Only a corrupt block can take this out of range.
+	    y = (int64_t) zunmap (u) + predict (warm (_order, _nsamp), _x1, _x2, _x3);
+	    if (y >  R24) y =  R24;
+	    if (y < -R24) y = -R24;
+	    x = (int32_t) y;
+	}
+	dst [i] = x;
+	_x3 = _x2;
+	_x2 = _x1;
+	_x1 = x;
+	_nsamp++;
+    }
+    if (i < nsamp)
+    {
+	_fail = true;
+	memset (dst + i, 0, (nsamp - i) * sizeof (int32_t));
+    }
+}
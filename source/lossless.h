@@ -0,0 +1,138 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2013-2016 Fons Adriaensen <fons@linuxaudio.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+#ifndef __LOSSLESS_H
+#define __LOSSLESS_H
+
+
+#include <stdint.h>
+
+
+// Lossless coding of a block of 24-bit samples, used for one channel
+// of a network packet.
+//
+// A block starts with a byte containing the predictor order in the
+// upper 3 bits and the Rice parameter k in the lower 5. The rest is
+// a bit stream, MSB first and padded to a whole byte. It contains the
+// errors of a fixed polynomial predictor of that order (0 to 3, as in
+// FLAC), Rice coded with parameter k. Unless the order is zero, the
+// first sample is a 24-bit integer instead, and the next ones use the
+// highest order that is available. Order 7 is used for a block that
+// has all its samples as 24-bit integers.
+//
+// Samples are in the range used by the 24-bit format, see the enci24
+// and deci24 conversion kernels.
+
+
+class Lossless_enc
+{
+public:
+
+    enum { VERBATIM = 7 };
+
+    // First pass, all samples of the block in one or more calls.
+    void  reset (void);
+    void  analyse (const int32_t *src, int nsamp);
+
+    // Select the coding parameters and return the maximum size of the
+    // coded block in bytes. This is never more than 1 + 3 * nsamp.
+    int   select (void);
+
+    // Second pass, the same samples again. Returns the block size.
+    void  start (unsigned char *dst);
+    void  encode (const int32_t *src, int nsamp);
+    int   finish (void);
+
+private:
+
+    void  putbits (uint32_t v, int nb)
+    {
+	_acc = (_acc << nb) | v;
+	_nbit += nb;
+	while (_nbit >= 8)
+	{
+	    _nbit -= 8;
+	    *_ptr++ = _acc >> _nbit;
+	}
+    }
+
+    int             _nsamp;   // Samples seen in current pass.
+    int32_t         _x1;      // Previous samples.
+    int32_t         _x2;
+    int32_t         _x3;
+    uint64_t        _sum [4]; // Sum of mapped errors, per order.
+    int             _order;
+    int             _kpar;
+    int             _size;
+    uint64_t        _acc;
+    int             _nbit;
+    unsigned char  *_dst;
+    unsigned char  *_ptr;
+};
+
+
+class Lossless_dec
+{
+public:
+
+    // Start decoding a block of 'size' bytes, returns 0 if the header
+    // is valid. Data beyond the end of the block is never read, and a
+    // corrupt block results in zero valued samples.
+    int   start (const unsigned char *src, int size);
+    void  decode (int32_t *dst, int nsamp);
+
+private:
+
+    // Keep at least 32 valid bits in the buffer, if available.
+    void  refill (void)
+    {
+	while (_nbit <= 56)
+	{
+	    if (_ptr == _end) return;
+	    _acc |= (uint64_t)(*_ptr++) << (56 - _nbit);
+	    _nbit += 8;
+	}
+    }
+    uint32_t getbits (int nb)
+    {
+	uint32_t v;
+
+	if (nb == 0) return 0;
+	v = _acc >> (64 - nb);
+	_acc <<= nb;
+	_nbit -= nb;
+	return v;
+    }
+
+    int                   _nsamp;
+    int32_t               _x1;
+    int32_t               _x2;
+    int32_t               _x3;
+    int                   _order;
+    int                   _kpar;
+    bool                  _fail;
+    uint64_t              _acc;   // Left aligned.
+    int                   _nbit;
+    const unsigned char  *_ptr;
+    const unsigned char  *_end;
+};
+
+
+#endif
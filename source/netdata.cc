@@ -18,43 +18,90 @@
 // ----------------------------------------------------------------------------
 
 
-#ifdef __APPLE__
-    #include <machine/endian.h>
-#elif __linux__
-    #include <endian.h>
-#endif
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 #include "netdata.h"
+#include "sampconv.h"
+#include "lossless.h"
+
+
+// Size in samples of the buffer used by the frame codecs. This should
+// be small enough so the buffer, and the part of the packet written
+// from it, remain in the L1 cache.
+#define TILESIZE 2048
+
+// Largest block floating point exponent. Samples are multiplied by
+// 2^e, with e chosen per channel and packet to keep the peak value
+// below full scale.
+#define BFPMAX 31
+
+
+static int bfp_exp (uint32_t peak)
+{
+    int e;
+
+    // The peak is the bits of a positive float, 126 - its exponent
+    // is the largest e that keeps peak * 2^e below one.
+    e = 126 - (int)(peak >> 23);
+    if (e < 0) return 0;
+    if (e > BFPMAX) return BFPMAX;
+    return e;
+}
+
+
+static float bfp_gain (int e)
+{
+    if (e > BFPMAX) e = BFPMAX;
+    return (float)(1u << e);
+}
 
 
 Netdata::Netdata (int size)
 {
     _size = size;
     _dlen = 0;
-    _data = new unsigned char [size];
+    _buff = new unsigned char [size + 15];
+    _data = (unsigned char *)(((uintptr_t) _buff + 15) & ~(uintptr_t) 15);
 }
 
 
 Netdata::~Netdata (void)
 {
-    delete[] _data;
+    delete[] _buff;
 }
 
 
-int Netdata::packetsperperiod (int maxsize, int period, int sform, int nchan)
+int Netdata::sampbits (int sform)
 {
-    int b, n;
-
     switch (sform)
     {
-    case FM_16BIT: b = 2; break;          // Bytes per sample.
-    case FM_24BIT: b = 3; break;
-    case FM_FLOAT: b = 4; break;
-    default: return -1; 
+    case FM_BFP12:  return 12;
+    case FM_16BIT:
+    case FM_HALF:
+    case FM_BFP16:  return 16;
+    case FM_20BIT:  return 20;
+    case FM_24BIT:
+    case FM_LL24:   return 24;
+    case FM_FLOAT:
+    case FM_PFLOAT:
+    case FM_P32BIT: return 32;
     }
-    n = (maxsize - ADATA) / (b * nchan);  // Number of frames per packet.
+    return 0;
+}
+
+
+int Netdata::packetsperperiod (int maxsize, int period, int sform, int nchan, int flags)
+{
+    int a, b, n;
+
+    b = sampbits (sform);                 // Bits per sample.
+    if (b == 0) return -1;
+    a = abase (flags);
+    if (planar (sform)) n = ((maxsize - pbase (flags)) / nchan) / 16 * 4;
+    else if (blockfp (sform)) n = 8 * (maxsize - a - nchan) / (b * nchan);
+    else n = 8 * (maxsize - a) / (b * nchan);  // Number of frames per packet.
+    if (n < 1) return -1;
     return (period + n - 1) / n;          // Number of packets per period.
 }
 
@@ -64,13 +111,14 @@ int Netdata::packetsperperiod (int maxsize, int period, int sform, int nchan)
 void Netdata::init_audio_desc (int flags, int sform, int nchan,
                                int psmax, int fsamp, int fsize)
 {
-    init_header (TY_ADESC, flags, sform, nchan);
+    init_header (TY_ADESC, flags, sform, (nchan <= MAXPCHAN) ? nchan : 0);
     putint (PSMAX, psmax);
     putint (FSAMP, fsamp);
     putint (FSIZE, fsize);
     putint (TFCNT, 0);
     putint (TSECS, 0);
     putint (TFRAC, 0);
+    putint (DCHAN, nchan);
     _dlen = DPEND;
 }
 
@@ -80,20 +128,29 @@ void Netdata::init_audio_desc (int flags, int sform, int nchan,
 void Netdata::init_audio_data (int flags, int sform, int nchan,
                                int count, int nfram, int dtime)
 {
-    int b;
-
-    switch (sform)
-    {
-    case FM_16BIT: b = 2; break;
-    case FM_24BIT: b = 3; break;
-    case FM_FLOAT: b = 4; break;
-    default: b = 0; 
-    }
     init_header (TY_ADATA, flags, sform, nchan);
     putint (COUNT, count);
     putint (NFRAM, nfram);
     putint (DTIME, dtime);
-    _dlen = ADATA + b * nchan * nfram;
+    if (planar (sform)) memset (_data + ADATA, 0, PDATA - ADATA);
+    if (sform == FM_OPUS) set_opus (0, 0);
+    else set_dlen ();
+}
+
+
+// Set the used size from the sample format, number of frames
+// and channels present.
+//
+void Netdata::set_dlen (void)
+{
+    int  sform, nfram, nch;
+
+    sform = _data [SFORM];
+    nfram = getint (NFRAM);
+    nch = pchan ();
+    if (planar (sform)) _dlen = pbase () + nch * pstride (nfram);
+    else if (blockfp (sform)) _dlen = abase () + nch + (sampbits (sform) * nch * nfram + 7) / 8;
+    else _dlen = abase () + (sampbits (sform) * nch * nfram + 7) / 8;
 }
 
 
@@ -118,6 +175,170 @@ void Netdata::set_tmark (int32_t tfcnt, uint32_t tsecs, uint32_t tfrac)
 }
 
 
+// Make the packet contain channels cbase and up of a stream of
+// 'nchan' channels. The size of the group is set by init_audio_data ().
+//
+void Netdata::set_group (int cbase, int nchan)
+{
+    _data [FLAGS] |= FL_GROUP;
+    _data [CBASE] = cbase >> 8;
+    _data [CBASE + 1] = cbase;
+    _data [CTOTL] = nchan >> 8;
+    _data [CTOTL + 1] = nchan;
+    set_dlen ();
+}
+
+
+int Netdata::get_nchan (void) const
+{
+    if (_data [PTYPE] == TY_ADESC) return _data [NCHAN] ? _data [NCHAN] : getint (DCHAN);
+    if (grouped ()) return (_data [CTOTL] << 8) + _data [CTOTL + 1];
+    return _data [NCHAN];
+}
+
+
+int Netdata::get_cbase (void) const
+{
+    if (grouped ()) return (_data [CBASE] << 8) + _data [CBASE + 1];
+    return 0;
+}
+
+
+// Select the channels present in the packet, bit c of 'cmask'
+// corresponds to channel c.
+//
+void Netdata::set_cmask (uint64_t cmask)
+{
+    int  i, k;
+
+    _data [FLAGS] |= FL_CMASK;
+    k = mbase ();
+    for (i = 0; i < 8; i++) _data [k + i] = cmask >> (56 - 8 * i);
+    set_dlen ();
+}
+
+
+// Channels present in the packet, only those that exist are
+// returned even if the mask contains more.
+//
+uint64_t Netdata::get_cmask (void) const
+{
+    int       i, k, nch;
+    uint64_t  m, v;
+
+    nch = _data [NCHAN];
+    m = (nch < 64) ? ((uint64_t) 1 << nch) - 1 : ~(uint64_t) 0;
+    if (! masked ()) return m;
+    k = mbase ();
+    for (i = 0, v = 0; i < 8; i++) v = (v << 8) | _data [k + i];
+    return v & m;
+}
+
+
+// Number the packet of a striped stream. For the planar formats
+// the bytes before the sample data that are not used are cleared.
+//
+void Netdata::set_seqnum (uint32_t seqnum)
+{
+    int  k;
+
+    _data [FLAGS] |= FL_SEQ;
+    k = sbase ();
+    putint (k, seqnum);
+    if (planar (_data [SFORM])) memset (_data + k + 4, 0, pbase () - k - 4);
+    set_dlen ();
+}
+
+
+uint32_t Netdata::get_seqnum (void) const
+{
+    if (xflags () & FL_SEQ) return getint (sbase ());
+    return 0;
+}
+
+
+// The descriptor of a stream striped over 'npath' paths.
+//
+void Netdata::set_npath (int npath)
+{
+    _data [FLAGS] |= FL_SEQ;
+    putint (DPATH, npath);
+    _dlen = DPATH + 4;
+}
+
+
+int Netdata::get_npath (void) const
+{
+    if (_data [FLAGS] & FL_SEQ) return getint (DPATH);
+    return 1;
+}
+
+
+// Initialise a CSUBS packet for the channels in 'chlist'.
+//
+void Netdata::init_subscr (const int *chlist)
+{
+    int  c;
+
+    init_header (TY_CSUBS, 0, 0, 0);
+    memset (_data + SMASK, 0, MAXCHAN / 8);
+    for (; *chlist >= 0; chlist++)
+    {
+	c = *chlist;
+	if (c < MAXCHAN) _data [SMASK + c / 8] |= 1 << (c % 8);
+    }
+    _dlen = SPEND;
+}
+
+
+// Get the channels from a CSUBS packet of 'len' bytes, bit c % 64
+// of smask [c / 64] corresponds to channel c.
+//
+int Netdata::get_subscr (uint64_t *smask, int len) const
+{
+    int  c;
+
+    if ((len < SPEND) || (check_ptype () != TY_CSUBS)) return -1;
+    for (c = 0; c < MAXCHAN / 64; c++) smask [c] = 0;
+    for (c = 0; c < MAXCHAN; c++)
+    {
+	if (_data [SMASK + c / 8] & (1 << (c % 8))) smask [c / 64] |= (uint64_t) 1 << (c % 64);
+    }
+    return 0;
+}
+
+
+// Only timed Opus packets have a non-zero offset, in all other
+// ones the first frame is the start of a sender period.
+//
+int Netdata::get_toffs (void) const
+{
+    if ((_data [SFORM] != FM_OPUS) || ! (_data [FLAGS] & FL_TIMED)) return 0;
+    return (_data [TOFFS] << 8) + _data [TOFFS + 1];
+}
+
+
+void Netdata::set_opus (int toffs, int osize)
+{
+    _data [TOFFS] = toffs >> 8;
+    _data [TOFFS + 1] = toffs;
+    _data [OSIZE] = osize >> 8;
+    _data [OSIZE + 1] = osize;
+    _dlen = ODATA + osize;
+}
+
+
+// Size of the Opus data, zero if invalid.
+//
+int Netdata::get_osize (void) const
+{
+    int  n;
+
+    n = (_data [OSIZE] << 8) + _data [OSIZE + 1];
+    return (n > _size - ODATA) ? 0 : n;
+}
+
+
 int Netdata::check_ptype (void) const
 {
     if (   (_data [0] != 'z')
@@ -128,73 +349,187 @@ int Netdata::check_ptype (void) const
 }
 
 
-#define R16 32767
-#define R24 8388607
-
-
 // Put audio samples from float array into network packet.
+// The padding of planar channel blocks is cleared, so no old
+// buffer contents are sent.
 //
 void Netdata::put_audio (int chan, int offs, int nsamp, const float *adata, int astep)
 {
-    int            i, v, nch, fmt;
-    unsigned char  *q, *p;
+    int            nch, nfr;
+    unsigned char  *d, *q;
 
-    nch = _data [NCHAN];	
-    fmt = _data [SFORM];
-    switch (fmt)
+    nch = pchan ();
+    d = _data + abase ();
+    switch (_data [SFORM])
     {
     case FM_16BIT:
-	q = _data + ADATA + 2 * (nch * offs + chan);
-	for (i = 0; i < nsamp; i++)
-	{
-	    v = (int)(R16 * adata [i * astep] + 0.5f);
-	    if (v >  R16) v =  R16;
-	    if (v < -R16) v = -R16;
-	    q [0] = v >> 8;
-	    q [1] = v;
-	    q += 2 * nch;
-	}
+	q = d + 2 * (nch * offs + chan);
+	sconv->enc16 (q, nch, adata, astep, nsamp);
 	break;
     
+    case FM_LL24:
+	// A single channel can't be coded, use the 24-bit format.
+	set_24bit ();
+	// Fall through.
     case FM_24BIT:	
-        q = _data + ADATA + 3 * (nch * offs + chan);
-        for (i = 0; i < nsamp; i++)
-        {
-            v = (int)(R24 * adata [i * astep] + 0.5f);
-            if (v >  R24) v =  R24;
-            if (v < -R24) v = -R24;
-            q [0] = v >> 16;
-            q [1] = v >> 8;
-            q [2] = v;
-            q += 3 * nch;
-	}
+        q = d + 3 * (nch * offs + chan);
+	sconv->enc24 (q, nch, adata, astep, nsamp);
 	break;
 
-#if __BYTE_ORDER == __BIG_ENDIAN
     case FM_FLOAT:
-	float *f = (float *)(_data + ADATA);
-	f += nch * offs + chan;
-	for (i = 0; i < nsamp; i++)
+	q = d + 4 * (nch * offs + chan);
+	sconv->encfl (q, nch, adata, astep, nsamp);
+	break;
+
+    case FM_PFLOAT:
+	nfr = getint (NFRAM);
+	q = _data + pbase () + chan * pstride (nfr);
+	sconv->encflle (q + 4 * offs, 1, adata, astep, nsamp);
+	memset (q + 4 * nfr, 0, pstride (nfr) - 4 * nfr);
+	break;
+
+    case FM_P32BIT:
+	nfr = getint (NFRAM);
+	q = _data + pbase () + chan * pstride (nfr);
+	sconv->enc32le (q + 4 * offs, 1, adata, astep, nsamp);
+	memset (q + 4 * nfr, 0, pstride (nfr) - 4 * nfr);
+	break;
+
+    case FM_20BIT:
+	sconv->enc20 (d, nch * offs + chan, nch, adata, astep, nsamp);
+	clr_nibble ();
+	break;
+
+    case FM_HALF:
+	q = d + 2 * (nch * offs + chan);
+	sconv->enchf (q, nch, adata, astep, nsamp);
+	break;
+
+    case FM_BFP12:
+    case FM_BFP16:
+	put_bfp (chan, offs, nsamp, adata, astep);
+	break;
+    }
+}
+
+
+// With an odd number of samples the last byte of a packed format
+// is only half used. Clear the other half so no stale data is sent.
+//
+void Netdata::clr_nibble (void)
+{
+    int  n;
+
+    n = pchan () * getint (NFRAM);
+    if (!(n & 1)) return;
+    switch (_data [SFORM])
+    {
+    case FM_20BIT:
+	_data [abase () + 5 * (n >> 1) + 2] &= 0xF0;
+	break;
+    case FM_BFP12:
+	_data [abase () + pchan () + 3 * (n >> 1) + 1] &= 0xF0;
+	break;
+    }
+}
+
+
+// Change a lossless packet to the 24-bit format.
+//
+void Netdata::set_24bit (void)
+{
+    _data [SFORM] = FM_24BIT;
+    set_dlen ();
+}
+
+
+// Code all channels of a lossless packet, returns false if the
+// result would be larger than the 24-bit format.
+//
+bool Netdata::put_lossless (int nfram, const float * const *adata)
+{
+    int            c, i, m, n, nch;
+    int32_t        tile [TILESIZE];
+    unsigned char  *d, *q, *e;
+    Lossless_enc   E;
+
+    nch = pchan ();
+    d = _data + abase ();
+    q = d + 2 * nch;
+    e = d + 3 * nch * nfram;
+    for (c = 0; c < nch; c++)
+    {
+	// The first pass finds the best parameters and a bound on the
+	// size, the second one codes the samples. These are converted again
+	// only if they don't fit into a single tile.
+	E.reset ();
+	for (i = 0; i < nfram; i += n)
 	{
-	    f [i * nch] = adata [i * astep];
+	    n = nfram - i;
+	    if (n > TILESIZE) n = TILESIZE;
+	    sconv->enci24 (tile, adata [c] + i, n);
+	    E.analyse (tile, n);
 	}
-	break;
-#else
-    case FM_FLOAT:
-	p = (unsigned char *) adata;
-	q = _data + ADATA + 4 * (nch * offs + chan);
-	for (i = 0; i < nsamp; i++)
+	m = E.select ();
+	if ((m > e - q) || (m > 0xFFFF)) return false;
+	E.start (q);
+	for (i = 0; i < nfram; i += n)
 	{
-	    q [0] = p [3];
-	    q [1] = p [2];
-	    q [2] = p [1];
-	    q [3] = p [0];
-	    p += 4 * astep;
-	    q += 4 * nch;
+	    n = nfram - i;
+	    if (n > TILESIZE) n = TILESIZE;
+	    if (nfram > TILESIZE) sconv->enci24 (tile, adata [c] + i, n);
+	    E.encode (tile, n);
 	}
-	break;
-#endif
+	m = E.finish ();
+	d [2 * c] = m >> 8;
+	d [2 * c + 1] = m;
+	q += m;
+    }
+    _dlen = q - _data;
+    return true;
+}
+
+
+// Block floating point, single channel. The exponent is set when
+// writing from the start of the packet, and reused otherwise. The
+// samples are scaled into a local buffer before conversion.
+//
+void Netdata::put_bfp (int chan, int offs, int nsamp, const float *adata, int astep)
+{
+    int            i, k, nch;
+    uint32_t       u, m;
+    float          g, t [256];
+    unsigned char  *d, *q;
+
+    nch = pchan ();
+    d = _data + abase ();
+    if (offs == 0)
+    {
+	if (astep == 1) m = sconv->peak (adata, nsamp);
+	else
+	{
+	    for (i = m = 0; i < nsamp; i++)
+	    {
+		memcpy (&u, adata + i * astep, 4);
+		u &= 0x7FFFFFFF;
+		if (u > m) m = u;
+	    }
+	}
+	d [chan] = bfp_exp (m);
     }
+    g = bfp_gain (d [chan]);
+    q = d + nch;
+    while (nsamp)
+    {
+	k = (nsamp < 256) ? nsamp : 256;
+	for (i = 0; i < k; i++) t [i] = g * adata [i * astep];
+	if (_data [SFORM] == FM_BFP12) sconv->enc12 (q, nch * offs + chan, nch, t, 1, k);
+	else sconv->enc16 (q + 2 * (nch * offs + chan), nch, t, 1, k);
+	adata += k * astep;
+	offs += k;
+	nsamp -= k;
+    }
+    if (_data [SFORM] == FM_BFP12) clr_nibble ();
 }
 
 
@@ -202,59 +537,502 @@ void Netdata::put_audio (int chan, int offs, int nsamp, const float *adata, int
 //
 void Netdata::get_audio (int chan, int offs, int nsamp, float *adata, int astep) const
 {
-    int            i, v, nch, fmt;
-    unsigned char  *p, *q;
+    int            i, nch;
+    float          g;
+    unsigned char  *d, *p;
 
-    nch = _data [NCHAN];	
-    fmt = _data [SFORM];
-    switch (fmt)
+    nch = pchan ();
+    d = _data + abase ();
+    switch (_data [SFORM])
     {
     case FM_16BIT:
-	p = _data + ADATA + 2 * (nch * offs + chan);
-	for (i = 0; i < nsamp; i++)
-	{
-	    v = p [0];
-	    if (v & 128) v -= 256;
-	    adata [i * astep] = (float)((v << 8) + p [1]) / R16;
-	    p += 2 * nch;
-	}
+	p = d + 2 * (nch * offs + chan);
+	sconv->dec16 (adata, astep, p, nch, nsamp);
 	break;
     
     case FM_24BIT:	
-        p = _data + ADATA + 3 * (nch * offs + chan);
-	for (i = 0; i < nsamp; i++)
-	{
-	    v = p [0];
-	    if (v & 128) v -= 256;
-	    adata [i * astep] = (float)((v << 16) + (p [1] << 8) + p [2]) / R24;
-	    p += 3 * nch;
-	}
+        p = d + 3 * (nch * offs + chan);
+	sconv->dec24 (adata, astep, p, nch, nsamp);
 	break;
 
-#if __BYTE_ORDER == __BIG_ENDIAN
     case FM_FLOAT:
-	float *f = (float *)(_data + ADATA);
-	f += nch * offs + chan;
-	for (i = 0; i < nsamp; i++)
+	p = d + 4 * (nch * offs + chan);
+	sconv->decfl (adata, astep, p, nch, nsamp);
+	break;
+
+    case FM_PFLOAT:
+	p = _data + pbase () + chan * pstride (getint (NFRAM)) + 4 * offs;
+	sconv->decflle (adata, astep, p, 1, nsamp);
+	break;
+
+    case FM_P32BIT:
+	p = _data + pbase () + chan * pstride (getint (NFRAM)) + 4 * offs;
+	sconv->dec32le (adata, astep, p, 1, nsamp);
+	break;
+
+    case FM_20BIT:
+	sconv->dec20 (adata, astep, d, nch * offs + chan, nch, nsamp);
+	break;
+
+    case FM_HALF:
+	p = d + 2 * (nch * offs + chan);
+	sconv->dechf (adata, astep, p, nch, nsamp);
+	break;
+
+    case FM_BFP12:
+    case FM_BFP16:
+	p = d + nch;
+	if (_data [SFORM] == FM_BFP12) sconv->dec12 (adata, astep, p, nch * offs + chan, nch, nsamp);
+	else sconv->dec16 (adata, astep, p + 2 * (nch * offs + chan), nch, nsamp);
+	g = 1.0f / bfp_gain (d [chan]);
+	for (i = 0; i < nsamp; i++) adata [i * astep] *= g;
+	break;
+
+    case FM_LL24:
+	get_lossless (chan, offs, nsamp, adata, astep);
+	break;
+    }
+}
+
+
+// Decode one channel of a lossless packet. Blocks can only be decoded
+// from the start, so any samples before 'offs' are decoded as well.
+// The block table is not trusted, the packet buffer is never read
+// beyond its allocated size.
+//
+void Netdata::get_lossless (int chan, int offs, int nsamp, float *adata, int astep) const
+{
+    int           a, c, i, k, m, n, nch;
+    int32_t       tile [TILESIZE];
+    Lossless_dec  D;
+
+    nch = pchan ();
+    a = abase ();
+    k = a + 2 * nch;
+    for (c = 0; c < chan; c++) k += (_data [a + 2 * c] << 8) + _data [a + 2 * c + 1];
+    m = (_data [a + 2 * chan] << 8) + _data [a + 2 * chan + 1];
+    if (k + m > _size) m = 0;
+    D.start (_data + k, m);
+    for (i = 0; i < offs; i += n)
+    {
+	n = offs - i;
+	if (n > TILESIZE) n = TILESIZE;
+	D.decode (tile, n);
+    }
+    for (i = 0; i < nsamp; i += n)
+    {
+	n = nsamp - i;
+	if (n > TILESIZE) n = TILESIZE;
+	D.decode (tile, n);
+	sconv->deci24 (adata + i * astep, astep, tile, n);
+    }
+}
+
+
+// Put audio samples from all channels into network packet, adata [c]
+// points to the samples for channel c.
+//
+void Netdata::put_frames (int offs, int nfram, const float * const *adata)
+{
+    (this->*encoder (_data [SFORM], pchan ())) (offs, nfram, adata);
+}
+
+
+// Get audio samples from network packet into interleaved frames of
+// 'astep' samples. The first 'nmap' samples of each frame are taken
+// from packet channels cmap [0..nmap-1], which must be in ascending
+// order, the remaining ones are not modified.
+//
+void Netdata::get_frames (int offs, int nfram, float *adata, int astep, int nmap, const int *cmap) const
+{
+    (this->*decoder (_data [SFORM], pchan ())) (offs, nfram, adata, astep, nmap, cmap);
+}
+
+
+// Sample format properties, for use as a template parameter.
+// The conversion functions address samples by index, since the
+// packed formats are not byte aligned.
+//
+template <int F> class Sform;
+
+template <> class Sform <Netdata::FM_16BIT>
+{
+public:
+    enum { PLANAR = 0, BFP = 0 };
+    static void enc (unsigned char *p, int i, const float *src, int n) { sconv->enc16 (p + 2 * i, 1, src, 1, n); }
+    static void dec (float *dst, int dstep, const unsigned char *p, int i, int n) { sconv->dec16 (dst, dstep, p + 2 * i, 1, n); }
+};
+
+template <> class Sform <Netdata::FM_24BIT>
+{
+public:
+    enum { PLANAR = 0, BFP = 0 };
+    static void enc (unsigned char *p, int i, const float *src, int n) { sconv->enc24 (p + 3 * i, 1, src, 1, n); }
+    static void dec (float *dst, int dstep, const unsigned char *p, int i, int n) { sconv->dec24 (dst, dstep, p + 3 * i, 1, n); }
+};
+
+template <> class Sform <Netdata::FM_FLOAT>
+{
+public:
+    enum { PLANAR = 0, BFP = 0 };
+    static void enc (unsigned char *p, int i, const float *src, int n) { sconv->encfl (p + 4 * i, 1, src, 1, n); }
+    static void dec (float *dst, int dstep, const unsigned char *p, int i, int n) { sconv->decfl (dst, dstep, p + 4 * i, 1, n); }
+};
+
+template <> class Sform <Netdata::FM_PFLOAT>
+{
+public:
+    enum { PLANAR = 1, BFP = 0 };
+    static void enc (unsigned char *p, int i, const float *src, int n) { sconv->encflle (p + 4 * i, 1, src, 1, n); }
+    static void dec (float *dst, int dstep, const unsigned char *p, int i, int n) { sconv->decflle (dst, dstep, p + 4 * i, 1, n); }
+};
+
+template <> class Sform <Netdata::FM_P32BIT>
+{
+public:
+    enum { PLANAR = 1, BFP = 0 };
+    static void enc (unsigned char *p, int i, const float *src, int n) { sconv->enc32le (p + 4 * i, 1, src, 1, n); }
+    static void dec (float *dst, int dstep, const unsigned char *p, int i, int n) { sconv->dec32le (dst, dstep, p + 4 * i, 1, n); }
+};
+
+template <> class Sform <Netdata::FM_20BIT>
+{
+public:
+    enum { PLANAR = 0, BFP = 0 };
+    static void enc (unsigned char *p, int i, const float *src, int n) { sconv->enc20 (p, i, 1, src, 1, n); }
+    static void dec (float *dst, int dstep, const unsigned char *p, int i, int n) { sconv->dec20 (dst, dstep, p, i, 1, n); }
+};
+
+template <> class Sform <Netdata::FM_HALF>
+{
+public:
+    enum { PLANAR = 0, BFP = 0 };
+    static void enc (unsigned char *p, int i, const float *src, int n) { sconv->enchf (p + 2 * i, 1, src, 1, n); }
+    static void dec (float *dst, int dstep, const unsigned char *p, int i, int n) { sconv->dechf (dst, dstep, p + 2 * i, 1, n); }
+};
+
+template <> class Sform <Netdata::FM_BFP12>
+{
+public:
+    enum { PLANAR = 0, BFP = 1 };
+    static void enc (unsigned char *p, int i, const float *src, int n) { sconv->enc12 (p, i, 1, src, 1, n); }
+    static void dec (float *dst, int dstep, const unsigned char *p, int i, int n) { sconv->dec12 (dst, dstep, p, i, 1, n); }
+};
+
+template <> class Sform <Netdata::FM_BFP16>
+{
+public:
+    enum { PLANAR = 0, BFP = 1 };
+    static void enc (unsigned char *p, int i, const float *src, int n) { sconv->enc16 (p + 2 * i, 1, src, 1, n); }
+    static void dec (float *dst, int dstep, const unsigned char *p, int i, int n) { sconv->dec16 (dst, dstep, p + 2 * i, 1, n); }
+};
+
+
+// Return the encoder for the given sample format and number
+// of channels. These are specialised at compile time for the
+// most common channel counts.
+//
+Netdata::Encoder Netdata::encoder (int sform, int nchan)
+{
+    if (nchan < 1) return &Netdata::enc_none;
+    switch (sform)
+    {
+    case FM_16BIT: return enc_select <FM_16BIT> (nchan);
+    case FM_24BIT: return enc_select <FM_24BIT> (nchan);
+    case FM_FLOAT: return enc_select <FM_FLOAT> (nchan);
+    case FM_PFLOAT: return enc_select <FM_PFLOAT> (nchan);
+    case FM_P32BIT: return enc_select <FM_P32BIT> (nchan);
+    case FM_20BIT: return enc_select <FM_20BIT> (nchan);
+    case FM_HALF: return enc_select <FM_HALF> (nchan);
+    case FM_BFP12: return enc_select <FM_BFP12> (nchan);
+    case FM_BFP16: return enc_select <FM_BFP16> (nchan);
+    case FM_LL24: return &Netdata::enc_lossless;
+    }
+    return &Netdata::enc_none;
+}
+
+
+// Idem for the decoder.
+//
+Netdata::Decoder Netdata::decoder (int sform, int nchan)
+{
+    if (nchan < 1) return &Netdata::dec_none;
+    switch (sform)
+    {
+    case FM_16BIT: return dec_select <FM_16BIT> (nchan);
+    case FM_24BIT: return dec_select <FM_24BIT> (nchan);
+    case FM_FLOAT: return dec_select <FM_FLOAT> (nchan);
+    case FM_PFLOAT: return dec_select <FM_PFLOAT> (nchan);
+    case FM_P32BIT: return dec_select <FM_P32BIT> (nchan);
+    case FM_20BIT: return dec_select <FM_20BIT> (nchan);
+    case FM_HALF: return dec_select <FM_HALF> (nchan);
+    case FM_BFP12: return dec_select <FM_BFP12> (nchan);
+    case FM_BFP16: return dec_select <FM_BFP16> (nchan);
+    case FM_LL24: return &Netdata::dec_lossless;
+    }
+    return &Netdata::dec_none;
+}
+
+
+template <int F>
+Netdata::Encoder Netdata::enc_select (int nchan)
+{
+    switch (nchan)
+    {
+    case  1: return &Netdata::enc_frames <F,  1>;
+    case  2: return &Netdata::enc_frames <F,  2>;
+    case  8: return &Netdata::enc_frames <F,  8>;
+    case 16: return &Netdata::enc_frames <F, 16>;
+    case 32: return &Netdata::enc_frames <F, 32>;
+    case 64: return &Netdata::enc_frames <F, 64>;
+    }
+    return &Netdata::enc_frames <F, 0>;
+}
+
+
+template <int F>
+Netdata::Decoder Netdata::dec_select (int nchan)
+{
+    switch (nchan)
+    {
+    case  1: return &Netdata::dec_frames <F,  1>;
+    case  2: return &Netdata::dec_frames <F,  2>;
+    case  8: return &Netdata::dec_frames <F,  8>;
+    case 16: return &Netdata::dec_frames <F, 16>;
+    case 32: return &Netdata::dec_frames <F, 32>;
+    case 64: return &Netdata::dec_frames <F, 64>;
+    }
+    return &Netdata::dec_frames <F, 0>;
+}
+
+
+// Encoder for F format and N channels, or any number if N is zero.
+// This is done in tiles of a few kB: the input is interleaved into a
+// local buffer which is then converted into the packet in a single
+// sequential pass. This avoids walking the entire packet once for
+// each channel. Planar formats need no interleaving. For block
+// floating point the scaling is done while interleaving.
+//
+template <int F, int N>
+void Netdata::enc_frames (int offs, int nfram, const float * const *adata)
+{
+    int            c, i, j, n, s;
+    float          *t, tile [TILESIZE];
+    float          g0, g1, g2, g3, gain [MAXPCHAN];
+    const float    *p0, *p1, *p2, *p3;
+    unsigned char  *q;
+
+    const int  nch = N ? N : pchan ();
+    const int  k = TILESIZE / nch;
+
+    if (Sform <F>::PLANAR)
+    {
+	// Clear the padding after each block as well.
+	n = getint (NFRAM);
+	s = pstride (n);
+	q = _data + pbase ();
+	for (c = 0; c < nch; c++)
 	{
-	    adata [i * astep] = f [i * nch];
+	    Sform <F>::enc (q, offs, adata [c], nfram);
+	    memset (q + 4 * n, 0, s - 4 * n);
+	    q += s;
 	}
-	break;
-#else
-    case FM_FLOAT:
-	p = _data + ADATA + 4 * (nch * offs + chan);
-	q = (unsigned char *) adata;
-	for (i = 0; i < nsamp; i++)
+	return;
+    }
+    q = _data + abase ();
+    if (Sform <F>::BFP)
+    {
+	// Exponents are set as in put_bfp (), samples follow them.
+	for (c = 0; c < nch; c++)
 	{
-	    q [0] = p [3];
-	    q [1] = p [2];
-	    q [2] = p [1];
-	    q [3] = p [0];
-	    p += 4 * nch;
-	    q += 4 * astep;
+	    if (offs == 0) q [c] = bfp_exp (sconv->peak (adata [c], nfram));
+	    gain [c] = bfp_gain (q [c]);
+	}
+	q += nch;
+    }
+    else if (nch == 1)
+    {
+	// Nothing to interleave.
+	Sform <F>::enc (q, offs, adata [0], nfram);
+	if ((F == FM_20BIT) || (F == FM_BFP12)) clr_nibble ();
+	return;
+    }
+    for (i = 0; i < nfram; i += n)
+    {
+	n = nfram - i;
+	if (n > k) n = k;
+	// Interleave, four channels at a time.
+	for (c = 0; c + 4 <= nch; c += 4)
+	{
+	    p0 = adata [c] + i;
+	    p1 = adata [c + 1] + i;
+	    p2 = adata [c + 2] + i;
+	    p3 = adata [c + 3] + i;
+	    t = tile + c;
+	    if (Sform <F>::BFP)
+	    {
+		g0 = gain [c];
+		g1 = gain [c + 1];
+		g2 = gain [c + 2];
+		g3 = gain [c + 3];
+		for (j = 0; j < n; j++)
+		{
+		    t [0] = g0 * p0 [j];
+		    t [1] = g1 * p1 [j];
+		    t [2] = g2 * p2 [j];
+		    t [3] = g3 * p3 [j];
+		    t += nch;
+		}
+		continue;
+	    }
+	    for (j = 0; j < n; j++)
+	    {
+		t [0] = p0 [j];
+		t [1] = p1 [j];
+		t [2] = p2 [j];
+		t [3] = p3 [j];
+		t += nch;
+	    }
+	}
+	for (; c < nch; c++)
+	{
+	    p0 = adata [c] + i;
+	    g0 = Sform <F>::BFP ? gain [c] : 1.0f;
+	    t = tile + c;
+	    for (j = 0; j < n; j++)
+	    {
+		t [0] = Sform <F>::BFP ? g0 * p0 [j] : p0 [j];
+		t += nch;
+	    }
+	}
+	// Convert the tile into the packet.
+	Sform <F>::enc (q, nch * (offs + i), tile, n * nch);
+    }
+    if ((F == FM_20BIT) || (F == FM_BFP12)) clr_nibble ();
+}
+
+
+// Decoder for F format and N channels, or any number if N is zero.
+// If the selected channels are contiguous they are decoded directly,
+// otherwise the used range is decoded into a local tile first and
+// then gathered from there. Either way the packet is read in a single
+// sequential pass. Planar formats are decoded one channel at a time.
+// Block floating point always uses the tile, and the samples are
+// scaled while gathering them.
+//
+template <int F, int N>
+void Netdata::dec_frames (int offs, int nfram, float *adata, int astep, int nmap, const int *cmap) const
+{
+    int            c, i, j, k, m, n, s, w, x;
+    float          *t, tile [TILESIZE], gain [MAXPCHAN];
+    unsigned char  *p;
+
+    const int  nch = N ? N : pchan ();
+
+    if (nmap == 0) return;
+    if (Sform <F>::PLANAR)
+    {
+	s = pstride (getint (NFRAM));
+	p = _data + pbase ();
+	for (m = 0; m < nmap; m++) Sform <F>::dec (adata + m, astep, p + cmap [m] * s, offs, nfram);
+	return;
+    }
+    // Range of packet channels used, and index of the first sample.
+    c = cmap [0];
+    w = cmap [nmap - 1] - c + 1;
+    p = _data + abase ();
+    x = nch * offs + c;
+    if (Sform <F>::BFP)
+    {
+	for (m = 0; m < nmap; m++) gain [m] = 1.0f / bfp_gain (p [cmap [m]]);
+	p += nch;
+    }
+    else if (w == nmap)
+    {
+	if ((w == nch) && (w == astep))
+	{
+	    // All channels, in packet order.
+	    Sform <F>::dec (adata, 1, p, x, nfram * nch);
+	    return;
+	}
+	for (i = 0; i < nfram; i++)
+	{
+	    Sform <F>::dec (adata, 1, p, x, w);
+	    adata += astep;
+	    x += nch;
+	}
+	return;
+    }
+    k = TILESIZE / w;
+    for (i = 0; i < nfram; i += n)
+    {
+	n = nfram - i;
+	if (n > k) n = k;
+	// Decode the used channel range.
+	if (w == nch) Sform <F>::dec (tile, 1, p, x, n * w);
+	else
+	{
+	    for (j = 0; j < n; j++) Sform <F>::dec (tile + j * w, 1, p, x + j * nch, w);
+	}
+	x += n * nch;
+	// Gather selected channels.
+	t = tile;
+	for (j = 0; j < n; j++)
+	{
+	    if (Sform <F>::BFP)
+	    {
+		for (m = 0; m < nmap; m++) adata [m] = gain [m] * t [cmap [m] - c];
+	    }
+	    else
+	    {
+		for (m = 0; m < nmap; m++) adata [m] = t [cmap [m] - c];
+	    }
+	    adata += astep;
+	    t += w;
 	}
-	break;
-#endif
     }
 }
 
+
+// Lossless encoder. A packet is coded only if written by a single
+// call, otherwise and if coding doesn't help it is sent in the 24-bit
+// format. Any further calls then find that format in the packet.
+//
+void Netdata::enc_lossless (int offs, int nfram, const float * const *adata)
+{
+    if (_data [SFORM] == FM_LL24)
+    {
+	if ((offs == 0) && (nfram == getint (NFRAM)) && put_lossless (nfram, adata)) return;
+	set_24bit ();
+    }
+    (this->*encoder (FM_24BIT, pchan ())) (offs, nfram, adata);
+}
+
+
+// Lossless decoder, one channel at a time.
+//
+void Netdata::dec_lossless (int offs, int nfram, float *adata, int astep, int nmap, const int *cmap) const
+{
+    int  m;
+
+    for (m = 0; m < nmap; m++) get_lossless (cmap [m], offs, nfram, adata + m, astep);
+}
+
+
+// Used for unknown sample formats.
+//
+void Netdata::enc_none (int, int, const float * const *)
+{
+}
+
+
+void Netdata::dec_none (int, int nfram, float *adata, int astep, int nmap, const int *) const
+{
+    int  i;
+
+    if (nmap == astep) memset (adata, 0, nfram * astep * sizeof (float));
+    else
+    {
+	for (i = 0; i < nfram; i++) memset (adata + i * astep, 0, nmap * sizeof (float));
+    }
+}
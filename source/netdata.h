@@ -25,7 +25,60 @@
 #include <stdint.h>
  
 // This class defines the encoding of network packets.
-// All data uses network byte order. 
+// All header fields use network byte order. Samples are big-endian
+// and interleaved, the packed 20-bit format stores each pair of
+// samples as a 40-bit word. The planar formats are the exception:
+// these store each channel as a block of little-endian samples,
+// starting at offset PDATA and padded to a multiple of 16 bytes,
+// so all blocks are aligned and can be used directly by vector code.
+//
+// Block floating point formats start with an exponent byte e for each
+// channel, followed by interleaved integer samples of 12 or 16 bits,
+// the 12-bit ones packed in pairs. The value of a sample is x / 2^e,
+// where x is decoded as for the integer formats.
+//
+// The lossless format codes the samples of the 24-bit format. A table
+// of 16-bit block sizes, one for each channel, is followed by the
+// blocks themselves, see lossless.h. Packets that would be larger than
+// in the 24-bit format are sent in that format instead, so the
+// sample format can change from one packet to the next.
+//
+// Opus packets contain a single Opus multistream packet for all
+// channels, see opuscodec.h, preceded by its size and, if the packet
+// is timed, the offset of the sender's period start in this packet.
+//
+// Streams of more than MAXPCHAN channels are divided into groups of
+// channels, and each packet contains the frames of a single group.
+// Smaller groups may be used, e.g. to send each on its own multicast
+// address, and then the first packet of each group in a period is
+// timed.
+// Packets with the FL_GROUP flag set have two 16-bit fields after the
+// header: the first channel of the group and the number of channels
+// in the stream. The NCHAN field is the number of channels in the
+// group, and the sample data is as for a stream of that many channels.
+// In the descriptor NCHAN is zero for such streams, and the number of
+// channels follows the timestamp.
+//
+// If the FL_CMASK flag is set, a 64-bit mask of the channels present
+// in the packet (or group) follows, and only those channels are sent.
+// The packet is otherwise the same as one with only the channels
+// present, and all channel numbers used by the encoding functions
+// refer to these. Channels not present are silent.
+//
+// A stream striped over several network paths has the FL_SEQ flag
+// set in its data packets, with a 32-bit sequence number after the
+// channel mask. Packet s is sent on path s % n, where n is given by
+// the descriptor, following the number of channels. Unnumbered
+// packets are sent on all paths.
+//
+// The sample data starts after these optional fields, except for the
+// planar formats which use the reserved bytes for them, or if these
+// are not enough, start 16 bytes later. Opus packets use none of them.
+//
+// A receiver of a unicast stream can send a subscription packet back
+// to the sender, with a mask of the channels it uses: channel c is bit
+// c % 8 of byte c / 8 after the header. The sender then leaves out the
+// other channels, using the channel mask.
 //
 class Netdata
 {
@@ -36,23 +89,36 @@ public:
 
     friend class Netrx;
     
-    enum { MAXCHAN = 64 };
+    enum { MAXCHAN = 256, MAXPCHAN = 64 };  // Per stream, per packet.
+    enum { MAXGROUP = 64 };                 // Channel groups per stream.
     enum
     {
         FM_16BIT,
         FM_24BIT,
         FM_FLOAT,
+        FM_PFLOAT,  // Planar 32-bit float.
+        FM_P32BIT,  // Planar 32-bit integer.
+        FM_20BIT,   // Packed 20-bit integer.
+        FM_HALF,    // IEEE half float.
+        FM_BFP12,   // Block floating point, 12-bit mantissa.
+        FM_BFP16,   // Block floating point, 16-bit mantissa.
+        FM_LL24,    // Lossless compressed 24-bit integer.
+        FM_OPUS     // Opus, all channels in one multistream packet.
     };
     enum
     {
         TY_ADESC,  // Audio descriptor packet.
-        TY_ADATA   // Audio sample data packet.
+        TY_ADATA,  // Audio sample data packet.
+        TY_CSUBS   // Channel subscription, receiver to sender.
     };
     enum
     {
         FL_TIMED  = 0x01, // Valid dtime field, start of period.
         FL_SUSP   = 0x02, // Transmission is suspended.
 	FL_SKIP   = 0x04, // Token packet for skipped frames.
+	FL_CMASK  = 0x08, // Channel mask, not all channels present.
+	FL_GROUP  = 0x10, // Packet contains a group of channels.
+	FL_SEQ    = 0x20, // Packet sequence number, stream is striped.
         FL_TERM   = 0x80  // Sender terminates.
     };
 
@@ -64,12 +130,19 @@ public:
     void init_audio_data (int flags, int sform, int nchan, int count, int nfram, int dtime);
     void set_flags (int flags) { _data [FLAGS] = flags; }
     void set_tmark (int32_t tfcnt, uint32_t tsecs, uint32_t tfrac);
+    void set_group (int cbase, int nchan);  // Must follow init_audio_data ().
+    void set_cmask (uint64_t cmask);  // Idem, and set_group () if used.
+    void set_seqnum (uint32_t seqnum);  // Idem, and set_cmask () if used.
+    void set_npath (int npath);  // Descriptor, number of paths if striped.
+    void init_subscr (const int *chlist);  // List ends with a negative value.
 
     int check_ptype (void) const;
     int get_ptype (void) const { return _data [PTYPE]; }   // Packet type (TY_xxx)
     int get_flags (void) const { return _data [FLAGS]; }   // Various flags (FL_xxx)
     int get_sform (void) const { return _data [SFORM]; }   // Sample format (FM_xxx)
-    int get_nchan (void) const { return _data [NCHAN]; }   // Number of channels.
+    int get_nchan (void) const;                            // Number of channels in the stream.
+    int get_gchan (void) const { return _data [NCHAN]; }   // Number of channels in the packet's group.
+    int get_cbase (void) const;                            // First channel in the packet's group.
     int get_psmax (void) const { return getint (PSMAX); }  // Maximum packet size.
     int get_fsamp (void) const { return getint (FSAMP); }  // Sender sample frequency.
     int get_fsize (void) const { return getint (FSIZE); }  // Sender period size.
@@ -79,11 +152,38 @@ public:
     int get_count (void) const { return getint (COUNT); }  // Frame count, used to check continuity.
     int get_nfram (void) const { return getint (NFRAM); }  // Number of frames in this packet.
     int get_dtime (void) const { return getint (DTIME); }  // Transmit delay in usecs.  
+    int get_toffs (void) const;  // Frame offset of the period start in timed packets.
+    uint64_t get_cmask (void) const;  // Channels present in this packet.
+    int get_subscr (uint64_t *smask, int len) const;  // MAXCHAN / 64 words, -1 if invalid.
+    int get_npath (void) const;  // Descriptor, number of paths.
+    uint32_t get_seqnum (void) const;  // Data packet sequence number.
+    bool numbered (void) const { return (_data [PTYPE] == TY_ADATA) && (xflags () & FL_SEQ); }
+
+    // Opus packets, the encoded data is written and read directly.
+    void set_opus (int toffs, int osize);
+    int get_osize (void) const;
+    unsigned char *opus_data (void) const { return _data + ODATA; }
+    int opus_maxsize (void) const { return _size - ODATA; }
+    static int opus_maxsize (int psize) { return psize - ODATA; }
 
     void put_audio (int chan, int offs, int nsamp, const float *adata, int astep);
+    void put_frames (int offs, int nfram, const float * const *adata);
     void get_audio (int chan, int offs, int nsamp, float *adata, int astep) const;
+    void get_frames (int offs, int nfram, float *adata, int astep, int nmap, const int *cmap) const;
 
-    static int packetsperperiod (int maxsize, int period, int sform, int nchan);
+    // Multichannel codec functions, see put_frames () and get_frames ().
+    typedef void (Netdata::*Encoder) (int offs, int nfram, const float * const *adata);
+    typedef void (Netdata::*Decoder) (int offs, int nfram, float *adata, int astep, int nmap, const int *cmap) const;
+
+    static Encoder encoder (int sform, int nchan);
+    static Decoder decoder (int sform, int nchan);
+
+    static int packetsperperiod (int maxsize, int period, int sform, int nchan, int flags);
+    static int ngroups (int nchan) { return (nchan + MAXPCHAN - 1) / MAXPCHAN; }
+    static int groupsize (int nchan) { return (nchan + ngroups (nchan) - 1) / ngroups (nchan); }
+    static int sampbits (int sform);  // Bits per sample, zero if unknown.
+    static bool planar (int sform) { return (sform == FM_PFLOAT) || (sform == FM_P32BIT); }
+    static bool blockfp (int sform) { return (sform == FM_BFP12) || (sform == FM_BFP16); }
 
 private:
 
@@ -105,16 +205,66 @@ private:
 	TFCNT = 20,
 	TSECS = 24,
 	TFRAC = 28,
-	DPEND = 32,
+	DCHAN = 32,
+	DPEND = 36,
+	DPATH = 36,         // If FL_SEQ is set.
+
+	// Subscription packet
+	SMASK = 8,
+	SPEND = SMASK + MAXCHAN / 8,
 
 	// Sample data packet
 	COUNT = 8,
 	NFRAM = 12,
 	DTIME = 16,
-	ADATA = 20
+	ADATA = 20,         // Interleaved formats.
+	PDATA = 32,         // Planar formats, 12 bytes reserved.
+	CBASE = 20,         // Channel group, if FL_GROUP is set.
+	CTOTL = 22,
+
+	// Opus data packet
+	TOFFS = 20,
+	OSIZE = 22,
+	ODATA = 24
     };
 
+    // Size of a channel block in planar formats.
+    static int pstride (int nfram) { return (4 * nfram + 15) & ~15; }
+
+    // Start of the data for interleaved formats, for the given flags.
+    static int abase (int flags)
+    {
+	return ADATA + ((flags & FL_GROUP) ? 4 : 0) + ((flags & FL_CMASK) ? 8 : 0) + ((flags & FL_SEQ) ? 4 : 0);
+    }
+    // Idem for planar formats.
+    static int pbase (int flags) { return (abase (flags) > PDATA) ? PDATA + 16 : PDATA; }
+    // Flags for optional fields used by this packet.
+    int xflags (void) const { return (_data [SFORM] == FM_OPUS) ? 0 : _data [FLAGS] & (FL_GROUP | FL_CMASK | FL_SEQ); }
+    bool grouped (void) const { return xflags () & FL_GROUP; }
+    bool masked (void) const { return xflags () & FL_CMASK; }
+    int abase (void) const { return abase (xflags ()); }
+    int pbase (void) const { return pbase (xflags ()); }
+    int mbase (void) const { return abase (xflags () & FL_GROUP); }
+    int sbase (void) const { return abase (xflags () & (FL_GROUP | FL_CMASK)); }
+    // Number of channels in the packet.
+    int pchan (void) const { return masked () ? __builtin_popcountll (get_cmask ()) : _data [NCHAN]; }
+
     void init_header (int ptype, int flags, int sform, int nchan);
+    void set_dlen (void);
+    void put_bfp (int chan, int offs, int nsamp, const float *adata, int astep);
+    void clr_nibble (void);
+    void set_24bit (void);
+    bool put_lossless (int nfram, const float * const *adata);
+    void get_lossless (int chan, int offs, int nsamp, float *adata, int astep) const;
+
+    template <int F> static Encoder enc_select (int nchan);
+    template <int F> static Decoder dec_select (int nchan);
+    template <int F, int N> void enc_frames (int offs, int nfram, const float * const *adata);
+    template <int F, int N> void dec_frames (int offs, int nfram, float *adata, int astep, int nmap, const int *cmap) const;
+    void enc_lossless (int offs, int nfram, const float * const *adata);
+    void dec_lossless (int offs, int nfram, float *adata, int astep, int nmap, const int *cmap) const;
+    void enc_none (int offs, int nfram, const float * const *adata);
+    void dec_none (int offs, int nfram, float *adata, int astep, int nmap, const int *cmap) const;
 
     // Used for header fields, always big-endian.
     // Put a 32-bit integer.
@@ -138,7 +288,8 @@ private:
 
     int             _size;  // Allocated size.
     int             _dlen;  // Used size.
-    unsigned char  *_data;
+    unsigned char  *_data;  // Aligned to 16 bytes.
+    unsigned char  *_buff;  // As allocated.
 };
 
 
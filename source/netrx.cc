@@ -22,14 +22,42 @@
 #include <string.h>
 #include <stdint.h>
 #include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/socket.h>
+#ifdef __linux__
+#include <poll.h>
+#include <netinet/udp.h>
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#endif
 #include <jack/jack.h>
 #include "zsockets.h"
 #include "timers.h"
 #include "netrx.h"
 
 
+// Keys of the io_uring requests.
+#define RECV_KEY 1
+#define HUP_KEY  2
+
+// Time a missing packet of a striped stream is waited for,
+// counted from the arrival of the first one after it.
+#define MAXSKEW 2e-3
+
+
 Netrx::Netrx (void) :
-    _state (INIT)
+    _state (INIT),
+    _xdp (0),
+    _shm (0),
+    _uring (0),
+    _busy (0),
+    _cpu (-1),
+    _tpoll (0),
+    _npoll (0),
+    _nrecv (0),
+    _npath (1)
 {
 }
 
@@ -39,16 +67,66 @@ Netrx::~Netrx (void)
 }
 
 
+// The buffers are allocated here, and deleted when the receiver
+// thread terminates.
+//
+int Netrx::set_uring (Uring *uring, int psmax)
+{
+    int             i;
+    unsigned char  *A [NUBUF];
+
+    _uring = 0;
+    if (! uring) return 0;
+    for (i = 0; i < NUBUF; i++)
+    {
+	_ubuff [i] = new Netdata (psmax);
+	A [i] = _ubuff [i]->data ();
+    }
+    if (uring->reg_bufring (A, NUBUF, psmax))
+    {
+	for (i = 0; i < NUBUF; i++) delete _ubuff [i];
+	return 1;
+    }
+    _uring = uring;
+    return 0;
+}
+
+
+// The buffers are allocated here, and deleted when the receiver
+// thread terminates.
+//
+void Netrx::set_stripe (int npath, int psmax)
+{
+    int  i;
+
+    if (npath > MAXPATH) npath = MAXPATH;
+    _npath = npath;
+    if (npath < 2) return;
+    for (i = 0; i < NHOLD; i++)
+    {
+	_hold [i] = new Netdata (psmax);
+	_hused [i] = false;
+    }
+    _nheld = 0;
+    _sinit = true;
+}
+
+
 int Netrx::start (Lfq_audio     *audioq,
                   Lfq_int32     *commq,
                   Lfq_timedata  *timeq,
 		  int           *chlist,
+		  int            sform,
+		  int            nchan,
 		  int            psmax,
 		  int            fsamp,
 		  int            fsize,
                   int            rtprio,
-		  int            sockfd)
+		  int            sockfd,
+		  bool           ktime)
 {
+    int  c, i;
+
     _audioq = audioq;
     _commq  = commq;
     _timeq  = timeq;
@@ -56,7 +134,23 @@ int Netrx::start (Lfq_audio     *audioq,
     _fsamp  = fsamp;
     _fsize  = fsize;
     _sockfd = sockfd;
-    _packet = new Netdata (psmax);
+    for (i = 0; i < MAXRECV; i++) _packet [i] = new Netdata (psmax);
+    _gro = !_shm && !_xdp && !_uring && (sock_set_udp_gro (sockfd, true) == 0);
+    _ktime = !_shm && !_xdp && !_uring && ktime && (sock_set_timestamp (sockfd, true) == 0);
+    _nused = 0;
+    _armed = false;
+    _hupreq = false;
+    _gbuff = _gro ? new unsigned char [MAXGRO * GROSIZE] : 0;
+    // Index of the first selected channel not less than c.
+    for (c = i = 0; c <= Netdata::MAXCHAN; c++)
+    {
+	while ((i < _audioq->nchan ()) && (_chlist [i] < c)) i++;
+	_qidx [c] = i;
+    }
+    _chrep = 0;
+    _npend = 0;
+    _ncp = -1;
+    set_decoder (sform, nchan);
 
     // Compute DLL filter coefficients.
     _dt = (double) _fsize / fsamp;
@@ -64,127 +158,641 @@ int Netrx::start (Lfq_audio     *audioq,
     _w2 = _w1 * _w1;
     _w1 *= 3.0;
 
-    // Start the receiver thread.
-    if (thr_start (SCHED_FIFO, rtprio, 0x10000)) return 1;
+    // Start the receiver thread. The stack size
+    // allows for the Opus decoder.
+    if (thr_start (SCHED_FIFO, rtprio, 0x40000)) return 1;
     return 0;
 }
 
 
 void Netrx::thr_main (void)
 {
-    int     rv, pt, fl, fc, dc;
-    double  tr, err;
+    int  i, n;
 
+#ifdef __linux__
+    cpu_set_t  cpus;
+
+    if (_cpu >= 0)
+    {
+	CPU_ZERO (&cpus);
+	CPU_SET (_cpu, &cpus);
+	pthread_setaffinity_np (pthread_self (), sizeof (cpus), &cpus);
+    }
+#endif
     _state = WAIT;
     while (_state < TERM)
     {
-        // Wait for packet, get timestamp.
-	rv = recv (_sockfd, _packet->data (), _packet->size (), 0);
-        tr = tjack (jack_get_time ());
+        // Wait for packets.
+	n = receive ();
 	
 	// Check socket status.
-	if (rv <= 0)
+	if (n <= 0)
 	{
 	    _state = FAIL;
 	    send (_state, 0, 0.0, 0, 0);
 	    break;
 	}
 
-	// Basic packet validity check.
-	pt = _packet->check_ptype ();
-	if (pt < 0) continue;
+	// Process packets in the order received.
+	for (i = 0; (i < n) && (_state < TERM); i++)
+	{
+	    if (_gro) process_gro (i);
+	    else if (_uring) deliver (_ubuff [_ubid [i]], _trecv [i]);
+	    else deliver (_packet [i], _trecv [i]);
+	}
+    }
+    
+    if (_uring) close_uring ();
+    if (_npath > 1) for (i = 0; i < NHOLD; i++) delete _hold [i];
+    for (i = 0; i < MAXRECV; i++) delete _packet [i];
+    delete[] _gbuff;
+    _state = INIT;
+}
+
 
-	// Check for termination or suspend.
-        fl = _packet->get_flags ();
-	if (fl & Netdata::FL_TERM)
+// Wait for at least one packet, then take all others that are
+// already available, up to MAXRECV. The receive time is taken
+// when the call returns, for the first packet this is the same
+// as when using recv (). Packets that were waiting have arrived
+// before that, but the sender marks only the first packet of a
+// period as timed and the time between these is normally longer
+// than a receive call.
+//
+// If kernel timestamps are used, each packet's receive time is
+// instead the Jack time when the call returns minus the age of
+// its timestamp. This excludes the wakeup latency of this thread.
+//
+// In busy mode, the socket is polled until a packet is available
+// or the time set by set_busy () expires, and only then does this
+// block. This avoids the wakeup latency, at the cost of CPU time.
+//
+// If GRO is used the kernel may combine datagrams of the same
+// size, which are split again by process_gro (). All packets
+// from one such datagram have the same receive time.
+//
+int Netrx::receive (void)
+{
+    int     i, n;
+    double  tr;
+
+    if (_shm) return receive_shm ();
+    if (_xdp) return receive_xdp ();
+    if (_uring) return receive_uring ();
+
+#ifdef __linux__
+    int              m;
+    double           age;
+    struct iovec     V [MAXRECV];
+    struct mmsghdr   H [MAXRECV];
+    struct cmsghdr  *C;
+    double           t0, t1;
+    struct timespec  tk, tn, tp;
+    char             cbuf [MAXRECV][CMSG_SPACE (sizeof (int)) + CMSG_SPACE (sizeof (struct timespec))];
+
+    m = _gro ? MAXGRO : MAXRECV;
+    memset (H, 0, m * sizeof (struct mmsghdr));
+    for (i = 0; i < m; i++)
+    {
+	if (_gro)
 	{
-	    _state = TERM;
-	    send (_state, 0, 0.0, 0, 0);
-	    break;
+	    V [i].iov_base = _gbuff + i * GROSIZE;
+	    V [i].iov_len = GROSIZE;
 	}
-	if (fl & Netdata::FL_SUSP)
+	else
 	{
-	    _state = WAIT;
-	    send (_state, 0, 0.0, 0, 0);
-	    continue;
+	    V [i].iov_base = _packet [i]->data ();
+	    V [i].iov_len = _packet [i]->size ();
 	}
+	H [i].msg_hdr.msg_iov = V + i;
+	H [i].msg_hdr.msg_iovlen = 1;
+	if (_gro || _ktime)
+	{
+	    H [i].msg_hdr.msg_control = cbuf [i];
+	    H [i].msg_hdr.msg_controllen = sizeof (cbuf [i]);
+	}
+    }
+    n = -1;
+    if (_busy)
+    {
+	// Poll for up to _busy microseconds before blocking.
+	clock_gettime (CLOCK_MONOTONIC, &tp);
+	t0 = tp.tv_sec + 1e-9 * tp.tv_nsec;
+	do
+	{
+	    n = recvmmsg (_sockfd, H, m, MSG_DONTWAIT, 0);
+	    clock_gettime (CLOCK_MONOTONIC, &tp);
+	    t1 = tp.tv_sec + 1e-9 * tp.tv_nsec;
+	}
+	while ((n < 0) && (errno == EAGAIN) && (t1 - t0 < 1e-6 * _busy));
+	_tpoll += t1 - t0;
+	if (n > 0) _npoll += n;
+    }
+    if (n <= 0) n = recvmmsg (_sockfd, H, m, MSG_WAITFORONE, 0);
+    tr = tjack (jack_get_time ());
+    if (n > 0) _nrecv += n;
+    if (_ktime) clock_gettime (CLOCK_REALTIME, &tn);
+    if (n > 0)
+    {
+	// As for recv (), an empty first datagram is a failure.
+	if (H [0].msg_len == 0) n = 0;
+	for (i = 0; i < n; i++)
+	{
+	    _trecv [i] = tr;
+	    // Without a segment size the datagram is not split.
+	    if (_gro) _glen [i] = _gseg [i] = H [i].msg_len;
+	    for (C = CMSG_FIRSTHDR (&(H [i].msg_hdr)); C; C = CMSG_NXTHDR (&(H [i].msg_hdr), C))
+	    {
+		if ((C->cmsg_level == SOL_UDP) && (C->cmsg_type == UDP_GRO))
+		{
+		    memcpy (_gseg + i, CMSG_DATA (C), sizeof (int));
+		}
+		if ((C->cmsg_level == SOL_SOCKET) && (C->cmsg_type == SCM_TIMESTAMPNS))
+		{
+		    memcpy (&tk, CMSG_DATA (C), sizeof (struct timespec));
+		    age = (tn.tv_sec - tk.tv_sec) + 1e-9 * (tn.tv_nsec - tk.tv_nsec);
+		    // Ignore the timestamp if the system clock was changed.
+		    if ((age >= 0) && (age < 1)) _trecv [i] = tr - age;
+		}
+	    }
+	    if (_gro)
+	    {
+		if (_gseg [i] <= 0) _gseg [i] = _glen [i];
+	    }
+	    // Empty datagrams would leave the previous
+	    // data in place, so make them invalid.
+	    else if (H [i].msg_len == 0) _packet [i]->data () [0] = 0;
+	}
+    }
+#else
+    n = recv (_sockfd, _packet [0]->data (), _packet [0]->size (), 0);
+    tr = tjack (jack_get_time ());
+    if (n > 0)
+    {
+	n = 1;
+	_trecv [0] = tr;
+    }
+#endif
+    return n;
+}
 
-	// // Get time marker if descriptor packet.
-	// if ((pt == Netdata::TY_ADESC) && (rv == Netdata::DPEND))
-	// {
-   	//     send (TNTP, _packet->get_tfcnt (), 0.0,
-	// 	  _packet->get_tsecs (), _packet->get_tfrac ());
-	// }
 
-	// Ignore packet if not sample data.
-	if (pt != Netdata::TY_ADATA) continue;
+void Netrx::get_busy (double *tpoll, int *npoll, int *nrecv)
+{
+    *tpoll = _tpoll;
+    *npoll = _npoll;
+    *nrecv = _nrecv;
+}
 
-        // Check for commands from the Jack thread.
-        if (_commq->rd_avail ())
-	{
-	    _state = _commq->rd_int32 ();
-	    if (_state == PROC) _first = true;
-	}
 
-	// Ignore data if not yet active.
-        if (_state != PROC) continue;
+// Packets for the stream may arrive using AF_XDP or, if the XDP
+// program does not redirect them, on the socket. Wait for either
+// and take what is available, polling first in busy mode. The
+// wait times out regularly, so the thread can see the socket is
+// closed.
+//
+int Netrx::receive_xdp (void)
+{
+    int     i, n;
+    double  tr;
 
-        // Apply timing correction from sender.
-        tr -= 1e-6 * _packet->get_dtime ();
+#ifdef __linux__
+    double           t0, t1;
+    struct iovec     V [MAXRECV];
+    struct mmsghdr   H [MAXRECV];
+    struct timespec  tp;
 
-	dc = 0;
-	fc = _packet->get_count ();
-	if (_first)
+    memset (H, 0, MAXRECV * sizeof (struct mmsghdr));
+    for (i = 0; i < MAXRECV; i++)
+    {
+	V [i].iov_base = _packet [i]->data ();
+	V [i].iov_len = _packet [i]->size ();
+	H [i].msg_hdr.msg_iov = V + i;
+	H [i].msg_hdr.msg_iovlen = 1;
+    }
+    clock_gettime (CLOCK_MONOTONIC, &tp);
+    t0 = t1 = tp.tv_sec + 1e-9 * tp.tv_nsec;
+    while (true)
+    {
+	n = _xdp->recv (_packet, MAXRECV);
+	if (n == 0)
 	{
-   	    // First packet must be a timed one.
-	    if (fl & Netdata::FL_TIMED)
+	    n = recvmmsg (_sockfd, H, MAXRECV, MSG_DONTWAIT, 0);
+	    if (n > 0)
 	    {
-   	        _first = false;
-		_audioq->wr_commit (fc);
-	        _t0 = tr;
+		// As for recv (), an empty first datagram is a failure.
+		if (H [0].msg_len == 0) return 0;
+		for (i = 1; i < n; i++) if (H [i].msg_len == 0) _packet [i]->data () [0] = 0;
 	    }
-	    else continue;
+	    else if (errno != EAGAIN) return -1;
 	}
-	else
+	if (n > 0) break;
+	if (_busy && (t1 - t0 < 1e-6 * _busy))
 	{
-	    // Check frame count continuity.
- 	    dc = fc - _audioq->nwr ();
-	    if (dc > 0)
+	    clock_gettime (CLOCK_MONOTONIC, &tp);
+	    t1 = tp.tv_sec + 1e-9 * tp.tv_nsec;
+	    continue;
+	}
+	if (_xdp->wait (_sockfd, 50) < 0) return -1;
+    }
+    tr = tjack (jack_get_time ());
+    if (_busy)
+    {
+	_tpoll += t1 - t0;
+	if (t1 - t0 < 1e-6 * _busy) _npoll += n;
+    }
+    _nrecv += n;
+    for (i = 0; i < n; i++) _trecv [i] = tr;
+#else
+    n = -1;
+#endif
+    return n;
+}
+
+
+// A multishot receive takes packets into the buffers provided to the
+// ring, until it fails or runs out of buffers and is submitted again.
+// The buffers are returned on the next call, when their packets have
+// been processed. As for recvmmsg (), this waits for one packet and
+// takes all others that are available, and the receive time is taken
+// when the wait returns. In busy mode the ring is polled first.
+// A shutdown of the socket is detected by a separate poll request.
+//
+int Netrx::receive_uring (void)
+{
+    int     i, n;
+    double  tr;
+
+#ifdef __linux__
+    double           t0, t1;
+    struct timespec  tp;
+    Uring::Cqe       C;
+
+    for (i = 0; i < _nused; i++) _uring->put_buffer (_ubid [i]);
+    _nused = 0;
+    clock_gettime (CLOCK_MONOTONIC, &tp);
+    t0 = t1 = tp.tv_sec + 1e-9 * tp.tv_nsec;
+    n = 0;
+    while (n == 0)
+    {
+	if (! _armed)
+	{
+	    if (_uring->recv_multi (_sockfd, RECV_KEY)) return -1;
+	    _armed = true;
+	}
+	if (! _hupreq)
+	{
+	    // The receive does not complete when the socket is shut down.
+	    if (_uring->poll (_sockfd, POLLRDHUP, HUP_KEY)) return -1;
+	    _hupreq = true;
+	}
+	if (_busy && (t1 - t0 < 1e-6 * _busy))
+	{
+	    if (_uring->submit (0)) return -1;
+	    clock_gettime (CLOCK_MONOTONIC, &tp);
+	    t1 = tp.tv_sec + 1e-9 * tp.tv_nsec;
+	}
+	else if (_uring->submit (1)) return -1;
+	while ((n < MAXRECV) && _uring->get_cqe (&C))
+	{
+	    if (C._key == HUP_KEY)
 	    {
-		// Missing frames, replace by silence.
-	         write_zeros (dc);
-		 _t0 += (double) dc / _fsamp;
+		_hupreq = false;
+		if ((C._res < 0) || (C._res & (POLLHUP | POLLRDHUP)))
+		{
+		    // As for recv (), the socket was shut down.
+		    _nused = n;
+		    return 0;
+		}
+		continue;
 	    }
-	    if (dc < 0)
+	    if (! C._more) _armed = false;
+	    if (C._bid >= 0)
 	    {
-		// Packet out of order, already
-		// replaced by silence so ignore.
-                continue;
+		_ubid [n++] = C._bid;
+		// Empty datagrams would leave the previous
+		// data in place, so make them invalid.
+		if (C._res == 0) _ubuff [C._bid]->data () [0] = 0;
 	    }
-	    if (fl & Netdata::FL_TIMED)
+	    // Out of buffers, those in use are returned on the next call.
+	    else if (C._res == -ENOBUFS) break;
+	    else if (C._res < 0)
 	    {
-  	        // Update the DLL.
-                err = tjack_diff (tr, _t0);
-	        if (err >  _dt) err =  _dt;
-	        if (err < -_dt) err = -_dt;
-		_t0 += _w1 * err;
-	        _dt += _w2 * err;
+		_nused = n;
+		// Multishot receive is not supported by older kernels.
+		if ((C._res == -EINVAL) && (_nrecv == 0) && (n == 0))
+		{
+		    close_uring ();
+		    return receive ();
+		}
+		return -1;
 	    }
 	}
+    }
+    _nused = n;
+    tr = tjack (jack_get_time ());
+    if (_busy)
+    {
+	_tpoll += t1 - t0;
+	if (t1 - t0 < 1e-6 * _busy) _npoll += n;
+    }
+    _nrecv += n;
+    for (i = 0; i < n; i++) _trecv [i] = tr;
+#else
+    n = -1;
+#endif
+    return n;
+}
+
+
+// Packets are copied from the shared memory ring. As for the socket,
+// this waits for one packet and takes all others that are available,
+// polling first in busy mode. Returns zero when the ring is shut down.
+//
+int Netrx::receive_shm (void)
+{
+    int              i, n;
+    double           tr, t0, t1;
+    struct timespec  tp;
+
+    clock_gettime (CLOCK_MONOTONIC, &tp);
+    t0 = t1 = tp.tv_sec + 1e-9 * tp.tv_nsec;
+    while ((n = _shm->read (_packet, MAXRECV)) == 0)
+    {
+	if (_busy && (t1 - t0 < 1e-6 * _busy))
+	{
+	    clock_gettime (CLOCK_MONOTONIC, &tp);
+	    t1 = tp.tv_sec + 1e-9 * tp.tv_nsec;
+	    continue;
+	}
+	if (_shm->wait ()) return 0;
+    }
+    tr = tjack (jack_get_time ());
+    if (_busy)
+    {
+	_tpoll += t1 - t0;
+	if (t1 - t0 < 1e-6 * _busy) _npoll += n;
+    }
+    _nrecv += n;
+    for (i = 0; i < n; i++) _trecv [i] = tr;
+    return n;
+}
 
+
+// Cancel any active requests and delete the buffers. Buffers in use
+// are not returned, as the ring is no longer used.
+//
+void Netrx::close_uring (void)
+{
+    int  i;
+
+    if (_armed) _uring->cancel (RECV_KEY);
+    if (_hupreq) _uring->cancel (HUP_KEY);
+    _uring->unreg_bufring ();
+    for (i = 0; i < NUBUF; i++) delete _ubuff [i];
+    _uring = 0;
+}
+
+
+// Split a coalesced datagram and process the packets. These are
+// copied as the decoders expect the alignment of a Netdata buffer.
+// As for recv (), packets larger than that buffer are truncated.
+//
+void Netrx::process_gro (int i)
+{
+    int             k, n;
+    unsigned char  *p;
+
+    p = _gbuff + i * GROSIZE;
+    for (n = _glen [i]; (n > 0) && (_state < TERM); n -= _gseg [i])
+    {
+	k = (n < _gseg [i]) ? n : _gseg [i];
+	if (k > _packet [0]->size ()) k = _packet [0]->size ();
+	memcpy (_packet [0]->data (), p, k);
+	deliver (_packet [0], _trecv [i]);
+	p += _gseg [i];
+    }
+}
+
+
+void Netrx::deliver (Netdata *D, double tr)
+{
+    if ((_npath > 1) && (D->check_ptype () == Netdata::TY_ADATA) && D->numbered ()) reorder (D, tr);
+    else process (D, tr);
+}
+
+
+// Packet s of a striped stream is sent on path s % npath. The paths
+// may have different delays, but each is assumed to keep its packets
+// in order. Packets that arrive before some of those preceding them
+// are copied and held. A missing packet is lost if a later one sent
+// on its path has arrived, or if it has not arrived MAXSKEW seconds
+// after the first held one. A packet arriving after it was given up
+// is ignored, as process () would do for one out of order.
+//
+void Netrx::reorder (Netdata *D, double tr)
+{
+    int       i, k;
+    int32_t   d;
+    uint32_t  s;
+
+    s = D->get_seqnum ();
+    d = s - _snext;
+    // Start, or restart if too far from the expected sequence
+    // number, e.g. if the sender was restarted.
+    if (_sinit || (d < -NHOLD) || (d >= 2 * NHOLD))
+    {
+	clear_held ();
+	for (i = 0; i < _npath; i++) _slast [i] = s - 1;
+	_snext = s;
+	_sinit = false;
+	d = 0;
+    }
+    if (d < 0) return;
+    i = s % _npath;
+    if ((int32_t)(s - _slast [i]) > 0) _slast [i] = s;
+    // Make room if the packet is beyond the held ones.
+    while (d >= NHOLD)
+    {
+	i = _snext % NHOLD;
+	if (_hused [i])
+	{
+	    _hused [i] = false;
+	    _nheld--;
+	    process (_hold [i], _thold [i]);
+	}
+	_snext++;
+	d--;
+    }
+    if (d == 0)
+    {
+	process (D, tr);
+	_snext++;
+    }
+    else
+    {
+	i = s % NHOLD;
+	if (! _hused [i])
+	{
+	    D->set_dlen ();
+	    k = D->dlen ();
+	    if ((k <= 0) || (k > _hold [i]->size ())) k = _hold [i]->size ();
+	    memcpy (_hold [i]->data (), D->data (), k);
+	    _thold [i] = tr;
+	    _hused [i] = true;
+	    _nheld++;
+	}
+    }
+    release (tr);
+}
+
+
+// Process the held packets that are next in order, and give up on
+// missing ones that are known to be lost or have waited too long.
+//
+void Netrx::release (double tr)
+{
+    int  i, k;
+
+    while (_nheld && (_state < TERM))
+    {
+	i = _snext % NHOLD;
+	if (_hused [i])
+	{
+	    _hused [i] = false;
+	    _nheld--;
+	    process (_hold [i], _thold [i]);
+	}
+	else if ((int32_t)(_slast [_snext % _npath] - _snext) <= 0)
+	{
+	    // Not yet received on its path, find the first held one.
+	    for (k = 1; ! _hused [(i + k) % NHOLD]; k++);
+	    if (tjack_diff (tr, _thold [(i + k) % NHOLD]) < MAXSKEW) break;
+	}
+	_snext++;
+    }
+}
+
+
+void Netrx::clear_held (void)
+{
+    int  i;
+
+    for (i = 0; i < NHOLD; i++) _hused [i] = false;
+    _nheld = 0;
+}
+
+
+void Netrx::process (Netdata *D, double tr)
+{
+    int     pt, fl, fc, dc;
+    double  err;
+
+    // Basic packet validity check.
+    pt = D->check_ptype ();
+    if (pt < 0) return;
+
+    // Check for termination or suspend.
+    fl = D->get_flags ();
+    if (fl & Netdata::FL_TERM)
+    {
+	_state = TERM;
+	send (_state, 0, 0.0, 0, 0);
+	return;
+    }
+    if (fl & Netdata::FL_SUSP)
+    {
+	_state = WAIT;
+	send (_state, 0, 0.0, 0, 0);
+	return;
+    }
+
+    // // Get time marker if descriptor packet.
+    // if ((pt == Netdata::TY_ADESC) && (rv == Netdata::DPEND))
+    // {
+    //     send (TNTP, D->get_tfcnt (), 0.0,
+    //        D->get_tsecs (), D->get_tfrac ());
+    // }
+
+    // Ignore packet if not sample data.
+    if (pt != Netdata::TY_ADATA) return;
+
+    // Check for commands from the Jack thread.
+    if (_commq->rd_avail ())
+    {
+	_state = _commq->rd_int32 ();
+	if (_state == PROC)
+	{
+	    _first = true;
+	    _npend = 0;
+	}
+    }
+
+    // Ignore data if not yet active.
+    if (_state != PROC) return;
+
+    // Apply timing correction from sender.
+    tr -= 1e-6 * D->get_dtime ();
+
+    dc = 0;
+    fc = D->get_count ();
+    // If channel groups are sent separately, the first packet
+    // of each group is timed. Only the first one is used.
+    if (fl & Netdata::FL_TIMED)
+    {
+	if (! _first && (fc == _tfc)) fl &= ~Netdata::FL_TIMED;
+	else _tfc = fc;
+    }
+    if (_first)
+    {
+	// First packet must be a timed one.
 	if (fl & Netdata::FL_TIMED)
 	{
-	    // Send timing data to Jack thread and update DLL.
-	    send (_state, _audioq->nwr (), _t0, 0, 0);
-  	    _t0 = tjack_diff (_t0, -_dt);
+	    _first = false;
+	    _audioq->wr_commit (fc);
+	    _opdec.reset ();
+	    _t0 = tr;
 	}
+	else return;
+    }
+    else
+    {
+	// Packets for other channels of the same frames have the
+	// same count, frames are committed when this changes.
+	if (_npend && (fc != _audioq->nwr ())) commit ();
+	// Check frame count continuity.
+	dc = fc - _audioq->nwr ();
+	if (dc > 0)
+	{
+	    // Missing frames, replace by silence.
+	     write_lost (dc);
+	     _t0 += (double) dc / _fsamp;
+	}
+	if (dc < 0)
+	{
+	    // Packet out of order, already
+	    // replaced by silence so ignore.
+	    return;
+	}
+	if (fl & Netdata::FL_TIMED)
+	{
+	    // Update the DLL.
+	    err = tjack_diff (tr, _t0);
+	    if (err >  _dt) err =  _dt;
+	    if (err < -_dt) err = -_dt;
+	    _t0 += _w1 * err;
+	    _dt += _w2 * err;
+	}
+    }
 
-	// Write samples to queue.
-	write_audio (_packet);
+    if (fl & Netdata::FL_TIMED)
+    {
+	// Send timing data to Jack thread and update DLL.
+	send (_state, _audioq->nwr () + D->get_toffs (), _t0, 0, 0);
+	_t0 = tjack_diff (_t0, -_dt);
     }
-    
-    delete _packet;
-    _state = INIT;
+
+    // Write samples to queue.
+    write_audio (D);
 }
 
 
@@ -213,43 +821,152 @@ void Netrx::send (int flags, int32_t count, double tjack, uint32_t tsecs, uint32
 // and being used in this way. 
 
 
+void Netrx::set_decoder (int sform, int nchan)
+{
+    int  i;
+
+    if (nchan != _ncp)
+    {
+	if (_npend) commit ();
+	for (i = 0; i < NCHMAP; i++) _chmap [i]._cbase = -1;
+    }
+    _sfp = sform;
+    _ncp = nchan;
+    _opok = false;
+    if (sform == Netdata::FM_OPUS)
+    {
+	// Only done when starting or if the sender changes format.
+	_opok = ! _opdec.init (_fsamp, nchan);
+	_opfr = _fsamp / 400;
+    }
+    // Channels used by Opus, which doesn't use groups.
+    _nmap = _qidx [nchan];
+}
+
+
+// Find the selected channels in the packet's channel group, their
+// index in the packet if present, and the decoder. The maps for a
+// few groups and sample formats are kept, so normally this is done
+// once for each group.
+// If some selected channels are missing in the packet, the decoded
+// ones have to be moved to their slot in the audio queue.
+//
+Netrx::Chanmap *Netrx::chanmap (Netdata *D)
+{
+    int       i, k, cb, nc;
+    uint64_t  b, cm;
+    Chanmap   *M;
+
+    cb = D->get_cbase ();
+    nc = D->get_gchan ();
+    cm = D->get_cmask ();
+    for (i = 0; i < NCHMAP; i++)
+    {
+	M = _chmap + i;
+	if ((M->_cbase == cb) && (M->_nchan == nc) && (M->_cmask == cm) && (M->_sform == _sfp)) return M;
+    }
+    M = _chmap + _chrep;
+    _chrep = (_chrep + 1) % NCHMAP;
+    M->_sform = _sfp;
+    M->_cbase = cb;
+    M->_nchan = nc;
+    M->_cmask = cm;
+    M->_qbase = _qidx [cb];
+    M->_nmap = 0;
+    M->_gaps = false;
+    for (i = M->_qbase; i < _qidx [cb + nc]; i++)
+    {
+	k = i - M->_qbase;
+	b = (uint64_t) 1 << (_chlist [i] - cb);
+	if (! (cm & b)) continue;
+	M->_cmap [M->_nmap] = __builtin_popcountll (cm & (b - 1));
+	M->_slot [M->_nmap] = k;
+	if (k != M->_nmap) M->_gaps = true;
+	M->_nmap++;
+    }
+    M->_full = (M->_nmap == _audioq->nchan ());
+    M->_decode = Netdata::decoder (_sfp, __builtin_popcountll (cm));
+    return M;
+}
+
+
 int Netrx::write_audio (Netdata *D)
 {
-    int    i, j, c, n, k;
-    int    nfp, ncp, ncq;
-    float  *q;
+    int      i, j, n, k, s;
+    int      nfp, ncq, ncp, cb;
+    float    *q;
+    Chanmap  *M;
 
     nfp = D->get_nfram ();
-    ncp = D->get_nchan ();
     ncq = _audioq->nchan (); 
-    // This loop takes care of wraparound.
-    for (n = nfp; n; n -= k)
+    ncp = D->get_nchan ();
+    if (ncp > Netdata::MAXCHAN) return 0;
+    if ((D->get_sform () != _sfp) || (ncp != _ncp))
     {
-	q = _audioq->wr_datap ();   // Audio queue write pointer.
-	k = _audioq->wr_linav ();   // Number of frames that can be
-	if (k > n) k = n;           // written without wraparound.
-	// Loop over all selected channels.
-	for (j = 0; j < ncq; j++)
+	// Not what the descriptor announced.
+	set_decoder (D->get_sform (), ncp);
+    }
+    if (_sfp == Netdata::FM_OPUS)
+    {
+	if (_npend) commit ();
+	return write_opus (D);
+    }
+    cb = D->get_cbase ();
+    if ((D->get_gchan () > Netdata::MAXPCHAN) || (cb + D->get_gchan () > _ncp)) return 0;
+    M = chanmap (D);
+    // Frames are written ahead of the queue's write pointer, and are
+    // committed when all channel groups have been received. Channels
+    // not written by all groups are set to zero first.
+    if (_npend < nfp)
+    {
+	if (! M->_full)
 	{
-	    c = _chlist [j];
-	    if (c < ncp)
+	    for (n = _npend; n < nfp; n += k)
 	    {
-		// Copy from packet to audio queue.
-		D->get_audio (c, nfp - n, k, q, ncq);
+		k = _audioq->wr_linav (n);
+		if (k > nfp - n) k = nfp - n;
+		memset (_audioq->wr_datap (n), 0, k * ncq * sizeof (float));
 	    }
-	    else
+	}
+	_npend = nfp;
+    }
+    // This loop takes care of wraparound.
+    for (n = 0; n < nfp; n += k)
+    {
+	q = _audioq->wr_datap (n) + M->_qbase;   // Audio queue write pointer.
+	k = _audioq->wr_linav (n);                // Number of frames that can be
+	if (k > nfp - n) k = nfp - n;             // written without wraparound.
+	(D->*M->_decode) (n, k, q, ncq, M->_nmap, M->_cmap);
+	if (M->_gaps)
+	{
+	    // Move to their slots, last one first.
+	    for (i = 0; i < k; i++, q += ncq)
 	    {
-		// Channel not available, write zeros.
-		for (i = 0; i < k; i++) q [i * ncq] = 0;
+		for (j = M->_nmap - 1; j >= 0; j--)
+		{
+		    s = M->_slot [j];
+		    if (s == j) break;
+		    q [s] = q [j];
+		    q [j] = 0.0f;
+		}
 	    }
-	    q++;
 	}
-	_audioq->wr_commit (k);    // Update audio queue state.
     }
+    // Commit if this is the last group, or the last one with selected
+    // channels. Any later groups with the same frames are ignored.
+    cb += D->get_gchan ();
+    if ((cb == _ncp) || (_qidx [cb] == ncq)) commit ();
     return nfp;
 }
 
 
+void Netrx::commit (void)
+{
+    _audioq->wr_commit (_npend);
+    _npend = 0;
+}
+
+
 int Netrx::write_zeros (int nfram)
 {
     int    n, k;
@@ -267,3 +984,70 @@ int Netrx::write_zeros (int nfram)
     return nfram;
 }
 
+
+// Opus packets are decoded into a buffer in the Opus decoder, the
+// selected channels are then copied from there.
+//
+int Netrx::write_opus (Netdata *D)
+{
+    int  nfp, osize;
+
+    nfp = D->get_nfram ();
+    osize = D->get_osize ();
+    // An empty packet means the sender failed to code it.
+    if (_opok && ! _opdec.decode (osize ? D->opus_data () : 0, osize, nfp))
+    {
+	_opfr = nfp;
+	write_frames (_opdec.data (), nfp);
+	return nfp;
+    }
+    return write_zeros (nfp);
+}
+
+
+// Replace missing frames. Opus uses loss concealment, but only for
+// a short time, after that the output is silent anyway.
+//
+int Netrx::write_lost (int nfram)
+{
+    int  n;
+
+    n = nfram;
+    if (_opok && (_sfp == Netdata::FM_OPUS))
+    {
+	while ((n >= _opfr) && (nfram - n < _fsamp / 50))
+	{
+	    if (_opdec.decode (0, 0, _opfr)) break;
+	    write_frames (_opdec.data (), _opfr);
+	    n -= _opfr;
+	}
+    }
+    if (n) write_zeros (n);
+    return nfram;
+}
+
+
+// Write interleaved frames of all sender channels.
+//
+void Netrx::write_frames (const float *data, int nfram)
+{
+    int    i, m, n, k, ncq;
+    float  *q;
+
+    ncq = _audioq->nchan (); 
+    // This loop takes care of wraparound.
+    for (n = nfram; n; n -= k)
+    {
+	q = _audioq->wr_datap ();   // Audio queue write pointer.
+	k = _audioq->wr_linav ();   // Number of frames that can be
+	if (k > n) k = n;           // written without wraparound.
+	for (i = 0; i < k; i++)
+	{
+	    for (m = 0; m < _nmap; m++) q [m] = data [_chlist [m]];
+	    if (ncq > _nmap) memset (q + _nmap, 0, (ncq - _nmap) * sizeof (float));
+	    q += ncq;
+	    data += _ncp;
+	}
+	_audioq->wr_commit (k);    // Update audio queue state.
+    }
+}
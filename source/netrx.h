@@ -24,6 +24,10 @@
 #include <stdint.h>
 #include "pxthread.h"
 #include "lfqueue.h"
+#include "opuscodec.h"
+#include "xdpsock.h"
+#include "uring.h"
+#include "shmring.h"
 
 
 class Netrx : public Pxthread
@@ -39,19 +43,102 @@ public:
                Lfq_int32     *commq,
                Lfq_timedata  *timeq,
 	       int           *chlist,
+	       int            sform,
+	       int            nchan,
 	       int            psmax,
 	       int            fsamp,
 	       int            fsize,
                int            rtprio,
-	       int            sockfd);
+	       int            sockfd,
+	       bool           ktime);
+
+    // Must be called before start (). If busy > 0, wait for
+    // packets for up to that many microseconds by polling.
+    // If cpu >= 0 the receiver thread runs on that CPU only.
+    void set_busy (int busy, int cpu)
+    {
+	_busy = busy;
+	_cpu = cpu;
+    }
+
+    // Receive using AF_XDP as well as the socket. Must be called
+    // before start (). GRO and kernel timestamps are not used.
+    void set_xdp (Xdpsock *xdp) { _xdp = xdp; }
+
+    // Receive from a shared memory ring instead of the socket,
+    // which is not used. Must be called before start ().
+    void set_shm (Shmring *shm) { _shm = shm; }
+
+    // Receive using io_uring. Must be called before start (), returns
+    // non-zero if the kernel does not support the provided buffers.
+    // GRO and kernel timestamps are not used.
+    int set_uring (Uring *uring, int psmax);
+
+    // The stream is striped over 'npath' paths, see Netdata. Packets
+    // are put back in order before being processed. Must be called
+    // before start (), with the same maximum packet size.
+    void set_stripe (int npath, int psmax);
+
+    // Total time spent polling, and the number of packets
+    // received by polling and in total. These are written
+    // by the receiver thread only.
+    void get_busy (double *tpoll, int *npoll, int *nrecv);
 
 private:
 
+    // Lossless packets may change format, allow for both.
+    enum { NCHMAP = 2 * Netdata::MAXGROUP };
+
+    // Maximum number of packets per receive call, and of
+    // coalesced datagrams and their size if GRO is used,
+    // and the number of buffers provided to io_uring.
+    enum { MAXRECV = 32, MAXGRO = 8, GROSIZE = 0x10000, NUBUF = 64 };
+
+    // Packets of a striped stream that can be held waiting for
+    // those before them, and the maximum number of paths.
+    enum { NHOLD = 256, MAXPATH = 8 };
+
+    // Selected channels in the packets of a channel group.
+    class Chanmap
+    {
+    public:
+
+	int               _sform;
+	int               _cbase;  // First channel in the group.
+	int               _nchan;  // Number of channels in the group.
+	uint64_t          _cmask;  // Channels present.
+	int               _qbase;  // First audio queue channel.
+	int               _nmap;
+	bool              _gaps;   // Channels must be moved to their slot.
+	bool              _full;   // All audio queue channels are written.
+	int               _cmap [Netdata::MAXPCHAN];
+	int               _slot [Netdata::MAXPCHAN];
+	Netdata::Decoder  _decode;
+    };
+
     virtual void thr_main (void);
 
+    int receive (void);
+    int receive_xdp (void);
+    int receive_uring (void);
+    int receive_shm (void);
+    void close_uring (void);
+    void process (Netdata *D, double tr);
+    void process_gro (int i);
+    void deliver (Netdata *D, double tr);
+    void reorder (Netdata *D, double tr);
+    void release (double tr);
+    void clear_held (void);
+
     void send (int flags, int32_t count, double tjack, uint32_t tsecs, uint32_t tfrac);
+    void set_decoder (int sform, int nchan);
+    Chanmap *chanmap (Netdata *D);
     int write_audio (Netdata *D);
+    void commit (void);
     int write_zeros (int nfram);
+    int write_opus (Netdata *D);
+    int write_lost (int nfram);
+    void write_frames (const float *data, int nfram);
 
     int            _state;
     bool           _first;
@@ -64,10 +151,49 @@ private:
     Lfq_int32     *_commq;
     Lfq_timedata  *_timeq;
     int           *_chlist;
+    int            _sfp;
+    int            _ncp;
+    int            _nmap;
+    int            _qidx [Netdata::MAXCHAN + 1];
+    Chanmap        _chmap [NCHMAP];
+    int            _chrep;
+    int            _npend;  // Frames written but not committed.
+    int            _tfc;    // Frame count of the last timed packet.
+    Netdata::Decoder _decode;
+    Opusdec        _opdec;
+    bool           _opok;   // Opus decoder ready.
+    int            _opfr;   // Last Opus frame size.
     int            _fsamp;
     int            _fsize;
     int            _sockfd;
-    Netdata       *_packet;
+    Netdata       *_packet [MAXRECV];
+    double         _trecv [MAXRECV]; // Receive time of each packet.
+    bool           _gro;    // Receive coalesced datagrams.
+    bool           _ktime;  // Use kernel receive timestamps.
+    Xdpsock       *_xdp;
+    Shmring       *_shm;
+    Uring         *_uring;
+    Netdata       *_ubuff [NUBUF];
+    int            _ubid [MAXRECV];  // Buffer of each packet.
+    int            _nused;           // Buffers to be returned.
+    bool           _armed;           // Multishot receive is active.
+    bool           _hupreq;          // Waiting for shutdown.
+    int            _busy;
+    int            _cpu;
+    volatile double _tpoll;
+    volatile int   _npoll;
+    volatile int   _nrecv;
+    unsigned char *_gbuff;
+    int            _glen [MAXGRO];
+    int            _gseg [MAXGRO];   // Segment size.
+    int            _npath;           // Paths of a striped stream.
+    bool           _sinit;           // Waiting for the first numbered packet.
+    uint32_t       _snext;           // Next sequence number to process.
+    uint32_t       _slast [MAXPATH]; // Last one received on each path.
+    Netdata       *_hold [NHOLD];    // Packets held, by sequence number.
+    double         _thold [NHOLD];   // Their receive time.
+    bool           _hused [NHOLD];
+    int            _nheld;
 };
 
 
@@ -19,18 +19,115 @@
 
 
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/socket.h>
+#ifdef __linux__
+#include <netinet/udp.h>
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef SCM_TXTIME
+#define SCM_TXTIME 61
+#endif
+#include <netinet/in.h>
+#include <linux/errqueue.h>
+#ifndef SO_EE_ORIGIN_TXTIME
+#define SO_EE_ORIGIN_TXTIME 6
+#endif
+#endif
 #include "nettx.h"
 #include "zsockets.h"
 
 
 Nettx::Nettx (void) :
-    _stop (false)
+    _xdp (0),
+    _shm (0),
+    _uring (0),
+    _stop (false),
+    _dreq (false),
+    _txerr (0),
+    _ntab (0),
+    _dchg (false),
+    _fanout (false),
+    _ndest (0),
+    _mhdr (0),
+    _ngroup (0),
+    _gsize (0),
+    _npath (0)
 {
+    pthread_mutex_init (&_dmutex, 0);
+#ifdef __linux__
+    _mhdr = new struct mmsghdr [MAXMSG];
+#endif
 }
 
 
 Nettx::~Nettx (void)
 {
+#ifdef __linux__
+    delete[] _mhdr;
+#endif
+    pthread_mutex_destroy (&_dmutex);
+}
+
+
+static bool same_addr (const Sockaddr *A, const Sockaddr *B)
+{
+    return (A->sa_len () == B->sa_len ()) && ! memcmp (A->sa_ptr (), B->sa_ptr (), A->sa_len ());
+}
+
+
+int Nettx::add_dest (const Sockaddr *A)
+{
+    int  i, rv;
+
+    pthread_mutex_lock (&_dmutex);
+    for (i = 0; (i < _ntab) && ! same_addr (A, _dtab + i); i++);
+    rv = 0;
+    if (i == MAXDEST) rv = -1;
+    else
+    {
+	if (i == _ntab) _dtab [_ntab++] = *A;
+	_dchg = true;
+    }
+    pthread_mutex_unlock (&_dmutex);
+    return rv;
+}
+
+
+int Nettx::del_dest (const Sockaddr *A)
+{
+    int  i, rv;
+
+    pthread_mutex_lock (&_dmutex);
+    for (i = 0; (i < _ntab) && ! same_addr (A, _dtab + i); i++);
+    rv = -1;
+    if (i < _ntab)
+    {
+	for (_ntab--; i < _ntab; i++) _dtab [i] = _dtab [i + 1];
+	_dchg = true;
+	rv = 0;
+    }
+    pthread_mutex_unlock (&_dmutex);
+    return rv;
+}
+
+
+// Take a copy of the destinations if they were changed. This must
+// not wait, if the list is being modified it is taken next time.
+//
+void Nettx::update_dest (void)
+{
+    int  i;
+
+    if (! _dchg || pthread_mutex_trylock (&_dmutex)) return;
+    for (i = 0; i < _ntab; i++) _dest [i] = _dtab [i];
+    _ndest = _ntab;
+    _fanout = true;
+    _dchg = false;
+    pthread_mutex_unlock (&_dmutex);
 }
 
 
@@ -38,53 +135,453 @@ void Nettx::start (Lfq_packdata   *packq,
 		   Lfq_timedata   *timeq,
 		   Netdata        *descpack,
  	           int             sockfd,
-		   int             rtprio)
+		   int             rtprio,
+		   int             pace,
+		   int             tpace,
+		   int             tlead)
 {
     _packq = packq;
     _timeq = timeq;
     _descpack = descpack;
     _sockfd = sockfd;
+    _gso = (sock_set_udp_segment (sockfd, 0) == 0);
+    _pace = pace;
+#ifdef __linux__
+    _clock = (pace == PACE_ETF) ? CLOCK_TAI : CLOCK_MONOTONIC;
+#else
+    _clock = CLOCK_MONOTONIC;
+#endif
+    _tpace = 1000LL * tpace;
+    _tlead = (pace == PACE_ETF) ? 1000LL * tlead : 0;
     thr_start (SCHED_FIFO, rtprio, 0);
 }
 
 
+// The descriptor packet's buffer follows those of the queue.
+//
+int Nettx::set_uring (Uring *uring, Lfq_packdata *packq, Netdata *descpack)
+{
+    int             i, n, rv;
+    unsigned char **A;
+    int            *L;
+
+    n = packq->nelm ();
+    A = new unsigned char * [n + 1];
+    L = new int [n + 1];
+    for (i = 0; i < n; i++)
+    {
+	A [i] = packq->datap (i)->data ();
+	L [i] = packq->datap (i)->size ();
+    }
+    A [n] = descpack->data ();
+    L [n] = descpack->size ();
+    rv = uring->reg_buffers (A, L, n + 1);
+    if (rv == 0) _uring = uring;
+    delete[] A;
+    delete[] L;
+    return rv;
+}
+
+
+void Nettx::set_groups (const Sockaddr *A, int ngroup, int gsize)
+{
+    int  i;
+
+    for (i = 0; i < ngroup; i++) _gaddr [i] = A [i];
+    _ngroup = ngroup;
+    _gsize = gsize;
+}
+
+
+void Nettx::set_paths (const int *fds, int npath)
+{
+    int  i;
+
+    for (i = 0; i < npath; i++) _pathfd [i] = fds [i];
+    _npath = npath;
+}
+
+
 void Nettx::trigger (void)
 {
     _sema.post ();
 }
 
 
+// Each trigger sends all packets waiting in the queue. The Jack
+// thread triggers once per period, so this is normally a single
+// batch. A requested descriptor packet is added to the batch.
+// If pacing is used, the packets are spread evenly over the
+// pacing time, starting now.
+//
 void Nettx::thr_main (void)
 {
-    Netdata  *D;
-    Timedata *M;
+    int              i, n, k;
+    Netdata         *B [MAXBATCH];
+    Timedata        *M;
+    struct timespec  T;
     
     while (true)
     {
         _sema.wait ();
+	update_dest ();
 	
 	if (_stop)
 	{
 	    _descpack->set_flags (Netdata::FL_TERM);
-            send (_sockfd, (char *) _descpack->data (), _descpack->dlen (), 0);
+	    if (_shm) _shm->write (_descpack);
+	    else if (_xdp) _xdp->send (&_descpack, 1);
+	    else if (_fanout) send_batch (_sockfd, &_descpack, 1, 0, _ndest);
+	    else if (_ngroup) send_groups (&_descpack, 1);
+	    else if (_npath) send_paths (&_descpack, 1);
+            else send (_sockfd, (char *) _descpack->data (), _descpack->dlen (), 0);
             sock_close (_sockfd);
+	    for (i = 1; i < _npath; i++) sock_close (_pathfd [i]);
  	    return;
 	}
-        if (_packq->rd_avail () > 0)
+	if (_pace && !_shm && !_xdp && !_uring && !_npath)
+	{
+	    n = _packq->rd_avail () + (_dreq ? 1 : 0);
+	    if (n == 0) continue;
+	    clock_gettime (_clock, &T);
+	    _tnext = T.tv_sec * 1000000000LL + T.tv_nsec + _tlead;
+	    _tstep = _tpace / n;
+	}
+	do
+	{
+	    n = _packq->rd_avail ();
+	    if (n > MAXBATCH) n = MAXBATCH;
+	    for (k = 0; k < n; k++) B [k] = _packq->rd_datap (k);
+	    if (_dreq && (n < MAXBATCH))
+	    {
+		_dreq = false;
+		if (_timeq->rd_avail () > 0)
+		{
+		    M = _timeq->rd_datap ();
+		    _descpack->set_tmark (M->_count, M->_tsecs, M->_tfrac);
+		    _timeq->rd_commit ();
+		}
+		B [k++] = _descpack;
+	    }
+	    if (k)
+	    {
+		if (_shm) for (i = 0; i < k; i++) _shm->write (B [i]);
+		else if (_xdp) _xdp->send (B, k);
+		else if (_uring) send_uring (B, k);
+		else if (_ngroup) send_groups (B, k);
+		else if (_npath) send_paths (B, k);
+		else if (_pace) send_paced (B, k);
+		else send_batch (_sockfd, B, k, 0, _fanout ? _ndest : 1);
+	    }
+	    _packq->rd_commit (n);
+	}
+	while (n == MAXBATCH);
+    }
+}
+
+
+// Packets are sent with a single sendmmsg (). If the kernel supports
+// UDP segmentation offload, consecutive packets of the same size are
+// combined into one message, which the kernel or the network device
+// splits again. The last packet of such a message may be smaller.
+// If the kernel or the device refuses this, segmentation is disabled
+// and the packets are sent again without it. Other errors, e.g. when
+// the receiver is not yet running, are ignored as for any message.
+//
+// With a list of destinations, the messages are repeated for each of
+// destinations d0 to d1 - 1, and sent in blocks of up to MAXMSG. The
+// packets are encoded once, only the system calls are repeated.
+//
+void Nettx::send_batch (int fd, Netdata **B, int n, int d0, int d1)
+{
+#ifdef __linux__
+    int             i, j, k, d, m, s, e, f, t;
+    int             P [MAXBATCH];
+    struct iovec    V [MAXBATCH];
+    struct mmsghdr  H [MAXBATCH];
+    struct cmsghdr  *C;
+    char            cbuf [MAXBATCH][CMSG_SPACE (sizeof (uint16_t))];
+
+    memset (H, 0, n * sizeof (struct mmsghdr));
+    for (i = 0; i < n; i++)
+    {
+	V [i].iov_base = B [i]->data ();
+	V [i].iov_len = B [i]->dlen ();
+    }
+    for (i = m = 0; i < n; i = j, m++)
+    {
+	j = i + 1;
+	s = d = B [i]->dlen ();
+	if (_gso)
+	{
+	    while ((j < n) && (B [j]->dlen () <= s) && (d + B [j]->dlen () <= GSOMAX))
+	    {
+		d += B [j++]->dlen ();
+		if (B [j - 1]->dlen () < s) break;
+	    }
+	}
+	H [m].msg_hdr.msg_iov = V + i;
+	H [m].msg_hdr.msg_iovlen = j - i;
+	if (j - i > 1)
 	{
-	    D = _packq->rd_datap ();
-	    send (_sockfd, (char *) D->data (), D->dlen (), 0);
-	    _packq->rd_commit ();
+	    H [m].msg_hdr.msg_control = cbuf [m];
+	    H [m].msg_hdr.msg_controllen = CMSG_SPACE (sizeof (uint16_t));
+	    C = CMSG_FIRSTHDR (&(H [m].msg_hdr));
+	    C->cmsg_level = SOL_UDP;
+	    C->cmsg_type = UDP_SEGMENT;
+	    C->cmsg_len = CMSG_LEN (sizeof (uint16_t));
+	    *((uint16_t *) CMSG_DATA (C)) = s;
 	}
-	else
+	P [m] = i;
+    }
+    // Message e is message e % m for destination d0 + e / m. Without
+    // a list the socket is connected, so no addresses are required.
+    t = (d1 - d0) * m;
+    for (e = 0; e < t; e += f)
+    {
+	f = (t - e < MAXMSG) ? t - e : MAXMSG;
+	for (i = 0; i < f; i++)
 	{
-	    if (_timeq->rd_avail () > 0)
+	    _mhdr [i] = H [(e + i) % m];
+	    if (_fanout)
 	    {
-		M = _timeq->rd_datap ();
-		_descpack->set_tmark (M->_count, M->_tsecs, M->_tfrac);
-		_timeq->rd_commit ();
+		d = d0 + (e + i) / m;
+		_mhdr [i].msg_hdr.msg_name = _dest [d].sa_ptr ();
+		_mhdr [i].msg_hdr.msg_namelen = _dest [d].sa_len ();
 	    }
-            send (_sockfd, (char *) _descpack->data (), _descpack->dlen (), 0);
 	}
+	// As for send (), errors are ignored. A message
+	// that fails is skipped and the rest are sent.
+	for (i = 0; i < f; i += (k > 0) ? k : 1)
+	{
+	    k = sendmmsg (fd, _mhdr + i, f - i, 0);
+	    if (   (k < 0) && _mhdr [i].msg_hdr.msg_control
+		&& ((errno == EIO) || (errno == EINVAL) || (errno == EOPNOTSUPP)))
+	    {
+		// Resend the rest for this destination, then
+		// continue with the next ones.
+		_gso = false;
+		d = d0 + (e + i) / m;
+		send_batch (fd, B + P [(e + i) % m], n - P [(e + i) % m], d, d + 1);
+		if (d + 1 < d1) send_batch (fd, B, n, d + 1, d1);
+		return;
+	    }
+	}
+    }
+#else
+    for (int d = d0; d < d1; d++)
+    {
+	for (int i = 0; i < n; i++)
+	{
+	    if (_fanout) sendto (fd, (char *) B [i]->data (), B [i]->dlen (), 0, _dest [d].sa_ptr (), _dest [d].sa_len ());
+	    else send (fd, (char *) B [i]->data (), B [i]->dlen (), 0);
+	}
+    }
+#endif
+}
+
+
+// Packets of a channel group go to the group's address, others such
+// as the descriptor to all groups. Segmentation offload is not used,
+// as consecutive packets are normally for different groups.
+//
+void Nettx::send_groups (Netdata **B, int n)
+{
+#ifdef __linux__
+    int           i, g, g0, g1, m;
+    struct iovec  V [MAXBATCH];
+
+    for (i = m = 0; i < n; i++)
+    {
+	V [i].iov_base = B [i]->data ();
+	V [i].iov_len = B [i]->dlen ();
+	g0 = 0;
+	g1 = _ngroup;
+	if (B [i]->get_flags () & Netdata::FL_GROUP)
+	{
+	    g0 = B [i]->get_cbase () / _gsize;
+	    g1 = g0 + 1;
+	}
+	for (g = g0; g < g1; g++)
+	{
+	    if (m == MAXMSG)
+	    {
+		send_mhdr (m);
+		m = 0;
+	    }
+	    memset (_mhdr + m, 0, sizeof (struct mmsghdr));
+	    _mhdr [m].msg_hdr.msg_iov = V + i;
+	    _mhdr [m].msg_hdr.msg_iovlen = 1;
+	    _mhdr [m].msg_hdr.msg_name = _gaddr [g].sa_ptr ();
+	    _mhdr [m].msg_hdr.msg_namelen = _gaddr [g].sa_len ();
+	    m++;
+	}
+    }
+    send_mhdr (m);
+#else
+    int  i, g, g0, g1;
+
+    for (i = 0; i < n; i++)
+    {
+	g0 = 0;
+	g1 = _ngroup;
+	if (B [i]->get_flags () & Netdata::FL_GROUP)
+	{
+	    g0 = B [i]->get_cbase () / _gsize;
+	    g1 = g0 + 1;
+	}
+	for (g = g0; g < g1; g++)
+	{
+	    sendto (_sockfd, (char *) B [i]->data (), B [i]->dlen (), 0, _gaddr [g].sa_ptr (), _gaddr [g].sa_len ());
+	}
+    }
+#endif
+}
+
+
+// Send the first n messages in _mhdr. As for send (), errors
+// are ignored, a message that fails is skipped.
+//
+void Nettx::send_mhdr (int n)
+{
+#ifdef __linux__
+    int  i, k;
+
+    for (i = 0; i < n; i += (k > 0) ? k : 1)
+    {
+	k = sendmmsg (_sockfd, _mhdr + i, n - i, 0);
+    }
+#endif
+}
+
+
+// Each path gets the packets numbered for it and all others, in
+// order. The packets for a path are every npath'th of the stream,
+// so they can still use segmentation offload.
+//
+void Nettx::send_paths (Netdata **B, int n)
+{
+    int       i, k, p;
+    Netdata  *L [MAXBATCH];
+
+    for (p = 0; p < _npath; p++)
+    {
+	for (i = k = 0; i < n; i++)
+	{
+	    if (! B [i]->numbered () || ((int)(B [i]->get_seqnum () % _npath) == p)) L [k++] = B [i];
+	}
+	if (k) send_batch (_pathfd [p], L, k, 0, 1);
+    }
+}
+
+
+// Send packets at the times given by _tnext and _tstep. With SO_TXTIME
+// these are passed to the qdisc and all packets are sent at once. The
+// timer pacer waits for each packet's time. Segmentation offload is
+// not used, as all segments would be sent at the same time.
+//
+void Nettx::send_paced (Netdata **B, int n)
+{
+#ifdef __linux__
+    int              i, k;
+    struct timespec  T;
+
+    if (_pace != PACE_TIMER)
+    {
+	struct iovec    V [MAXBATCH];
+	struct mmsghdr  H [MAXBATCH];
+	struct cmsghdr  *C;
+	char            cbuf [MAXBATCH][CMSG_SPACE (sizeof (uint64_t))];
+
+	memset (H, 0, n * sizeof (struct mmsghdr));
+	for (i = 0; i < n; i++)
+	{
+	    V [i].iov_base = B [i]->data ();
+	    V [i].iov_len = B [i]->dlen ();
+	    H [i].msg_hdr.msg_iov = V + i;
+	    H [i].msg_hdr.msg_iovlen = 1;
+	    H [i].msg_hdr.msg_control = cbuf [i];
+	    H [i].msg_hdr.msg_controllen = sizeof (cbuf [i]);
+	    C = CMSG_FIRSTHDR (&(H [i].msg_hdr));
+	    C->cmsg_level = SOL_SOCKET;
+	    C->cmsg_type = SCM_TXTIME;
+	    C->cmsg_len = CMSG_LEN (sizeof (uint64_t));
+	    *((uint64_t *) CMSG_DATA (C)) = _tnext;
+	    _tnext += _tstep;
+	}
+	for (i = 0; i < n; i += (k > 0) ? k : 1)
+	{
+	    k = sendmmsg (_sockfd, H + i, n - i, 0);
+	}
+	if (_pace == PACE_ETF) read_errqueue ();
+	return;
+    }
+    for (i = 0; i < n; i++)
+    {
+	T.tv_sec = _tnext / 1000000000LL;
+	T.tv_nsec = _tnext % 1000000000LL;
+	while (clock_nanosleep (_clock, TIMER_ABSTIME, &T, 0) == EINTR);
+        send (_sockfd, (char *) B [i]->data (), B [i]->dlen (), 0);
+	_tnext += _tstep;
+    }
+#else
+    send_batch (_sockfd, B, n, 0, 1);
+#endif
+}
+
+
+// Count the packets the etf qdisc reports as dropped because their
+// transmit time had passed, see sock_set_txtime (). The packet data
+// is not needed and is truncated.
+//
+void Nettx::read_errqueue (void)
+{
+#ifdef __linux__
+    struct msghdr              H;
+    struct cmsghdr            *C;
+    struct sock_extended_err  *E;
+    char                       cbuf [256];
+
+    while (true)
+    {
+	memset (&H, 0, sizeof (H));
+	H.msg_control = cbuf;
+	H.msg_controllen = sizeof (cbuf);
+	if (recvmsg (_sockfd, &H, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) break;
+	for (C = CMSG_FIRSTHDR (&H); C; C = CMSG_NXTHDR (&H, C))
+	{
+	    if (   ((C->cmsg_level == SOL_IP) && (C->cmsg_type == IP_RECVERR))
+		|| ((C->cmsg_level == SOL_IPV6) && (C->cmsg_type == IPV6_RECVERR)))
+	    {
+		E = (struct sock_extended_err *) CMSG_DATA (C);
+		if (E->ee_origin == SO_EE_ORIGIN_TXTIME) _txerr++;
+	    }
+	}
+    }
+#endif
+}
+
+
+// Queue a write for each packet and submit them with a single system
+// call, which returns when all are complete and the buffers can be
+// reused. As for send (), errors are ignored. If the ring fails, the
+// socket is used from then on.
+//
+void Nettx::send_uring (Netdata **B, int n)
+{
+    int         i, j;
+    Uring::Cqe  C;
+
+    for (i = 0; i < n; i++)
+    {
+	j = (B [i] == _descpack) ? _packq->nelm () : _packq->rd_index (i);
+	_uring->send_fixed (_sockfd, B [i]->data (), B [i]->dlen (), j, i);
+    }
+    if (_uring->submit (n))
+    {
+	_uring = 0;
+	send_batch (_sockfd, B, n, 0, 1);
+	return;
     }
+    while (_uring->get_cqe (&C));
 }
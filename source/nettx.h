@@ -27,12 +27,27 @@
 #include "pxthread.h"
 #include "lfqueue.h"
 #include "netdata.h"
+#include "zsockets.h"
+#include "xdpsock.h"
+#include "uring.h"
+#include "shmring.h"
 
 
 class Nettx : public Pxthread
 {
 public:
 
+    // Pacing modes: none, using a timer, or using SO_TXTIME
+    // with the fq or etf qdisc. The latter two must be enabled
+    // on the socket before calling start (). The etf qdisc
+    // drops packets with a time that has passed when they are
+    // queued, so in that mode all times are delayed by 'tlead'
+    // microseconds given to start ().
+    enum { PACE_NONE, PACE_TIMER, PACE_FQ, PACE_ETF };
+
+    // Maximum number of destinations, and of striped paths.
+    enum { MAXDEST = 64, MAXPATH = 8 };
+
     Nettx (void);
     virtual ~Nettx (void);
     
@@ -40,7 +55,23 @@ public:
 		Lfq_timedata *timeq, 
 		Netdata      *descpack,
 		int           sockfd,
-	        int           rtprio);
+	        int           rtprio,
+		int           pace = PACE_NONE,
+		int           tpace = 0,
+		int           tlead = 0);
+
+    // Send using AF_XDP instead of the socket. Must be
+    // called before start (). Pacing is not used.
+    void set_xdp (Xdpsock *xdp) { _xdp = xdp; }
+
+    // Send to a shared memory ring instead of the socket. Must be
+    // called before start (). Pacing is not used.
+    void set_shm (Shmring *shm) { _shm = shm; }
+
+    // Send using io_uring, registering the buffers of the packet
+    // queue and the descriptor packet. Must be called before
+    // start (), returns non-zero if the buffers can't be used.
+    int set_uring (Uring *uring, Lfq_packdata *packq, Netdata *descpack);
 
     void stop (void)
     {
@@ -48,18 +79,87 @@ public:
 	trigger ();
     }
 
+    // Send all packets in the queue.
     void trigger (void);
 
+    // Number of packets dropped by the qdisc for a missed
+    // transmit time, if reported by the kernel.
+    int txerrors (void) const { return _txerr; }
+
+    // Send each packet to a list of destinations instead of the
+    // connected address. This starts when the first destination
+    // is added, and the list may then be changed at any time.
+    // Returns -1 if the list is full or the address is not in it.
+    int add_dest (const Sockaddr *A);
+    int del_dest (const Sockaddr *A);
+
+    // Send the packets of each channel group to its own address,
+    // and other packets to all of them. Must be called before
+    // start (). Pacing is not used.
+    void set_groups (const Sockaddr *A, int ngroup, int gsize);
+
+    // Stripe the numbered packets over 'npath' sockets, the first
+    // being the one given to start (). Packet s is sent on path
+    // s % npath, others on all paths. Must be called before start ().
+    // Pacing is not used. The sockets are closed by stop ().
+    void set_paths (const int *fds, int npath);
+
+    // Send the descriptor packet, with the next batch of
+    // packets if there are any.
+    void trigger_desc (void)
+    {
+	_dreq = true;
+	trigger ();
+    }
+
 private:
 
+    // At most 64 segments are allowed by the kernel, and
+    // their size must fit into a single IP datagram.
+    // Messages for all destinations are sent in blocks of MAXMSG.
+    enum { MAXBATCH = 64, GSOMAX = 0xFFFF - 48, MAXMSG = 1024 };
+
     virtual void thr_main (void);
+    void send_batch (int fd, Netdata **B, int n, int d0, int d1);
+    void update_dest (void);
+    void send_paced (Netdata **B, int n);
+    void read_errqueue (void);
+    void send_uring (Netdata **B, int n);
+    void send_groups (Netdata **B, int n);
+    void send_mhdr (int n);
+    void send_paths (Netdata **B, int n);
 
     Lfq_packdata    *_packq;
     Lfq_timedata    *_timeq; 
     Netdata         *_descpack;
     int              _sockfd;
+    Xdpsock         *_xdp;
+    Shmring         *_shm;
+    Uring           *_uring;
     bool             _stop;
+    volatile bool    _dreq;
+    bool             _gso;    // Use UDP segmentation offload.
+    int              _pace;
+    int              _clock;  // Clock used for pacing.
+    int64_t          _tpace;  // Pacing time, nanoseconds.
+    int64_t          _tlead;  // Delay of all packets with etf.
+    volatile int     _txerr;
+    int64_t          _tstep;
+    int64_t          _tnext;
     Pxsema           _sema;
+    pthread_mutex_t  _dmutex;
+    Sockaddr         _dtab [MAXDEST];  // Destinations, under _dmutex.
+    int              _ntab;
+    volatile bool    _dchg;            // _dtab was modified.
+    bool             _fanout;
+    Sockaddr         _dest [MAXDEST];  // Used by the sending thread.
+    int              _ndest;
+    struct mmsghdr  *_mhdr;
+    Sockaddr         _gaddr [Netdata::MAXGROUP];
+    int              _ngroup;
+    int              _gsize;
+    int              _pathfd [MAXPATH];
+    int              _npath;
 };
 
 
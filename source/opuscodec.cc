@@ -0,0 +1,276 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2013-2016 Fons Adriaensen <fons@linuxaudio.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "opuscodec.h"
+#ifdef HAVE_OPUS
+#include <opus_multistream.h>
+#endif
+
+
+// Longest Opus frame accepted by the decoder, in units of 2.5 ms.
+// Senders use at most 5 ms, this allows some margin.
+#define MAXFRAME 8
+
+
+int Opusenc::framesize (int fsamp, int period)
+{
+    int  k;
+
+    switch (fsamp)
+    {
+    case  8000:
+    case 12000:
+    case 16000:
+    case 24000:
+    case 48000:
+	break;
+    default:
+	return 0;
+    }
+    k = fsamp / 200;
+    if (period >= k) return k;
+    k /= 2;
+    if (period >= k) return k;
+    return 0;
+}
+
+
+Opusenc::Opusenc (void) :
+    _enc (0),
+    _nchan (0),
+    _fsize (0),
+    _fill (0),
+    _buff (0)
+{
+}
+
+
+Opusenc::~Opusenc (void)
+{
+    fini ();
+}
+
+
+int Opusenc::write (float * const *inp, int offs, int nfram)
+{
+    int    c, i;
+    float  *p;
+
+    if (nfram > _fsize - _fill) nfram = _fsize - _fill;
+    for (c = 0; c < _nchan; c++)
+    {
+	p = _buff + _fill * _nchan + c;
+	for (i = 0; i < nfram; i++) p [i * _nchan] = inp [c][offs + i];
+    }
+    _fill += nfram;
+    return nfram;
+}
+
+
+Opusdec::Opusdec (void) :
+    _dec (0),
+    _nchan (0),
+    _maxfram (0),
+    _buff (0)
+{
+}
+
+
+Opusdec::~Opusdec (void)
+{
+    fini ();
+}
+
+
+#ifdef HAVE_OPUS
+
+
+// Channel mapping for 'nchan' channels: pairs first, then a single
+// one if needed. This is just the identity mapping.
+static void mapping (unsigned char *map, int nchan, int *nstr, int *ncpl)
+{
+    int  i;
+
+    for (i = 0; i < nchan; i++) map [i] = i;
+    *nstr = (nchan + 1) / 2;
+    *ncpl = nchan / 2;
+}
+
+
+bool Opusenc::available (void)
+{
+    return true;
+}
+
+
+int Opusenc::init (int fsamp, int nchan, int fsize, int bitrate)
+{
+    int            err, nstr, ncpl;
+    unsigned char  map [256];
+
+    fini ();
+    if ((nchan < 1) || (nchan > 255) || (fsize < 1)) return -1;
+    mapping (map, nchan, &nstr, &ncpl);
+    _enc = opus_multistream_encoder_create (fsamp, nchan, nstr, ncpl, map,
+                                            OPUS_APPLICATION_RESTRICTED_LOWDELAY, &err);
+    if (err != OPUS_OK)
+    {
+	_enc = 0;
+	return -1;
+    }
+    opus_multistream_encoder_ctl (_enc, OPUS_SET_BITRATE (bitrate * nchan));
+    _nchan = nchan;
+    _fsize = fsize;
+    _fill = 0;
+    _buff = new float [nchan * fsize];
+    return 0;
+}
+
+
+void Opusenc::fini (void)
+{
+    if (_enc) opus_multistream_encoder_destroy (_enc);
+    delete[] _buff;
+    _enc = 0;
+    _buff = 0;
+}
+
+
+int Opusenc::encode (unsigned char *dst, int maxlen)
+{
+    int  n;
+
+    _fill = 0;
+    n = opus_multistream_encode_float (_enc, _buff, _fsize, dst, maxlen);
+    return (n < 0) ? -1 : n;
+}
+
+
+bool Opusdec::available (void)
+{
+    return true;
+}
+
+
+int Opusdec::init (int fsamp, int nchan)
+{
+    int            err, nstr, ncpl;
+    unsigned char  map [256];
+
+    fini ();
+    if ((nchan < 1) || (nchan > 255)) return -1;
+    mapping (map, nchan, &nstr, &ncpl);
+    _dec = opus_multistream_decoder_create (fsamp, nchan, nstr, ncpl, map, &err);
+    if (err != OPUS_OK)
+    {
+	_dec = 0;
+	return -1;
+    }
+    _nchan = nchan;
+    _maxfram = MAXFRAME * fsamp / 400;
+    _buff = new float [nchan * _maxfram];
+    return 0;
+}
+
+
+void Opusdec::fini (void)
+{
+    if (_dec) opus_multistream_decoder_destroy (_dec);
+    delete[] _buff;
+    _dec = 0;
+    _buff = 0;
+}
+
+
+void Opusdec::reset (void)
+{
+    if (_dec) opus_multistream_decoder_ctl (_dec, OPUS_RESET_STATE);
+}
+
+
+int Opusdec::decode (const unsigned char *src, int size, int nfram)
+{
+    if (! _dec || (nfram < 1) || (nfram > _maxfram)) return -1;
+    if (src && (size < 1)) return -1;
+    // The frame size given to the decoder limits the packet duration,
+    // so this also checks the packet agrees with 'nfram'.
+    if (opus_multistream_decode_float (_dec, src, size, _buff, nfram, 0) != nfram) return -1;
+    return 0;
+}
+
+
+#else
+
+
+bool Opusenc::available (void)
+{
+    return false;
+}
+
+
+int Opusenc::init (int, int, int, int)
+{
+    return -1;
+}
+
+
+void Opusenc::fini (void)
+{
+}
+
+
+int Opusenc::encode (unsigned char *, int)
+{
+    _fill = 0;
+    return -1;
+}
+
+
+bool Opusdec::available (void)
+{
+    return false;
+}
+
+
+int Opusdec::init (int, int)
+{
+    return -1;
+}
+
+
+void Opusdec::fini (void)
+{
+}
+
+
+void Opusdec::reset (void)
+{
+}
+
+
+int Opusdec::decode (const unsigned char *, int, int)
+{
+    return -1;
+}
+
+
+#endif
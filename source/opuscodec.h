@@ -0,0 +1,107 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2013-2016 Fons Adriaensen <fons@linuxaudio.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+#ifndef __OPUSCODEC_H
+#define __OPUSCODEC_H
+
+
+// Opus coding of all channels of a stream, used by the FM_OPUS
+// sample format. Channels are coded in pairs, plus a single one
+// if their number is odd, as a single Opus multistream packet.
+// If built without HAVE_OPUS defined, init () always fails.
+
+
+struct OpusMSEncoder;
+struct OpusMSDecoder;
+
+
+class Opusenc
+{
+public:
+
+    Opusenc (void);
+    ~Opusenc (void);
+
+    static bool available (void);
+
+    // Opus frame size for the given sample rate and period, the longest
+    // of 2.5 and 5 ms that fits into the period, or zero if none does.
+    static int framesize (int fsamp, int period);
+
+    // Bitrate is in bits per second for each channel.
+    int  init (int fsamp, int nchan, int fsize, int bitrate);
+    void reset (void) { _fill = 0; }
+
+    int  fsize (void) const { return _fsize; }
+    int  fill (void) const { return _fill; }
+
+    // Add up to 'nfram' frames to the current Opus frame, taking samples
+    // from inp [c] + offs. Returns the number of frames used.
+    int  write (float * const *inp, int offs, int nfram);
+
+    // Code the current frame, which must be complete. Returns the size
+    // of the Opus packet or -1 on error, and starts a new frame.
+    int  encode (unsigned char *dst, int maxlen);
+
+private:
+
+    void fini (void);
+
+    OpusMSEncoder  *_enc;
+    int             _nchan;
+    int             _fsize;
+    int             _fill;
+    float          *_buff;
+};
+
+
+class Opusdec
+{
+public:
+
+    Opusdec (void);
+    ~Opusdec (void);
+
+    static bool available (void);
+
+    int  init (int fsamp, int nchan);
+    void reset (void);
+
+    // Decode an Opus packet of exactly 'nfram' frames into the internal
+    // buffer. If 'src' is null, packet loss concealment is used instead.
+    // Returns -1 on error.
+    int  decode (const unsigned char *src, int size, int nfram);
+
+    // Interleaved samples of all channels.
+    const float *data (void) const { return _buff; }
+    int maxfram (void) const { return _maxfram; }
+
+private:
+
+    void fini (void);
+
+    OpusMSDecoder  *_dec;
+    int             _nchan;
+    int             _maxfram;
+    float          *_buff;
+};
+
+
+#endif
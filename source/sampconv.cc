@@ -0,0 +1,2090 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2013-2016 Fons Adriaensen <fons@linuxaudio.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+#include <stdint.h>
+#include <string.h>
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+    #define SCONV_BIG_ENDIAN
+#elif defined(__x86_64__)
+    #include <immintrin.h>
+    #define SCONV_X86
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    #include <arm_neon.h>
+    #define SCONV_ARM
+#endif
+#include "sampconv.h"
+
+
+// NOTE: This file must be compiled with -ffp-contract=off. If the
+// compiler fuses the multiply and add used to scale samples into
+// an FMA instruction the scalar and vector versions may round in
+// a different way, and results would no longer be bit-identical.
+
+
+#define R12 2047
+#define R16 32767
+#define R20 524287
+#define R24 8388607
+
+// The 32-bit integer format uses an exact power of two as scale.
+// Samples are clipped before conversion to the largest float that
+// is below 2^31, so the result always fits.
+#define S32 2147483648.0f
+#define M32 2147483520.0f
+
+
+// ----------------------------------------------------------------------------
+
+
+// Scalar reference versions.
+
+
+static void enc16_ref (unsigned char *dst, int dstep, const float *src, int sstep, int nsamp)
+{
+    int  i, v;
+
+    for (i = 0; i < nsamp; i++)
+    {
+	v = (int)(R16 * src [i * sstep] + 0.5f);
+	if (v >  R16) v =  R16;
+	if (v < -R16) v = -R16;
+	dst [0] = v >> 8;
+	dst [1] = v;
+	dst += 2 * dstep;
+    }
+}
+
+
+static void enc24_ref (unsigned char *dst, int dstep, const float *src, int sstep, int nsamp)
+{
+    int  i, v;
+
+    for (i = 0; i < nsamp; i++)
+    {
+	v = (int)(R24 * src [i * sstep] + 0.5f);
+	if (v >  R24) v =  R24;
+	if (v < -R24) v = -R24;
+	dst [0] = v >> 16;
+	dst [1] = v >> 8;
+	dst [2] = v;
+	dst += 3 * dstep;
+    }
+}
+
+
+static void encfl_ref (unsigned char *dst, int dstep, const float *src, int sstep, int nsamp)
+{
+    int                  i;
+    const unsigned char  *p;
+
+    for (i = 0; i < nsamp; i++)
+    {
+	p = (const unsigned char *) src;
+#ifdef SCONV_BIG_ENDIAN
+	memcpy (dst, p, 4);
+#else
+	dst [0] = p [3];
+	dst [1] = p [2];
+	dst [2] = p [1];
+	dst [3] = p [0];
+#endif
+	src += sstep;
+	dst += 4 * dstep;
+    }
+}
+
+
+static void dec16_ref (float *dst, int dstep, const unsigned char *src, int sstep, int nsamp)
+{
+    int  i, v;
+
+    for (i = 0; i < nsamp; i++)
+    {
+	v = src [0];
+	if (v & 128) v -= 256;
+	dst [i * dstep] = (float)((v << 8) + src [1]) / R16;
+	src += 2 * sstep;
+    }
+}
+
+
+static void dec24_ref (float *dst, int dstep, const unsigned char *src, int sstep, int nsamp)
+{
+    int  i, v;
+
+    for (i = 0; i < nsamp; i++)
+    {
+	v = src [0];
+	if (v & 128) v -= 256;
+	dst [i * dstep] = (float)((v << 16) + (src [1] << 8) + src [2]) / R24;
+	src += 3 * sstep;
+    }
+}
+
+
+static void decfl_ref (float *dst, int dstep, const unsigned char *src, int sstep, int nsamp)
+{
+    int            i;
+    unsigned char  *q;
+
+    for (i = 0; i < nsamp; i++)
+    {
+	q = (unsigned char *) dst;
+#ifdef SCONV_BIG_ENDIAN
+	memcpy (q, src, 4);
+#else
+	q [0] = src [3];
+	q [1] = src [2];
+	q [2] = src [1];
+	q [3] = src [0];
+#endif
+	src += 4 * sstep;
+	dst += dstep;
+    }
+}
+
+
+static void enc32le_ref (unsigned char *dst, int dstep, const float *src, int sstep, int nsamp)
+{
+    int      i;
+    float    f;
+    int32_t  v;
+
+    for (i = 0; i < nsamp; i++)
+    {
+	f = S32 * src [i * sstep];
+	if (f >  M32) f =  M32;
+	if (f < -M32) f = -M32;
+	v = (int32_t) f;
+	dst [0] = v;
+	dst [1] = v >> 8;
+	dst [2] = v >> 16;
+	dst [3] = v >> 24;
+	dst += 4 * dstep;
+    }
+}
+
+
+static void encflle_ref (unsigned char *dst, int dstep, const float *src, int sstep, int nsamp)
+{
+    int                  i;
+    const unsigned char  *p;
+
+#ifndef SCONV_BIG_ENDIAN
+    if ((dstep == 1) && (sstep == 1))
+    {
+	memcpy (dst, src, 4 * nsamp);
+	return;
+    }
+#endif
+    for (i = 0; i < nsamp; i++)
+    {
+	p = (const unsigned char *) src;
+#ifdef SCONV_BIG_ENDIAN
+	dst [0] = p [3];
+	dst [1] = p [2];
+	dst [2] = p [1];
+	dst [3] = p [0];
+#else
+	memcpy (dst, p, 4);
+#endif
+	src += sstep;
+	dst += 4 * dstep;
+    }
+}
+
+
+static void dec32le_ref (float *dst, int dstep, const unsigned char *src, int sstep, int nsamp)
+{
+    int      i;
+    int32_t  v;
+
+    for (i = 0; i < nsamp; i++)
+    {
+	v = (int32_t)(src [0] | (src [1] << 8) | (src [2] << 16) | ((uint32_t)(src [3]) << 24));
+	dst [i * dstep] = (float) v * (1.0f / S32);
+	src += 4 * sstep;
+    }
+}
+
+
+static void decflle_ref (float *dst, int dstep, const unsigned char *src, int sstep, int nsamp)
+{
+    int            i;
+    unsigned char  *q;
+
+#ifndef SCONV_BIG_ENDIAN
+    if ((dstep == 1) && (sstep == 1))
+    {
+	memcpy (dst, src, 4 * nsamp);
+	return;
+    }
+#endif
+    for (i = 0; i < nsamp; i++)
+    {
+	q = (unsigned char *) dst;
+#ifdef SCONV_BIG_ENDIAN
+	q [0] = src [3];
+	q [1] = src [2];
+	q [2] = src [1];
+	q [3] = src [0];
+#else
+	memcpy (q, src, 4);
+#endif
+	src += 4 * sstep;
+	dst += dstep;
+    }
+}
+
+
+// Packed 20-bit format: each pair of samples is stored in 5 bytes,
+// as a 40-bit big-endian word. The byte in the middle is shared,
+// so writing a single sample must preserve the other half of it.
+
+
+static inline void put20 (unsigned char *p, int i, int v)
+{
+    p += 5 * (i >> 1);
+    if (i & 1)
+    {
+	p [2] = (p [2] & 0xF0) | ((v >> 16) & 0x0F);
+	p [3] = v >> 8;
+	p [4] = v;
+    }
+    else
+    {
+	p [0] = v >> 12;
+	p [1] = v >> 4;
+	p [2] = (p [2] & 0x0F) | (v << 4);
+    }
+}
+
+
+static inline int get20 (const unsigned char *p, int i)
+{
+    int v;
+
+    p += 5 * (i >> 1);
+    if (i & 1) v = ((p [2] & 0x0F) << 16) + (p [3] << 8) + p [4];
+    else v = (p [0] << 12) + (p [1] << 4) + (p [2] >> 4);
+    if (v & 0x80000) v -= 0x100000;
+    return v;
+}
+
+
+static void enc20_ref (unsigned char *dst, int dind, int dstep, const float *src, int sstep, int nsamp)
+{
+    int  i, v;
+
+    for (i = 0; i < nsamp; i++)
+    {
+	v = (int)(R20 * src [i * sstep] + 0.5f);
+	if (v >  R20) v =  R20;
+	if (v < -R20) v = -R20;
+	put20 (dst, dind, v);
+	dind += dstep;
+    }
+}
+
+
+static void dec20_ref (float *dst, int dstep, const unsigned char *src, int sind, int sstep, int nsamp)
+{
+    int  i;
+
+    for (i = 0; i < nsamp; i++)
+    {
+	dst [i * dstep] = (float) get20 (src, sind) / R20;
+	sind += sstep;
+    }
+}
+
+
+// IEEE half float, rounded to nearest even. Values out of range
+// become infinite, NaNs keep the sign and the upper part of the
+// payload and are made quiet, as done by hardware conversions.
+// The denormal case uses a float addition to round the mantissa,
+// this is also what the vector versions do.
+
+
+static inline unsigned int f2h (float x)
+{
+    uint32_t  f, s;
+
+    memcpy (&f, &x, 4);
+    s = (f >> 16) & 0x8000;
+    f &= 0x7FFFFFFF;
+    if (f > 0x7F800000) return s | 0x7E00 | ((f >> 13) & 0x03FF);
+    if (f >= 0x47800000) return s | 0x7C00;
+    if (f < 0x38800000)
+    {
+	memcpy (&x, &f, 4);
+	x += 0.5f;
+	memcpy (&f, &x, 4);
+	return s | (f - 0x3F000000);
+    }
+    return s | ((f - 0x38000000 + 0x0FFF + ((f >> 13) & 1)) >> 13);
+}
+
+
+static inline float h2f (unsigned int h)
+{
+    uint32_t  f, e;
+    float     x;
+
+    f = (h & 0x7FFF) << 13;
+    e = f & 0x0F800000;
+    f += 0x38000000;
+    if (e == 0x0F800000)
+    {
+	f += 0x38000000;
+	if (f & 0x007FFFFF) f |= 0x00400000;
+    }
+    else if (e == 0)
+    {
+	f += 0x00800000;
+	memcpy (&x, &f, 4);
+	x -= 6.103515625e-5f;
+	memcpy (&f, &x, 4);
+    }
+    f |= (h & 0x8000) << 16;
+    memcpy (&x, &f, 4);
+    return x;
+}
+
+
+static void enchf_ref (unsigned char *dst, int dstep, const float *src, int sstep, int nsamp)
+{
+    int           i;
+    unsigned int  v;
+
+    for (i = 0; i < nsamp; i++)
+    {
+	v = f2h (src [i * sstep]);
+	dst [0] = v >> 8;
+	dst [1] = v;
+	dst += 2 * dstep;
+    }
+}
+
+
+static void dechf_ref (float *dst, int dstep, const unsigned char *src, int sstep, int nsamp)
+{
+    int  i;
+
+    for (i = 0; i < nsamp; i++)
+    {
+	dst [i * dstep] = h2f ((src [0] << 8) + src [1]);
+	src += 2 * sstep;
+    }
+}
+
+
+// Packed 12-bit format, used for block floating point: each pair
+// of samples is stored in 3 bytes, as a 24-bit big-endian word.
+
+
+static inline void put12 (unsigned char *p, int i, int v)
+{
+    p += 3 * (i >> 1);
+    if (i & 1)
+    {
+	p [1] = (p [1] & 0xF0) | ((v >> 8) & 0x0F);
+	p [2] = v;
+    }
+    else
+    {
+	p [0] = v >> 4;
+	p [1] = (p [1] & 0x0F) | (v << 4);
+    }
+}
+
+
+static inline int get12 (const unsigned char *p, int i)
+{
+    int v;
+
+    p += 3 * (i >> 1);
+    if (i & 1) v = ((p [1] & 0x0F) << 8) + p [2];
+    else v = (p [0] << 4) + (p [1] >> 4);
+    if (v & 0x800) v -= 0x1000;
+    return v;
+}
+
+
+static void enc12_ref (unsigned char *dst, int dind, int dstep, const float *src, int sstep, int nsamp)
+{
+    int  i, v;
+
+    for (i = 0; i < nsamp; i++)
+    {
+	v = (int)(R12 * src [i * sstep] + 0.5f);
+	if (v >  R12) v =  R12;
+	if (v < -R12) v = -R12;
+	put12 (dst, dind, v);
+	dind += dstep;
+    }
+}
+
+
+static void dec12_ref (float *dst, int dstep, const unsigned char *src, int sind, int sstep, int nsamp)
+{
+    int  i;
+
+    for (i = 0; i < nsamp; i++)
+    {
+	dst [i * dstep] = (float) get12 (src, sind) / R12;
+	sind += sstep;
+    }
+}
+
+
+static void enci24_ref (int32_t *dst, const float *src, int nsamp)
+{
+    int  i, v;
+
+    for (i = 0; i < nsamp; i++)
+    {
+	v = (int)(R24 * src [i] + 0.5f);
+	if (v >  R24) v =  R24;
+	if (v < -R24) v = -R24;
+	dst [i] = v;
+    }
+}
+
+
+static void deci24_ref (float *dst, int dstep, const int32_t *src, int nsamp)
+{
+    int  i;
+
+    for (i = 0; i < nsamp; i++) dst [i * dstep] = (float) src [i] / R24;
+}
+
+
+static uint32_t peak_ref (const float *src, int nsamp)
+{
+    int       i;
+    uint32_t  u, m;
+
+    m = 0;
+    for (i = 0; i < nsamp; i++)
+    {
+	memcpy (&u, src + i, 4);
+	u &= 0x7FFFFFFF;
+	if (u > m) m = u;
+    }
+    return m;
+}
+
+
+static const Sconvtab sconv_ref =
+{
+    "scalar",
+    enc16_ref, enc24_ref, encfl_ref, enc32le_ref, encflle_ref, enc20_ref, enchf_ref, enc12_ref, enci24_ref,
+    dec16_ref, dec24_ref, decfl_ref, dec32le_ref, decflle_ref, dec20_ref, dechf_ref, dec12_ref, deci24_ref,
+    peak_ref
+};
+
+
+// ----------------------------------------------------------------------------
+
+
+#ifdef SCONV_X86
+
+
+// SSE4.1 versions, 4 samples per iteration. Only the float side
+// of the conversion needs to be contiguous to use vector code.
+// Strided packet data is written or read one sample at a time,
+// which is still a lot faster than doing the arithmetic in scalar
+// code. Remaining samples are handled by the reference versions.
+
+
+#define SSE __attribute__ ((target ("sse4.1")))
+#define AVX __attribute__ ((target ("avx2")))
+
+
+// Byte shuffles, from host int32 to big-endian 16, 24 and 32 bit
+// and back. The 'P' versions pack samples, the 'S' versions leave
+// one sample per 32-bit lane, for strided access.
+#define SHUF_E16P   1,  0,  5,  4,  9,  8, 13, 12, -1, -1, -1, -1, -1, -1, -1, -1
+#define SHUF_E16S   1,  0, -1, -1,  5,  4, -1, -1,  9,  8, -1, -1, 13, 12, -1, -1
+#define SHUF_E24P   2,  1,  0,  6,  5,  4, 10,  9,  8, 14, 13, 12, -1, -1, -1, -1
+#define SHUF_E24S   2,  1,  0, -1,  6,  5,  4, -1, 10,  9,  8, -1, 14, 13, 12, -1
+#define SHUF_SW32   3,  2,  1,  0,  7,  6,  5,  4, 11, 10,  9,  8, 15, 14, 13, 12
+#define SHUF_D16P  -1, -1,  1,  0, -1, -1,  3,  2, -1, -1,  5,  4, -1, -1,  7,  6
+#define SHUF_D16S  -1, -1,  1,  0, -1, -1,  5,  4, -1, -1,  9,  8, -1, -1, 13, 12
+#define SHUF_D24P  -1,  2,  1,  0, -1,  5,  4,  3, -1,  8,  7,  6, -1, 11, 10,  9
+#define SHUF_D24S  -1,  2,  1,  0, -1,  6,  5,  4, -1, 10,  9,  8, -1, 14, 13, 12
+
+// Packed 20 and 12-bit, see sse_pack20 () and sse_unpack20 ().
+#define SHUF_E20P   4,  3,  2,  1,  0, 12, 11, 10,  9,  8, -1, -1, -1, -1, -1, -1
+#define SHUF_D20L  -1,  2,  1,  0, -1,  4,  3,  2, -1,  7,  6,  5, -1,  9,  8,  7
+#define SHUF_D20H  -1,  8,  7,  6, -1, 10,  9,  8, -1, 13, 12, 11, -1, 15, 14, 13
+#define SHUF_E12P   2,  1,  0, 10,  9,  8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+#define SHUF_D12P  -1, -1,  1,  0, -1, -1,  2,  1, -1, -1,  4,  3, -1, -1,  5,  4
+
+
+// Scale, round and clip 4 floats to integer, as in the reference code.
+SSE static inline __m128i sse_quant (const float *src, __m128 g, __m128i lim)
+{
+    __m128i v;
+
+    v = _mm_cvttps_epi32 (_mm_add_ps (_mm_mul_ps (_mm_loadu_ps (src), g), _mm_set1_ps (0.5f)));
+    v = _mm_min_epi32 (v, lim);
+    return _mm_max_epi32 (v, _mm_sub_epi32 (_mm_setzero_si128 (), lim));
+}
+
+
+// Write 4 shuffled samples of 'size' bytes, one per 32-bit lane.
+SSE static inline void sse_scatter (unsigned char *dst, int step, __m128i v, int size)
+{
+    uint32_t  t [4];
+
+    _mm_storeu_si128 ((__m128i *) t, v);
+    memcpy (dst, t + 0, size); dst += step;
+    memcpy (dst, t + 1, size); dst += step;
+    memcpy (dst, t + 2, size); dst += step;
+    memcpy (dst, t + 3, size);
+}
+
+
+// Read 4 samples of 'size' bytes into the 32-bit lanes.
+SSE static inline __m128i sse_gather (const unsigned char *src, int step, int size)
+{
+    uint32_t  t [4] = { 0, 0, 0, 0 };
+
+    memcpy (t + 0, src, size); src += step;
+    memcpy (t + 1, src, size); src += step;
+    memcpy (t + 2, src, size); src += step;
+    memcpy (t + 3, src, size);
+    return _mm_loadu_si128 ((const __m128i *) t);
+}
+
+
+// Write 4 floats with the given step.
+SSE static inline void sse_store (float *dst, int step, __m128 v)
+{
+    if (step == 1) _mm_storeu_ps (dst, v);
+    else
+    {
+	float t [4];
+
+	_mm_storeu_ps (t, v);
+	dst [0] = t [0];
+	dst [step] = t [1];
+	dst [2 * step] = t [2];
+	dst [3 * step] = t [3];
+    }
+}
+
+
+SSE static void enc16_sse (unsigned char *dst, int dstep, const float *src, int sstep, int nsamp)
+{
+    __m128   g;
+    __m128i  v, m, lim;
+
+    if (sstep == 1)
+    {
+	g = _mm_set1_ps (R16);
+	lim = _mm_set1_epi32 (R16);
+	m = (dstep == 1) ? _mm_setr_epi8 (SHUF_E16P) : _mm_setr_epi8 (SHUF_E16S);
+	for (; nsamp >= 4; nsamp -= 4)
+	{
+	    v = _mm_shuffle_epi8 (sse_quant (src, g, lim), m);
+	    if (dstep == 1) _mm_storel_epi64 ((__m128i *) dst, v);
+	    else sse_scatter (dst, 2 * dstep, v, 2);
+	    src += 4;
+	    dst += 8 * dstep;
+	}
+    }
+    enc16_ref (dst, dstep, src, sstep, nsamp);
+}
+
+
+SSE static void enc24_sse (unsigned char *dst, int dstep, const float *src, int sstep, int nsamp)
+{
+    __m128   g;
+    __m128i  v, m, lim;
+
+    if (sstep == 1)
+    {
+	g = _mm_set1_ps (R24);
+	lim = _mm_set1_epi32 (R24);
+	m = (dstep == 1) ? _mm_setr_epi8 (SHUF_E24P) : _mm_setr_epi8 (SHUF_E24S);
+	for (; nsamp >= 4; nsamp -= 4)
+	{
+	    v = _mm_shuffle_epi8 (sse_quant (src, g, lim), m);
+	    if (dstep == 1)
+	    {
+		int32_t t = _mm_extract_epi32 (v, 2);
+		_mm_storel_epi64 ((__m128i *) dst, v);
+		memcpy (dst + 8, &t, 4);
+	    }
+	    else sse_scatter (dst, 3 * dstep, v, 3);
+	    src += 4;
+	    dst += 12 * dstep;
+	}
+    }
+    enc24_ref (dst, dstep, src, sstep, nsamp);
+}
+
+
+SSE static void encfl_sse (unsigned char *dst, int dstep, const float *src, int sstep, int nsamp)
+{
+    __m128i  v, m;
+
+    if (sstep == 1)
+    {
+	m = _mm_setr_epi8 (SHUF_SW32);
+	for (; nsamp >= 4; nsamp -= 4)
+	{
+	    v = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) src), m);
+	    if (dstep == 1) _mm_storeu_si128 ((__m128i *) dst, v);
+	    else sse_scatter (dst, 4 * dstep, v, 4);
+	    src += 4;
+	    dst += 16 * dstep;
+	}
+    }
+    encfl_ref (dst, dstep, src, sstep, nsamp);
+}
+
+
+SSE static void dec16_sse (float *dst, int dstep, const unsigned char *src, int sstep, int nsamp)
+{
+    __m128   g;
+    __m128i  v, m;
+
+    g = _mm_set1_ps (R16);
+    m = (sstep == 1) ? _mm_setr_epi8 (SHUF_D16P) : _mm_setr_epi8 (SHUF_D16S);
+    for (; nsamp >= 4; nsamp -= 4)
+    {
+	if (sstep == 1) v = _mm_loadl_epi64 ((const __m128i *) src);
+	else v = sse_gather (src, 2 * sstep, 2);
+	v = _mm_srai_epi32 (_mm_shuffle_epi8 (v, m), 16);
+	sse_store (dst, dstep, _mm_div_ps (_mm_cvtepi32_ps (v), g));
+	src += 8 * sstep;
+	dst += 4 * dstep;
+    }
+    dec16_ref (dst, dstep, src, sstep, nsamp);
+}
+
+
+SSE static void dec24_sse (float *dst, int dstep, const unsigned char *src, int sstep, int nsamp)
+{
+    __m128   g;
+    __m128i  v, m;
+    int32_t  t;
+
+    g = _mm_set1_ps (R24);
+    m = (sstep == 1) ? _mm_setr_epi8 (SHUF_D24P) : _mm_setr_epi8 (SHUF_D24S);
+    for (; nsamp >= 4; nsamp -= 4)
+    {
+	if (sstep == 1)
+	{
+	    memcpy (&t, src + 8, 4);
+	    v = _mm_insert_epi32 (_mm_loadl_epi64 ((const __m128i *) src), t, 2);
+	}
+	else v = sse_gather (src, 3 * sstep, 3);
+	v = _mm_srai_epi32 (_mm_shuffle_epi8 (v, m), 8);
+	sse_store (dst, dstep, _mm_div_ps (_mm_cvtepi32_ps (v), g));
+	src += 12 * sstep;
+	dst += 4 * dstep;
+    }
+    dec24_ref (dst, dstep, src, sstep, nsamp);
+}
+
+
+SSE static void decfl_sse (float *dst, int dstep, const unsigned char *src, int sstep, int nsamp)
+{
+    __m128i  v, m;
+
+    m = _mm_setr_epi8 (SHUF_SW32);
+    for (; nsamp >= 4; nsamp -= 4)
+    {
+	if (sstep == 1) v = _mm_loadu_si128 ((const __m128i *) src);
+	else v = sse_gather (src, 4 * sstep, 4);
+	sse_store (dst, dstep, _mm_castsi128_ps (_mm_shuffle_epi8 (v, m)));
+	src += 16 * sstep;
+	dst += 4 * dstep;
+    }
+    decfl_ref (dst, dstep, src, sstep, nsamp);
+}
+
+
+SSE static void enc32le_sse (unsigned char *dst, int dstep, const float *src, int sstep, int nsamp)
+{
+    __m128   f;
+    __m128i  v;
+
+    if (sstep == 1)
+    {
+	for (; nsamp >= 4; nsamp -= 4)
+	{
+	    // Operand order matters: a NaN must be kept as in the scalar code.
+	    f = _mm_mul_ps (_mm_loadu_ps (src), _mm_set1_ps (S32));
+	    f = _mm_min_ps (_mm_set1_ps (M32), f);
+	    f = _mm_max_ps (_mm_set1_ps (-M32), f);
+	    v = _mm_cvttps_epi32 (f);
+	    if (dstep == 1) _mm_storeu_si128 ((__m128i *) dst, v);
+	    else sse_scatter (dst, 4 * dstep, v, 4);
+	    src += 4;
+	    dst += 16 * dstep;
+	}
+    }
+    enc32le_ref (dst, dstep, src, sstep, nsamp);
+}
+
+
+SSE static void dec32le_sse (float *dst, int dstep, const unsigned char *src, int sstep, int nsamp)
+{
+    __m128i  v;
+
+    for (; nsamp >= 4; nsamp -= 4)
+    {
+	if (sstep == 1) v = _mm_loadu_si128 ((const __m128i *) src);
+	else v = sse_gather (src, 4 * sstep, 4);
+	sse_store (dst, dstep, _mm_mul_ps (_mm_cvtepi32_ps (v), _mm_set1_ps (1.0f / S32)));
+	src += 16 * sstep;
+	dst += 4 * dstep;
+    }
+    dec32le_ref (dst, dstep, src, sstep, nsamp);
+}
+
+
+// Pack 4 samples into 10 bytes. Each pair is combined into a 40-bit
+// word in a 64-bit lane, which is then byte swapped.
+SSE static inline __m128i sse_pack20 (__m128i v)
+{
+    __m128i m, a, b;
+
+    m = _mm_set1_epi64x (0xFFFFF);
+    a = _mm_slli_epi64 (_mm_and_si128 (v, m), 20);
+    b = _mm_and_si128 (_mm_srli_epi64 (v, 32), m);
+    return _mm_shuffle_epi8 (_mm_or_si128 (a, b), _mm_setr_epi8 (SHUF_E20P));
+}
+
+
+// Unpack 4 samples, already shuffled so the 20 bits of each are in
+// the upper part of a 32-bit lane, except for the 4 upper bits of
+// the odd ones which need an extra shift.
+SSE static inline __m128i sse_unpack20 (__m128i v)
+{
+    return _mm_srai_epi32 (_mm_blend_epi16 (v, _mm_slli_epi32 (v, 4), 0xCC), 12);
+}
+
+
+// Idem for 12-bit samples, with 12 bits in each lane.
+SSE static inline __m128i sse_unpack12 (__m128i v)
+{
+    return _mm_srai_epi32 (_mm_blend_epi16 (v, _mm_slli_epi32 (v, 4), 0xCC), 20);
+}
+
+
+// Packed data is handled 8 samples, or 20 bytes, at a time, and
+// only if contiguous. An odd first sample is done separately.
+SSE static void enc20_sse (unsigned char *dst, int dind, int dstep, const float *src, int sstep, int nsamp)
+{
+    __m128   g;
+    __m128i  v0, v1, lim;
+    int32_t  t;
+
+    if ((sstep == 1) && (dstep == 1))
+    {
+	if ((dind & 1) && nsamp)
+	{
+	    enc20_ref (dst, dind++, 1, src++, 1, 1);
+	    nsamp--;
+	}
+	g = _mm_set1_ps (R20);
+	lim = _mm_set1_epi32 (R20);
+	dst += 5 * (dind >> 1);
+	dind = 0;
+	for (; nsamp >= 8; nsamp -= 8)
+	{
+	    v0 = sse_pack20 (sse_quant (src, g, lim));
+	    v1 = sse_pack20 (sse_quant (src + 4, g, lim));
+	    _mm_storeu_si128 ((__m128i *) dst, _mm_or_si128 (v0, _mm_slli_si128 (v1, 10)));
+	    t = _mm_cvtsi128_si32 (_mm_srli_si128 (v1, 6));
+	    memcpy (dst + 16, &t, 4);
+	    src += 8;
+	    dst += 20;
+	}
+    }
+    enc20_ref (dst, dind, dstep, src, sstep, nsamp);
+}
+
+
+SSE static void dec20_sse (float *dst, int dstep, const unsigned char *src, int sind, int sstep, int nsamp)
+{
+    __m128   g;
+    __m128i  v;
+
+    if (sstep == 1)
+    {
+	if ((sind & 1) && nsamp)
+	{
+	    dec20_ref (dst, 1, src, sind++, 1, 1);
+	    dst += dstep;
+	    nsamp--;
+	}
+	g = _mm_set1_ps (R20);
+	src += 5 * (sind >> 1);
+	sind = 0;
+	for (; nsamp >= 8; nsamp -= 8)
+	{
+	    v = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *) src), _mm_setr_epi8 (SHUF_D20L));
+	    sse_store (dst, dstep, _mm_div_ps (_mm_cvtepi32_ps (sse_unpack20 (v)), g));
+	    v = _mm_shuffle_epi8 (_mm_loadu_si128 ((const __m128i *)(src + 4)), _mm_setr_epi8 (SHUF_D20H));
+	    sse_store (dst + 4 * dstep, dstep, _mm_div_ps (_mm_cvtepi32_ps (sse_unpack20 (v)), g));
+	    src += 20;
+	    dst += 8 * dstep;
+	}
+    }
+    dec20_ref (dst, dstep, src, sind, sstep, nsamp);
+}
+
+
+// Half float conversion, same algorithm as f2h () and h2f ().
+SSE static inline __m128i sse_f2h (__m128 x)
+{
+    __m128i  f, s, n, d, q;
+
+    f = _mm_castps_si128 (x);
+    s = _mm_and_si128 (_mm_srli_epi32 (f, 16), _mm_set1_epi32 (0x8000));
+    f = _mm_and_si128 (f, _mm_set1_epi32 (0x7FFFFFFF));
+    n = _mm_add_epi32 (f, _mm_set1_epi32 (0x0FFF - 0x38000000));
+    n = _mm_add_epi32 (n, _mm_and_si128 (_mm_srli_epi32 (f, 13), _mm_set1_epi32 (1)));
+    n = _mm_srli_epi32 (n, 13);
+    d = _mm_castps_si128 (_mm_add_ps (_mm_castsi128_ps (f), _mm_set1_ps (0.5f)));
+    d = _mm_sub_epi32 (d, _mm_set1_epi32 (0x3F000000));
+    n = _mm_blendv_epi8 (n, d, _mm_cmplt_epi32 (f, _mm_set1_epi32 (0x38800000)));
+    q = _mm_and_si128 (_mm_srli_epi32 (f, 13), _mm_set1_epi32 (0x03FF));
+    q = _mm_and_si128 (_mm_or_si128 (q, _mm_set1_epi32 (0x0200)), _mm_cmpgt_epi32 (f, _mm_set1_epi32 (0x7F800000)));
+    n = _mm_blendv_epi8 (n, _mm_or_si128 (q, _mm_set1_epi32 (0x7C00)), _mm_cmpgt_epi32 (f, _mm_set1_epi32 (0x477FFFFF)));
+    return _mm_or_si128 (n, s);
+}
+
+
+SSE static inline __m128 sse_h2f (__m128i h)
+{
+    __m128i  f, e, m, d;
+
+    f = _mm_slli_epi32 (_mm_and_si128 (h, _mm_set1_epi32 (0x7FFF)), 13);
+    e = _mm_and_si128 (f, _mm_set1_epi32 (0x0F800000));
+    f = _mm_add_epi32 (f, _mm_set1_epi32 (0x38000000));
+    m = _mm_cmpeq_epi32 (e, _mm_set1_epi32 (0x0F800000));
+    f = _mm_add_epi32 (f, _mm_and_si128 (m, _mm_set1_epi32 (0x38000000)));
+    m = _mm_andnot_si128 (_mm_cmpeq_epi32 (_mm_and_si128 (f, _mm_set1_epi32 (0x007FFFFF)), _mm_setzero_si128 ()), m);
+    f = _mm_or_si128 (f, _mm_and_si128 (m, _mm_set1_epi32 (0x00400000)));
+    d = _mm_add_epi32 (f, _mm_set1_epi32 (0x00800000));
+    d = _mm_castps_si128 (_mm_sub_ps (_mm_castsi128_ps (d), _mm_set1_ps (6.103515625e-5f)));
+    f = _mm_blendv_epi8 (f, d, _mm_cmpeq_epi32 (e, _mm_setzero_si128 ()));
+    f = _mm_or_si128 (f, _mm_slli_epi32 (_mm_and_si128 (h, _mm_set1_epi32 (0x8000)), 16));
+    return _mm_castsi128_ps (f);
+}
+
+
+SSE static void enchf_sse (unsigned char *dst, int dstep, const float *src, int sstep, int nsamp)
+{
+    __m128i  v, m;
+
+    if (sstep == 1)
+    {
+	m = (dstep == 1) ? _mm_setr_epi8 (SHUF_E16P) : _mm_setr_epi8 (SHUF_E16S);
+	for (; nsamp >= 4; nsamp -= 4)
+	{
+	    v = _mm_shuffle_epi8 (sse_f2h (_mm_loadu_ps (src)), m);
+	    if (dstep == 1) _mm_storel_epi64 ((__m128i *) dst, v);
+	    else sse_scatter (dst, 2 * dstep, v, 2);
+	    src += 4;
+	    dst += 8 * dstep;
+	}
+    }
+    enchf_ref (dst, dstep, src, sstep, nsamp);
+}
+
+
+SSE static void dechf_sse (float *dst, int dstep, const unsigned char *src, int sstep, int nsamp)
+{
+    __m128i  v, m;
+
+    m = (sstep == 1) ? _mm_setr_epi8 (SHUF_D16P) : _mm_setr_epi8 (SHUF_D16S);
+    for (; nsamp >= 4; nsamp -= 4)
+    {
+	if (sstep == 1) v = _mm_loadl_epi64 ((const __m128i *) src);
+	else v = sse_gather (src, 2 * sstep, 2);
+	v = _mm_srli_epi32 (_mm_shuffle_epi8 (v, m), 16);
+	sse_store (dst, dstep, sse_h2f (v));
+	src += 8 * sstep;
+	dst += 4 * dstep;
+    }
+    dechf_ref (dst, dstep, src, sstep, nsamp);
+}
+
+
+// Packed 12-bit, 8 samples or 12 bytes at a time, in the same way
+// as the 20-bit format.
+SSE static void enc12_sse (unsigned char *dst, int dind, int dstep, const float *src, int sstep, int nsamp)
+{
+    __m128   g;
+    __m128i  v0, v1, m, lim;
+    int32_t  t;
+
+    if ((sstep == 1) && (dstep == 1))
+    {
+	if ((dind & 1) && nsamp)
+	{
+	    enc12_ref (dst, dind++, 1, src++, 1, 1);
+	    nsamp--;
+	}
+	g = _mm_set1_ps (R12);
+	lim = _mm_set1_epi32 (R12);
+	m = _mm_set1_epi64x (0xFFF);
+	dst += 3 * (dind >> 1);
+	dind = 0;
+	for (; nsamp >= 8; nsamp -= 8)
+	{
+	    v0 = sse_quant (src, g, lim);
+	    v1 = sse_quant (src + 4, g, lim);
+	    v0 = _mm_or_si128 (_mm_slli_epi64 (_mm_and_si128 (v0, m), 12), _mm_and_si128 (_mm_srli_epi64 (v0, 32), m));
+	    v1 = _mm_or_si128 (_mm_slli_epi64 (_mm_and_si128 (v1, m), 12), _mm_and_si128 (_mm_srli_epi64 (v1, 32), m));
+	    v0 = _mm_shuffle_epi8 (v0, _mm_setr_epi8 (SHUF_E12P));
+	    v1 = _mm_shuffle_epi8 (v1, _mm_setr_epi8 (SHUF_E12P));
+	    v0 = _mm_or_si128 (v0, _mm_slli_si128 (v1, 6));
+	    _mm_storel_epi64 ((__m128i *) dst, v0);
+	    t = _mm_extract_epi32 (v0, 2);
+	    memcpy (dst + 8, &t, 4);
+	    src += 8;
+	    dst += 12;
+	}
+    }
+    enc12_ref (dst, dind, dstep, src, sstep, nsamp);
+}
+
+
+SSE static void dec12_sse (float *dst, int dstep, const unsigned char *src, int sind, int sstep, int nsamp)
+{
+    __m128   g;
+    __m128i  v, m;
+    int32_t  t;
+
+    if (sstep == 1)
+    {
+	if ((sind & 1) && nsamp)
+	{
+	    dec12_ref (dst, 1, src, sind++, 1, 1);
+	    dst += dstep;
+	    nsamp--;
+	}
+	g = _mm_set1_ps (R12);
+	m = _mm_setr_epi8 (SHUF_D12P);
+	src += 3 * (sind >> 1);
+	sind = 0;
+	for (; nsamp >= 8; nsamp -= 8)
+	{
+	    memcpy (&t, src + 8, 4);
+	    v = _mm_insert_epi32 (_mm_loadl_epi64 ((const __m128i *) src), t, 2);
+	    sse_store (dst, dstep, _mm_div_ps (_mm_cvtepi32_ps (sse_unpack12 (_mm_shuffle_epi8 (v, m))), g));
+	    v = _mm_srli_si128 (v, 6);
+	    sse_store (dst + 4 * dstep, dstep, _mm_div_ps (_mm_cvtepi32_ps (sse_unpack12 (_mm_shuffle_epi8 (v, m))), g));
+	    src += 12;
+	    dst += 8 * dstep;
+	}
+    }
+    dec12_ref (dst, dstep, src, sind, sstep, nsamp);
+}
+
+
+SSE static void enci24_sse (int32_t *dst, const float *src, int nsamp)
+{
+    __m128   g;
+    __m128i  lim;
+
+    g = _mm_set1_ps (R24);
+    lim = _mm_set1_epi32 (R24);
+    for (; nsamp >= 4; nsamp -= 4)
+    {
+	_mm_storeu_si128 ((__m128i *) dst, sse_quant (src, g, lim));
+	src += 4;
+	dst += 4;
+    }
+    enci24_ref (dst, src, nsamp);
+}
+
+
+SSE static void deci24_sse (float *dst, int dstep, const int32_t *src, int nsamp)
+{
+    __m128  g;
+
+    g = _mm_set1_ps (R24);
+    for (; nsamp >= 4; nsamp -= 4)
+    {
+	sse_store (dst, dstep, _mm_div_ps (_mm_cvtepi32_ps (_mm_loadu_si128 ((const __m128i *) src)), g));
+	src += 4;
+	dst += 4 * dstep;
+    }
+    deci24_ref (dst, dstep, src, nsamp);
+}
+
+
+// Unsigned integer compare on the float bits.
+SSE static uint32_t peak_sse (const float *src, int nsamp)
+{
+    __m128i  v, a, m;
+
+    a = _mm_setzero_si128 ();
+    m = _mm_set1_epi32 (0x7FFFFFFF);
+    for (; nsamp >= 4; nsamp -= 4)
+    {
+	v = _mm_and_si128 (_mm_loadu_si128 ((const __m128i *) src), m);
+	a = _mm_max_epu32 (a, v);
+	src += 4;
+    }
+    a = _mm_max_epu32 (a, _mm_shuffle_epi32 (a, 0x4E));
+    a = _mm_max_epu32 (a, _mm_shuffle_epi32 (a, 0xB1));
+    v = _mm_cvtsi32_si128 (peak_ref (src, nsamp));
+    return _mm_cvtsi128_si32 (_mm_max_epu32 (a, v));
+}
+
+
+// Little-endian float needs no conversion, and the reference
+// versions use memcpy () whenever possible.
+static const Sconvtab sconv_sse =
+{
+    "sse4.1",
+    enc16_sse, enc24_sse, encfl_sse, enc32le_sse, encflle_ref, enc20_sse, enchf_sse, enc12_sse, enci24_sse,
+    dec16_sse, dec24_sse, decfl_sse, dec32le_sse, decflle_ref, dec20_sse, dechf_sse, dec12_sse, deci24_sse,
+    peak_sse
+};
+
+
+// AVX2 versions, 8 samples per iteration. Byte shuffles operate
+// on each 128-bit half separately, so the same masks can be used.
+// The strided cases are handled as two SSE blocks. The upper halves
+// of the registers must be cleared before calling non-VEX code for
+// the remaining samples, the compiler does not always do this and
+// the penalty is large.
+
+
+AVX static inline __m256i avx_quant (const float *src, __m256 g, __m256i lim)
+{
+    __m256i v;
+
+    v = _mm256_cvttps_epi32 (_mm256_add_ps (_mm256_mul_ps (_mm256_loadu_ps (src), g), _mm256_set1_ps (0.5f)));
+    v = _mm256_min_epi32 (v, lim);
+    return _mm256_max_epi32 (v, _mm256_sub_epi32 (_mm256_setzero_si256 (), lim));
+}
+
+
+AVX static inline void avx_store (float *dst, int step, __m256 v)
+{
+    if (step == 1) _mm256_storeu_ps (dst, v);
+    else
+    {
+	sse_store (dst, step, _mm256_castps256_ps128 (v));
+	sse_store (dst + 4 * step, step, _mm256_extractf128_ps (v, 1));
+    }
+}
+
+
+AVX static void enc16_avx (unsigned char *dst, int dstep, const float *src, int sstep, int nsamp)
+{
+    __m256   g;
+    __m256i  v, m, lim;
+
+    if (sstep == 1)
+    {
+	g = _mm256_set1_ps (R16);
+	lim = _mm256_set1_epi32 (R16);
+	m = (dstep == 1) ? _mm256_setr_epi8 (SHUF_E16P, SHUF_E16P) : _mm256_setr_epi8 (SHUF_E16S, SHUF_E16S);
+	for (; nsamp >= 8; nsamp -= 8)
+	{
+	    v = _mm256_shuffle_epi8 (avx_quant (src, g, lim), m);
+	    if (dstep == 1)
+	    {
+		// Move the 8 bytes of the upper half next to those of the lower one.
+		v = _mm256_permute4x64_epi64 (v, 0x08);
+		_mm_storeu_si128 ((__m128i *) dst, _mm256_castsi256_si128 (v));
+	    }
+	    else
+	    {
+		sse_scatter (dst, 2 * dstep, _mm256_castsi256_si128 (v), 2);
+		sse_scatter (dst + 8 * dstep, 2 * dstep, _mm256_extracti128_si256 (v, 1), 2);
+	    }
+	    src += 8;
+	    dst += 16 * dstep;
+	}
+    }
+    _mm256_zeroupper ();
+    enc16_sse (dst, dstep, src, sstep, nsamp);
+}
+
+
+AVX static void enc24_avx (unsigned char *dst, int dstep, const float *src, int sstep, int nsamp)
+{
+    __m256   g;
+    __m256i  v, m, lim;
+    __m128i  a, b;
+
+    if (sstep == 1)
+    {
+	g = _mm256_set1_ps (R24);
+	lim = _mm256_set1_epi32 (R24);
+	m = (dstep == 1) ? _mm256_setr_epi8 (SHUF_E24P, SHUF_E24P) : _mm256_setr_epi8 (SHUF_E24S, SHUF_E24S);
+	for (; nsamp >= 8; nsamp -= 8)
+	{
+	    v = _mm256_shuffle_epi8 (avx_quant (src, g, lim), m);
+	    a = _mm256_castsi256_si128 (v);
+	    b = _mm256_extracti128_si256 (v, 1);
+	    if (dstep == 1)
+	    {
+		// Each half has 12 valid bytes, total 24.
+		_mm_storeu_si128 ((__m128i *) dst, _mm_or_si128 (a, _mm_slli_si128 (b, 12)));
+		_mm_storel_epi64 ((__m128i *)(dst + 16), _mm_srli_si128 (b, 4));
+	    }
+	    else
+	    {
+		sse_scatter (dst, 3 * dstep, a, 3);
+		sse_scatter (dst + 12 * dstep, 3 * dstep, b, 3);
+	    }
+	    src += 8;
+	    dst += 24 * dstep;
+	}
+    }
+    _mm256_zeroupper ();
+    enc24_sse (dst, dstep, src, sstep, nsamp);
+}
+
+
+AVX static void encfl_avx (unsigned char *dst, int dstep, const float *src, int sstep, int nsamp)
+{
+    __m256i  v, m;
+
+    if (sstep == 1)
+    {
+	m = _mm256_setr_epi8 (SHUF_SW32, SHUF_SW32);
+	for (; nsamp >= 8; nsamp -= 8)
+	{
+	    v = _mm256_shuffle_epi8 (_mm256_loadu_si256 ((const __m256i *) src), m);
+	    if (dstep == 1) _mm256_storeu_si256 ((__m256i *) dst, v);
+	    else
+	    {
+		sse_scatter (dst, 4 * dstep, _mm256_castsi256_si128 (v), 4);
+		sse_scatter (dst + 16 * dstep, 4 * dstep, _mm256_extracti128_si256 (v, 1), 4);
+	    }
+	    src += 8;
+	    dst += 32 * dstep;
+	}
+    }
+    _mm256_zeroupper ();
+    encfl_sse (dst, dstep, src, sstep, nsamp);
+}
+
+
+AVX static void dec16_avx (float *dst, int dstep, const unsigned char *src, int sstep, int nsamp)
+{
+    __m256   g;
+    __m256i  v, m;
+
+    if (sstep == 1)
+    {
+	g = _mm256_set1_ps (R16);
+	m = _mm256_setr_epi8 (SHUF_D16P, SHUF_D16P);
+	for (; nsamp >= 8; nsamp -= 8)
+	{
+	    // Samples 0..3 to the lower half, 4..7 to the upper one.
+	    v = _mm256_castsi128_si256 (_mm_loadl_epi64 ((const __m128i *) src));
+	    v = _mm256_inserti128_si256 (v, _mm_loadl_epi64 ((const __m128i *)(src + 8)), 1);
+	    v = _mm256_srai_epi32 (_mm256_shuffle_epi8 (v, m), 16);
+	    avx_store (dst, dstep, _mm256_div_ps (_mm256_cvtepi32_ps (v), g));
+	    src += 16;
+	    dst += 8 * dstep;
+	}
+    }
+    _mm256_zeroupper ();
+    dec16_sse (dst, dstep, src, sstep, nsamp);
+}
+
+
+AVX static void dec24_avx (float *dst, int dstep, const unsigned char *src, int sstep, int nsamp)
+{
+    __m256   g;
+    __m256i  v, m;
+
+    if (sstep == 1)
+    {
+	g = _mm256_set1_ps (R24);
+	m = _mm256_setr_epi8 (SHUF_D24P, SHUF_D24P);
+	for (; nsamp >= 8; nsamp -= 8)
+	{
+	    // Bytes 0..15 to the lower half, 12..23 to the upper one.
+	    v = _mm256_castsi128_si256 (_mm_loadu_si128 ((const __m128i *) src));
+	    v = _mm256_inserti128_si256 (v, _mm_srli_si128 (_mm_loadu_si128 ((const __m128i *)(src + 8)), 4), 1);
+	    v = _mm256_srai_epi32 (_mm256_shuffle_epi8 (v, m), 8);
+	    avx_store (dst, dstep, _mm256_div_ps (_mm256_cvtepi32_ps (v), g));
+	    src += 24;
+	    dst += 8 * dstep;
+	}
+    }
+    _mm256_zeroupper ();
+    dec24_sse (dst, dstep, src, sstep, nsamp);
+}
+
+
+AVX static void decfl_avx (float *dst, int dstep, const unsigned char *src, int sstep, int nsamp)
+{
+    __m256i  v, m;
+
+    if (sstep == 1)
+    {
+	m = _mm256_setr_epi8 (SHUF_SW32, SHUF_SW32);
+	for (; nsamp >= 8; nsamp -= 8)
+	{
+	    v = _mm256_shuffle_epi8 (_mm256_loadu_si256 ((const __m256i *) src), m);
+	    avx_store (dst, dstep, _mm256_castsi256_ps (v));
+	    src += 32;
+	    dst += 8 * dstep;
+	}
+    }
+    _mm256_zeroupper ();
+    decfl_sse (dst, dstep, src, sstep, nsamp);
+}
+
+
+AVX static void enc32le_avx (unsigned char *dst, int dstep, const float *src, int sstep, int nsamp)
+{
+    __m256   f;
+    __m256i  v;
+
+    if (sstep == 1)
+    {
+	for (; nsamp >= 8; nsamp -= 8)
+	{
+	    f = _mm256_mul_ps (_mm256_loadu_ps (src), _mm256_set1_ps (S32));
+	    f = _mm256_min_ps (_mm256_set1_ps (M32), f);
+	    f = _mm256_max_ps (_mm256_set1_ps (-M32), f);
+	    v = _mm256_cvttps_epi32 (f);
+	    if (dstep == 1) _mm256_storeu_si256 ((__m256i *) dst, v);
+	    else
+	    {
+		sse_scatter (dst, 4 * dstep, _mm256_castsi256_si128 (v), 4);
+		sse_scatter (dst + 16 * dstep, 4 * dstep, _mm256_extracti128_si256 (v, 1), 4);
+	    }
+	    src += 8;
+	    dst += 32 * dstep;
+	}
+    }
+    _mm256_zeroupper ();
+    enc32le_sse (dst, dstep, src, sstep, nsamp);
+}
+
+
+AVX static void dec32le_avx (float *dst, int dstep, const unsigned char *src, int sstep, int nsamp)
+{
+    __m256i  v;
+
+    if (sstep == 1)
+    {
+	for (; nsamp >= 8; nsamp -= 8)
+	{
+	    v = _mm256_loadu_si256 ((const __m256i *) src);
+	    avx_store (dst, dstep, _mm256_mul_ps (_mm256_cvtepi32_ps (v), _mm256_set1_ps (1.0f / S32)));
+	    src += 32;
+	    dst += 8 * dstep;
+	}
+    }
+    _mm256_zeroupper ();
+    dec32le_sse (dst, dstep, src, sstep, nsamp);
+}
+
+
+AVX static void enc20_avx (unsigned char *dst, int dind, int dstep, const float *src, int sstep, int nsamp)
+{
+    __m256   g;
+    __m256i  v, m, lim;
+    __m128i  v0, v1;
+    int32_t  t;
+
+    if ((sstep == 1) && (dstep == 1))
+    {
+	if ((dind & 1) && nsamp)
+	{
+	    enc20_ref (dst, dind++, 1, src++, 1, 1);
+	    nsamp--;
+	}
+	g = _mm256_set1_ps (R20);
+	lim = _mm256_set1_epi32 (R20);
+	m = _mm256_set1_epi64x (0xFFFFF);
+	dst += 5 * (dind >> 1);
+	dind = 0;
+	for (; nsamp >= 8; nsamp -= 8)
+	{
+	    // As sse_pack20 (), giving 10 bytes in each half.
+	    v = avx_quant (src, g, lim);
+	    v = _mm256_or_si256 (_mm256_slli_epi64 (_mm256_and_si256 (v, m), 20),
+				 _mm256_and_si256 (_mm256_srli_epi64 (v, 32), m));
+	    v = _mm256_shuffle_epi8 (v, _mm256_setr_epi8 (SHUF_E20P, SHUF_E20P));
+	    v0 = _mm256_castsi256_si128 (v);
+	    v1 = _mm256_extracti128_si256 (v, 1);
+	    _mm_storeu_si128 ((__m128i *) dst, _mm_or_si128 (v0, _mm_slli_si128 (v1, 10)));
+	    t = _mm_cvtsi128_si32 (_mm_srli_si128 (v1, 6));
+	    memcpy (dst + 16, &t, 4);
+	    src += 8;
+	    dst += 20;
+	}
+    }
+    _mm256_zeroupper ();
+    enc20_sse (dst, dind, dstep, src, sstep, nsamp);
+}
+
+
+AVX static void dec20_avx (float *dst, int dstep, const unsigned char *src, int sind, int sstep, int nsamp)
+{
+    __m256   g;
+    __m256i  v, m;
+
+    if (sstep == 1)
+    {
+	if ((sind & 1) && nsamp)
+	{
+	    dec20_ref (dst, 1, src, sind++, 1, 1);
+	    dst += dstep;
+	    nsamp--;
+	}
+	g = _mm256_set1_ps (R20);
+	m = _mm256_setr_epi8 (SHUF_D20L, SHUF_D20H);
+	src += 5 * (sind >> 1);
+	sind = 0;
+	for (; nsamp >= 8; nsamp -= 8)
+	{
+	    v = _mm256_castsi128_si256 (_mm_loadu_si128 ((const __m128i *) src));
+	    v = _mm256_inserti128_si256 (v, _mm_loadu_si128 ((const __m128i *)(src + 4)), 1);
+	    v = _mm256_shuffle_epi8 (v, m);
+	    v = _mm256_srai_epi32 (_mm256_blend_epi16 (v, _mm256_slli_epi32 (v, 4), 0xCC), 12);
+	    avx_store (dst, dstep, _mm256_div_ps (_mm256_cvtepi32_ps (v), g));
+	    src += 20;
+	    dst += 8 * dstep;
+	}
+    }
+    _mm256_zeroupper ();
+    dec20_sse (dst, dstep, src, sind, sstep, nsamp);
+}
+
+
+AVX static inline __m256i avx_f2h (__m256 x)
+{
+    __m256i  f, s, n, d, q;
+
+    f = _mm256_castps_si256 (x);
+    s = _mm256_and_si256 (_mm256_srli_epi32 (f, 16), _mm256_set1_epi32 (0x8000));
+    f = _mm256_and_si256 (f, _mm256_set1_epi32 (0x7FFFFFFF));
+    n = _mm256_add_epi32 (f, _mm256_set1_epi32 (0x0FFF - 0x38000000));
+    n = _mm256_add_epi32 (n, _mm256_and_si256 (_mm256_srli_epi32 (f, 13), _mm256_set1_epi32 (1)));
+    n = _mm256_srli_epi32 (n, 13);
+    d = _mm256_castps_si256 (_mm256_add_ps (_mm256_castsi256_ps (f), _mm256_set1_ps (0.5f)));
+    d = _mm256_sub_epi32 (d, _mm256_set1_epi32 (0x3F000000));
+    n = _mm256_blendv_epi8 (n, d, _mm256_cmpgt_epi32 (_mm256_set1_epi32 (0x38800000), f));
+    q = _mm256_and_si256 (_mm256_srli_epi32 (f, 13), _mm256_set1_epi32 (0x03FF));
+    q = _mm256_and_si256 (_mm256_or_si256 (q, _mm256_set1_epi32 (0x0200)), _mm256_cmpgt_epi32 (f, _mm256_set1_epi32 (0x7F800000)));
+    n = _mm256_blendv_epi8 (n, _mm256_or_si256 (q, _mm256_set1_epi32 (0x7C00)), _mm256_cmpgt_epi32 (f, _mm256_set1_epi32 (0x477FFFFF)));
+    return _mm256_or_si256 (n, s);
+}
+
+
+AVX static inline __m256 avx_h2f (__m256i h)
+{
+    __m256i  f, e, m, d;
+
+    f = _mm256_slli_epi32 (_mm256_and_si256 (h, _mm256_set1_epi32 (0x7FFF)), 13);
+    e = _mm256_and_si256 (f, _mm256_set1_epi32 (0x0F800000));
+    f = _mm256_add_epi32 (f, _mm256_set1_epi32 (0x38000000));
+    m = _mm256_cmpeq_epi32 (e, _mm256_set1_epi32 (0x0F800000));
+    f = _mm256_add_epi32 (f, _mm256_and_si256 (m, _mm256_set1_epi32 (0x38000000)));
+    m = _mm256_andnot_si256 (_mm256_cmpeq_epi32 (_mm256_and_si256 (f, _mm256_set1_epi32 (0x007FFFFF)), _mm256_setzero_si256 ()), m);
+    f = _mm256_or_si256 (f, _mm256_and_si256 (m, _mm256_set1_epi32 (0x00400000)));
+    d = _mm256_add_epi32 (f, _mm256_set1_epi32 (0x00800000));
+    d = _mm256_castps_si256 (_mm256_sub_ps (_mm256_castsi256_ps (d), _mm256_set1_ps (6.103515625e-5f)));
+    f = _mm256_blendv_epi8 (f, d, _mm256_cmpeq_epi32 (e, _mm256_setzero_si256 ()));
+    f = _mm256_or_si256 (f, _mm256_slli_epi32 (_mm256_and_si256 (h, _mm256_set1_epi32 (0x8000)), 16));
+    return _mm256_castsi256_ps (f);
+}
+
+
+AVX static void enchf_avx (unsigned char *dst, int dstep, const float *src, int sstep, int nsamp)
+{
+    __m256i  v, m;
+
+    if (sstep == 1)
+    {
+	m = (dstep == 1) ? _mm256_setr_epi8 (SHUF_E16P, SHUF_E16P) : _mm256_setr_epi8 (SHUF_E16S, SHUF_E16S);
+	for (; nsamp >= 8; nsamp -= 8)
+	{
+	    v = _mm256_shuffle_epi8 (avx_f2h (_mm256_loadu_ps (src)), m);
+	    if (dstep == 1)
+	    {
+		v = _mm256_permute4x64_epi64 (v, 0x08);
+		_mm_storeu_si128 ((__m128i *) dst, _mm256_castsi256_si128 (v));
+	    }
+	    else
+	    {
+		sse_scatter (dst, 2 * dstep, _mm256_castsi256_si128 (v), 2);
+		sse_scatter (dst + 8 * dstep, 2 * dstep, _mm256_extracti128_si256 (v, 1), 2);
+	    }
+	    src += 8;
+	    dst += 16 * dstep;
+	}
+    }
+    _mm256_zeroupper ();
+    enchf_sse (dst, dstep, src, sstep, nsamp);
+}
+
+
+AVX static void dechf_avx (float *dst, int dstep, const unsigned char *src, int sstep, int nsamp)
+{
+    __m256i  v, m;
+
+    if (sstep == 1)
+    {
+	m = _mm256_setr_epi8 (SHUF_D16P, SHUF_D16P);
+	for (; nsamp >= 8; nsamp -= 8)
+	{
+	    v = _mm256_castsi128_si256 (_mm_loadl_epi64 ((const __m128i *) src));
+	    v = _mm256_inserti128_si256 (v, _mm_loadl_epi64 ((const __m128i *)(src + 8)), 1);
+	    v = _mm256_srli_epi32 (_mm256_shuffle_epi8 (v, m), 16);
+	    avx_store (dst, dstep, avx_h2f (v));
+	    src += 16;
+	    dst += 8 * dstep;
+	}
+    }
+    _mm256_zeroupper ();
+    dechf_sse (dst, dstep, src, sstep, nsamp);
+}
+
+
+AVX static void enci24_avx (int32_t *dst, const float *src, int nsamp)
+{
+    __m256   g;
+    __m256i  lim;
+
+    g = _mm256_set1_ps (R24);
+    lim = _mm256_set1_epi32 (R24);
+    for (; nsamp >= 8; nsamp -= 8)
+    {
+	_mm256_storeu_si256 ((__m256i *) dst, avx_quant (src, g, lim));
+	src += 8;
+	dst += 8;
+    }
+    _mm256_zeroupper ();
+    enci24_ref (dst, src, nsamp);
+}
+
+
+AVX static void deci24_avx (float *dst, int dstep, const int32_t *src, int nsamp)
+{
+    __m256  g;
+
+    g = _mm256_set1_ps (R24);
+    for (; nsamp >= 8; nsamp -= 8)
+    {
+	avx_store (dst, dstep, _mm256_div_ps (_mm256_cvtepi32_ps (_mm256_loadu_si256 ((const __m256i *) src)), g));
+	src += 8;
+	dst += 8 * dstep;
+    }
+    _mm256_zeroupper ();
+    deci24_ref (dst, dstep, src, nsamp);
+}
+
+
+AVX static uint32_t peak_avx (const float *src, int nsamp)
+{
+    __m256i   v, a, m;
+    uint32_t  u, w;
+
+    a = _mm256_setzero_si256 ();
+    m = _mm256_set1_epi32 (0x7FFFFFFF);
+    for (; nsamp >= 8; nsamp -= 8)
+    {
+	v = _mm256_and_si256 (_mm256_loadu_si256 ((const __m256i *) src), m);
+	a = _mm256_max_epu32 (a, v);
+	src += 8;
+    }
+    v = _mm256_max_epu32 (a, _mm256_permute2x128_si256 (a, a, 1));
+    v = _mm256_max_epu32 (v, _mm256_shuffle_epi32 (v, 0x4E));
+    v = _mm256_max_epu32 (v, _mm256_shuffle_epi32 (v, 0xB1));
+    u = _mm256_extract_epi32 (v, 0);
+    _mm256_zeroupper ();
+    w = peak_sse (src, nsamp);
+    return (u > w) ? u : w;
+}
+
+
+// The 12-bit format is only used by block floating point, the
+// SSE versions are good enough.
+static const Sconvtab sconv_avx =
+{
+    "avx2",
+    enc16_avx, enc24_avx, encfl_avx, enc32le_avx, encflle_ref, enc20_avx, enchf_avx, enc12_sse, enci24_avx,
+    dec16_avx, dec24_avx, decfl_avx, dec32le_avx, decflle_ref, dec20_avx, dechf_avx, dec12_sse, deci24_avx,
+    peak_avx
+};
+
+
+#endif
+
+
+// ----------------------------------------------------------------------------
+
+
+#ifdef SCONV_ARM
+
+
+// NEON versions for 64-bit ARM, 4 samples per iteration. On this
+// architecture the float to int conversion saturates, in the same
+// way for the scalar and vector instructions.
+
+
+static const uint8_t tab_e16s [16] = {  1,  0, 255, 255,   5,  4, 255, 255,   9,  8, 255, 255,  13, 12, 255, 255 };
+static const uint8_t tab_e24p [16] = {  2,  1,   0,   6,   5,  4,  10,   9,   8, 14,  13,  12, 255, 255, 255, 255 };
+static const uint8_t tab_e24s [16] = {  2,  1,   0, 255,   6,  5,   4, 255,  10,  9,   8, 255,  14,  13,  12, 255 };
+static const uint8_t tab_d24p [16] = { 255, 2,   1,   0, 255,  5,   4,   3, 255,  8,   7,   6, 255,  11,  10,   9 };
+static const uint8_t tab_e20p [16] = {  4,  3,   2,   1,   0, 12,  11,  10,   9,  8, 255, 255, 255, 255, 255, 255 };
+static const uint8_t tab_d20l [16] = { 255, 2,   1,   0, 255,  4,   3,   2, 255,  7,   6,   5, 255,   9,   8,   7 };
+static const uint8_t tab_d20h [16] = { 255, 8,   7,   6, 255, 10,   9,   8, 255, 13,  12,  11, 255,  15,  14,  13 };
+static const uint8_t tab_e12p [16] = {  2,  1,   0,  10,   9,  8, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 };
+static const uint8_t tab_d12p [16] = { 255, 255, 1,   0, 255, 255,  2,   1, 255, 255,  4,   3, 255, 255,   5,   4 };
+static const int32_t tab_s20o [4]  = { 0, 4, 0, 4 };
+
+
+static inline int32x4_t neon_quant (const float *src, float g, int32x4_t lim)
+{
+    int32x4_t v;
+
+    v = vcvtq_s32_f32 (vaddq_f32 (vmulq_n_f32 (vld1q_f32 (src), g), vdupq_n_f32 (0.5f)));
+    v = vminq_s32 (v, lim);
+    return vmaxq_s32 (v, vnegq_s32 (lim));
+}
+
+
+static inline void neon_scatter (unsigned char *dst, int step, uint8x16_t v, int size)
+{
+    uint32_t  t [4];
+
+    vst1q_u8 ((uint8_t *) t, v);
+    memcpy (dst, t + 0, size); dst += step;
+    memcpy (dst, t + 1, size); dst += step;
+    memcpy (dst, t + 2, size); dst += step;
+    memcpy (dst, t + 3, size);
+}
+
+
+static inline uint8x16_t neon_gather (const unsigned char *src, int step, int size)
+{
+    uint32_t  t [4] = { 0, 0, 0, 0 };
+
+    memcpy (t + 0, src, size); src += step;
+    memcpy (t + 1, src, size); src += step;
+    memcpy (t + 2, src, size); src += step;
+    memcpy (t + 3, src, size);
+    return vld1q_u8 ((const uint8_t *) t);
+}
+
+
+static inline void neon_store (float *dst, int step, float32x4_t v)
+{
+    if (step == 1) vst1q_f32 (dst, v);
+    else
+    {
+	dst [0] = vgetq_lane_f32 (v, 0);
+	dst [step] = vgetq_lane_f32 (v, 1);
+	dst [2 * step] = vgetq_lane_f32 (v, 2);
+	dst [3 * step] = vgetq_lane_f32 (v, 3);
+    }
+}
+
+
+static void enc16_neon (unsigned char *dst, int dstep, const float *src, int sstep, int nsamp)
+{
+    int32x4_t  v, lim;
+    uint8x16_t m;
+
+    if (sstep == 1)
+    {
+	lim = vdupq_n_s32 (R16);
+	m = vld1q_u8 (tab_e16s);
+	for (; nsamp >= 4; nsamp -= 4)
+	{
+	    v = neon_quant (src, R16, lim);
+	    if (dstep == 1) vst1_u8 (dst, vrev16_u8 (vreinterpret_u8_s16 (vmovn_s32 (v))));
+	    else neon_scatter (dst, 2 * dstep, vqtbl1q_u8 (vreinterpretq_u8_s32 (v), m), 2);
+	    src += 4;
+	    dst += 8 * dstep;
+	}
+    }
+    enc16_ref (dst, dstep, src, sstep, nsamp);
+}
+
+
+static void enc24_neon (unsigned char *dst, int dstep, const float *src, int sstep, int nsamp)
+{
+    int32x4_t  v, lim;
+    uint8x16_t m, b;
+    uint32_t   t;
+
+    if (sstep == 1)
+    {
+	lim = vdupq_n_s32 (R24);
+	m = vld1q_u8 ((dstep == 1) ? tab_e24p : tab_e24s);
+	for (; nsamp >= 4; nsamp -= 4)
+	{
+	    v = neon_quant (src, R24, lim);
+	    b = vqtbl1q_u8 (vreinterpretq_u8_s32 (v), m);
+	    if (dstep == 1)
+	    {
+		vst1_u8 (dst, vget_low_u8 (b));
+		t = vgetq_lane_u32 (vreinterpretq_u32_u8 (b), 2);
+		memcpy (dst + 8, &t, 4);
+	    }
+	    else neon_scatter (dst, 3 * dstep, b, 3);
+	    src += 4;
+	    dst += 12 * dstep;
+	}
+    }
+    enc24_ref (dst, dstep, src, sstep, nsamp);
+}
+
+
+static void encfl_neon (unsigned char *dst, int dstep, const float *src, int sstep, int nsamp)
+{
+    uint8x16_t b;
+
+    if (sstep == 1)
+    {
+	for (; nsamp >= 4; nsamp -= 4)
+	{
+	    b = vrev32q_u8 (vld1q_u8 ((const uint8_t *) src));
+	    if (dstep == 1) vst1q_u8 (dst, b);
+	    else neon_scatter (dst, 4 * dstep, b, 4);
+	    src += 4;
+	    dst += 16 * dstep;
+	}
+    }
+    encfl_ref (dst, dstep, src, sstep, nsamp);
+}
+
+
+static void dec16_neon (float *dst, int dstep, const unsigned char *src, int sstep, int nsamp)
+{
+    float32x4_t  g;
+    int16x4_t    h;
+
+    g = vdupq_n_f32 (R16);
+    for (; nsamp >= 4; nsamp -= 4)
+    {
+	if (sstep == 1) h = vreinterpret_s16_u8 (vrev16_u8 (vld1_u8 (src)));
+	else h = vmovn_s32 (vshrq_n_s32 (vreinterpretq_s32_u8 (vrev32q_u8 (neon_gather (src, 2 * sstep, 2))), 16));
+	neon_store (dst, dstep, vdivq_f32 (vcvtq_f32_s32 (vmovl_s16 (h)), g));
+	src += 8 * sstep;
+	dst += 4 * dstep;
+    }
+    dec16_ref (dst, dstep, src, sstep, nsamp);
+}
+
+
+static void dec24_neon (float *dst, int dstep, const unsigned char *src, int sstep, int nsamp)
+{
+    float32x4_t  g;
+    uint8x16_t   b, m;
+    uint8_t      t [16];
+
+    g = vdupq_n_f32 (R24);
+    m = vld1q_u8 (tab_d24p);
+    for (; nsamp >= 4; nsamp -= 4)
+    {
+	if (sstep == 1)
+	{
+	    memcpy (t, src, 12);
+	    b = vqtbl1q_u8 (vld1q_u8 (t), m);
+	}
+	else b = vrev32q_u8 (neon_gather (src, 3 * sstep, 3));
+	neon_store (dst, dstep, vdivq_f32 (vcvtq_f32_s32 (vshrq_n_s32 (vreinterpretq_s32_u8 (b), 8)), g));
+	src += 12 * sstep;
+	dst += 4 * dstep;
+    }
+    dec24_ref (dst, dstep, src, sstep, nsamp);
+}
+
+
+static void decfl_neon (float *dst, int dstep, const unsigned char *src, int sstep, int nsamp)
+{
+    uint8x16_t b;
+
+    for (; nsamp >= 4; nsamp -= 4)
+    {
+	if (sstep == 1) b = vld1q_u8 (src);
+	else b = neon_gather (src, 4 * sstep, 4);
+	neon_store (dst, dstep, vreinterpretq_f32_u8 (vrev32q_u8 (b)));
+	src += 16 * sstep;
+	dst += 4 * dstep;
+    }
+    decfl_ref (dst, dstep, src, sstep, nsamp);
+}
+
+
+static void enc32le_neon (unsigned char *dst, int dstep, const float *src, int sstep, int nsamp)
+{
+    float32x4_t  f;
+    int32x4_t    v;
+
+    if (sstep == 1)
+    {
+	for (; nsamp >= 4; nsamp -= 4)
+	{
+	    f = vmulq_n_f32 (vld1q_f32 (src), S32);
+	    f = vmaxq_f32 (vminq_f32 (f, vdupq_n_f32 (M32)), vdupq_n_f32 (-M32));
+	    v = vcvtq_s32_f32 (f);
+	    if (dstep == 1) vst1q_s32 ((int32_t *) dst, v);
+	    else neon_scatter (dst, 4 * dstep, vreinterpretq_u8_s32 (v), 4);
+	    src += 4;
+	    dst += 16 * dstep;
+	}
+    }
+    enc32le_ref (dst, dstep, src, sstep, nsamp);
+}
+
+
+static void dec32le_neon (float *dst, int dstep, const unsigned char *src, int sstep, int nsamp)
+{
+    uint8x16_t b;
+
+    for (; nsamp >= 4; nsamp -= 4)
+    {
+	if (sstep == 1) b = vld1q_u8 (src);
+	else b = neon_gather (src, 4 * sstep, 4);
+	neon_store (dst, dstep, vmulq_n_f32 (vcvtq_f32_s32 (vreinterpretq_s32_u8 (b)), 1.0f / S32));
+	src += 16 * sstep;
+	dst += 4 * dstep;
+    }
+    dec32le_ref (dst, dstep, src, sstep, nsamp);
+}
+
+
+// Packed 20-bit, as the SSE versions.
+static inline uint8x16_t neon_pack20 (int32x4_t v)
+{
+    uint64x2_t  u, m;
+
+    u = vreinterpretq_u64_s32 (v);
+    m = vdupq_n_u64 (0xFFFFF);
+    u = vorrq_u64 (vshlq_n_u64 (vandq_u64 (u, m), 20), vandq_u64 (vshrq_n_u64 (u, 32), m));
+    return vqtbl1q_u8 (vreinterpretq_u8_u64 (u), vld1q_u8 (tab_e20p));
+}
+
+
+static inline float32x4_t neon_unpack20 (uint8x16_t b, const uint8_t *tab)
+{
+    int32x4_t v;
+
+    v = vreinterpretq_s32_u8 (vqtbl1q_u8 (b, vld1q_u8 (tab)));
+    v = vshrq_n_s32 (vshlq_s32 (v, vld1q_s32 (tab_s20o)), 12);
+    return vdivq_f32 (vcvtq_f32_s32 (v), vdupq_n_f32 (R20));
+}
+
+
+static void enc20_neon (unsigned char *dst, int dind, int dstep, const float *src, int sstep, int nsamp)
+{
+    int32x4_t   lim;
+    uint8x16_t  v0, v1, z;
+    uint32_t    t;
+
+    if ((sstep == 1) && (dstep == 1))
+    {
+	if ((dind & 1) && nsamp)
+	{
+	    enc20_ref (dst, dind++, 1, src++, 1, 1);
+	    nsamp--;
+	}
+	lim = vdupq_n_s32 (R20);
+	z = vdupq_n_u8 (0);
+	dst += 5 * (dind >> 1);
+	dind = 0;
+	for (; nsamp >= 8; nsamp -= 8)
+	{
+	    v0 = neon_pack20 (neon_quant (src, R20, lim));
+	    v1 = neon_pack20 (neon_quant (src + 4, R20, lim));
+	    vst1q_u8 (dst, vorrq_u8 (v0, vextq_u8 (z, v1, 6)));
+	    t = vgetq_lane_u32 (vreinterpretq_u32_u8 (vextq_u8 (v1, z, 6)), 0);
+	    memcpy (dst + 16, &t, 4);
+	    src += 8;
+	    dst += 20;
+	}
+    }
+    enc20_ref (dst, dind, dstep, src, sstep, nsamp);
+}
+
+
+static void dec20_neon (float *dst, int dstep, const unsigned char *src, int sind, int sstep, int nsamp)
+{
+    if (sstep == 1)
+    {
+	if ((sind & 1) && nsamp)
+	{
+	    dec20_ref (dst, 1, src, sind++, 1, 1);
+	    dst += dstep;
+	    nsamp--;
+	}
+	src += 5 * (sind >> 1);
+	sind = 0;
+	for (; nsamp >= 8; nsamp -= 8)
+	{
+	    neon_store (dst, dstep, neon_unpack20 (vld1q_u8 (src), tab_d20l));
+	    neon_store (dst + 4 * dstep, dstep, neon_unpack20 (vld1q_u8 (src + 4), tab_d20h));
+	    src += 20;
+	    dst += 8 * dstep;
+	}
+    }
+    dec20_ref (dst, dstep, src, sind, sstep, nsamp);
+}
+
+
+// The hardware half float conversions round and handle NaNs in the
+// same way as f2h () and h2f ().
+static void enchf_neon (unsigned char *dst, int dstep, const float *src, int sstep, int nsamp)
+{
+    uint16x4_t  h;
+
+    if (sstep == 1)
+    {
+	for (; nsamp >= 4; nsamp -= 4)
+	{
+	    h = vreinterpret_u16_f16 (vcvt_f16_f32 (vld1q_f32 (src)));
+	    if (dstep == 1) vst1_u8 (dst, vrev16_u8 (vreinterpret_u8_u16 (h)));
+	    else neon_scatter (dst, 2 * dstep, vqtbl1q_u8 (vreinterpretq_u8_u32 (vmovl_u16 (h)), vld1q_u8 (tab_e16s)), 2);
+	    src += 4;
+	    dst += 8 * dstep;
+	}
+    }
+    enchf_ref (dst, dstep, src, sstep, nsamp);
+}
+
+
+static void dechf_neon (float *dst, int dstep, const unsigned char *src, int sstep, int nsamp)
+{
+    uint16x4_t  h;
+
+    for (; nsamp >= 4; nsamp -= 4)
+    {
+	if (sstep == 1) h = vreinterpret_u16_u8 (vrev16_u8 (vld1_u8 (src)));
+	else h = vmovn_u32 (vshrq_n_u32 (vreinterpretq_u32_u8 (vrev32q_u8 (neon_gather (src, 2 * sstep, 2))), 16));
+	neon_store (dst, dstep, vcvt_f32_f16 (vreinterpret_f16_u16 (h)));
+	src += 8 * sstep;
+	dst += 4 * dstep;
+    }
+    dechf_ref (dst, dstep, src, sstep, nsamp);
+}
+
+
+// Packed 12-bit, as the SSE versions.
+static inline uint8x16_t neon_pack12 (int32x4_t v)
+{
+    uint64x2_t  u, m;
+
+    u = vreinterpretq_u64_s32 (v);
+    m = vdupq_n_u64 (0xFFF);
+    u = vorrq_u64 (vshlq_n_u64 (vandq_u64 (u, m), 12), vandq_u64 (vshrq_n_u64 (u, 32), m));
+    return vqtbl1q_u8 (vreinterpretq_u8_u64 (u), vld1q_u8 (tab_e12p));
+}
+
+
+static inline float32x4_t neon_unpack12 (uint8x16_t b)
+{
+    int32x4_t v;
+
+    v = vreinterpretq_s32_u8 (vqtbl1q_u8 (b, vld1q_u8 (tab_d12p)));
+    v = vshrq_n_s32 (vshlq_s32 (v, vld1q_s32 (tab_s20o)), 20);
+    return vdivq_f32 (vcvtq_f32_s32 (v), vdupq_n_f32 (R12));
+}
+
+
+static void enc12_neon (unsigned char *dst, int dind, int dstep, const float *src, int sstep, int nsamp)
+{
+    int32x4_t   lim;
+    uint8x16_t  v0, v1, z;
+    uint32_t    t;
+
+    if ((sstep == 1) && (dstep == 1))
+    {
+	if ((dind & 1) && nsamp)
+	{
+	    enc12_ref (dst, dind++, 1, src++, 1, 1);
+	    nsamp--;
+	}
+	lim = vdupq_n_s32 (R12);
+	z = vdupq_n_u8 (0);
+	dst += 3 * (dind >> 1);
+	dind = 0;
+	for (; nsamp >= 8; nsamp -= 8)
+	{
+	    v0 = neon_pack12 (neon_quant (src, R12, lim));
+	    v1 = neon_pack12 (neon_quant (src + 4, R12, lim));
+	    v0 = vorrq_u8 (v0, vextq_u8 (z, v1, 10));
+	    vst1_u8 (dst, vget_low_u8 (v0));
+	    t = vgetq_lane_u32 (vreinterpretq_u32_u8 (v0), 2);
+	    memcpy (dst + 8, &t, 4);
+	    src += 8;
+	    dst += 12;
+	}
+    }
+    enc12_ref (dst, dind, dstep, src, sstep, nsamp);
+}
+
+
+static void dec12_neon (float *dst, int dstep, const unsigned char *src, int sind, int sstep, int nsamp)
+{
+    uint8x16_t  b;
+    uint32_t    t;
+
+    if (sstep == 1)
+    {
+	if ((sind & 1) && nsamp)
+	{
+	    dec12_ref (dst, 1, src, sind++, 1, 1);
+	    dst += dstep;
+	    nsamp--;
+	}
+	src += 3 * (sind >> 1);
+	sind = 0;
+	for (; nsamp >= 8; nsamp -= 8)
+	{
+	    memcpy (&t, src + 8, 4);
+	    b = vcombine_u8 (vld1_u8 (src), vreinterpret_u8_u32 (vdup_n_u32 (t)));
+	    neon_store (dst, dstep, neon_unpack12 (b));
+	    neon_store (dst + 4 * dstep, dstep, neon_unpack12 (vextq_u8 (b, b, 6)));
+	    src += 12;
+	    dst += 8 * dstep;
+	}
+    }
+    dec12_ref (dst, dstep, src, sind, sstep, nsamp);
+}
+
+
+static void enci24_neon (int32_t *dst, const float *src, int nsamp)
+{
+    int32x4_t  lim;
+
+    lim = vdupq_n_s32 (R24);
+    for (; nsamp >= 4; nsamp -= 4)
+    {
+	vst1q_s32 (dst, neon_quant (src, R24, lim));
+	src += 4;
+	dst += 4;
+    }
+    enci24_ref (dst, src, nsamp);
+}
+
+
+static void deci24_neon (float *dst, int dstep, const int32_t *src, int nsamp)
+{
+    float32x4_t  g;
+
+    g = vdupq_n_f32 (R24);
+    for (; nsamp >= 4; nsamp -= 4)
+    {
+	neon_store (dst, dstep, vdivq_f32 (vcvtq_f32_s32 (vld1q_s32 (src)), g));
+	src += 4;
+	dst += 4 * dstep;
+    }
+    deci24_ref (dst, dstep, src, nsamp);
+}
+
+
+static uint32_t peak_neon (const float *src, int nsamp)
+{
+    uint32x4_t  a, m;
+    uint32_t    u, w;
+
+    a = vdupq_n_u32 (0);
+    m = vdupq_n_u32 (0x7FFFFFFF);
+    for (; nsamp >= 4; nsamp -= 4)
+    {
+	a = vmaxq_u32 (a, vandq_u32 (vld1q_u32 ((const uint32_t *) src), m));
+	src += 4;
+    }
+    u = vmaxvq_u32 (a);
+    w = peak_ref (src, nsamp);
+    return (u > w) ? u : w;
+}
+
+
+static const Sconvtab sconv_neon =
+{
+    "neon",
+    enc16_neon, enc24_neon, encfl_neon, enc32le_neon, encflle_ref, enc20_neon, enchf_neon, enc12_neon, enci24_neon,
+    dec16_neon, dec24_neon, decfl_neon, dec32le_neon, decflle_ref, dec20_neon, dechf_neon, dec12_neon, deci24_neon,
+    peak_neon
+};
+
+
+#endif
+
+
+// ----------------------------------------------------------------------------
+
+
+const Sconvtab *sconv = &sconv_ref;
+
+
+int sconv_select (int type)
+{
+    switch (type)
+    {
+    case SCONV_SCALAR:
+	sconv = &sconv_ref;
+	return type;
+#ifdef SCONV_X86
+    case SCONV_SSE41:
+	if (! __builtin_cpu_supports ("sse4.1")) break;
+	sconv = &sconv_sse;
+	return type;
+    case SCONV_AVX2:
+	if (! __builtin_cpu_supports ("avx2")) break;
+	sconv = &sconv_avx;
+	return type;
+#endif
+#ifdef SCONV_ARM
+    case SCONV_NEON:
+	sconv = &sconv_neon;
+	return type;
+#endif
+    }
+    return -1;
+}
+
+
+int sconv_init (void)
+{
+#ifdef SCONV_X86
+    __builtin_cpu_init ();
+    if (sconv_select (SCONV_AVX2) >= 0) return SCONV_AVX2;
+    if (sconv_select (SCONV_SSE41) >= 0) return SCONV_SSE41;
+#endif
+#ifdef SCONV_ARM
+    return sconv_select (SCONV_NEON);
+#endif
+    return sconv_select (SCONV_SCALAR);
+}
@@ -0,0 +1,95 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2013-2016 Fons Adriaensen <fons@linuxaudio.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+#ifndef __SAMPCONV_H
+#define __SAMPCONV_H
+
+
+#include <stdint.h>
+
+
+// Sample conversion kernels used by the Netdata class.
+//
+// Encoders convert float samples to the network sample formats,
+// decoders do the reverse. Steps are in samples, not bytes. The
+// scalar versions are the reference, all vector versions must
+// produce bit-identical results.
+
+
+typedef void (*Sconv_enc) (unsigned char *dst, int dstep, const float *src, int sstep, int nsamp);
+typedef void (*Sconv_dec) (float *dst, int dstep, const unsigned char *src, int sstep, int nsamp);
+
+// Packed 12 and 20-bit samples are not byte aligned, so these take the
+// start of the packed data and the index of the first sample instead.
+typedef void (*Sconv_encp) (unsigned char *dst, int dind, int dstep, const float *src, int sstep, int nsamp);
+typedef void (*Sconv_decp) (float *dst, int dstep, const unsigned char *src, int sind, int sstep, int nsamp);
+
+// Same values as the 24-bit format, as host integers. Only used on
+// contiguous samples, by the lossless coder.
+typedef void (*Sconv_enci) (int32_t *dst, const float *src, int nsamp);
+typedef void (*Sconv_deci) (float *dst, int dstep, const int32_t *src, int nsamp);
+
+// Returns the largest absolute value of 'nsamp' contiguous samples,
+// as the bits of a float. NaNs compare larger than infinity.
+typedef uint32_t (*Sconv_peak) (const float *src, int nsamp);
+
+
+class Sconvtab
+{
+public:
+
+    const char  *name;
+    Sconv_enc    enc16;  // 16-bit big-endian integer.
+    Sconv_enc    enc24;  // 24-bit big-endian integer.
+    Sconv_enc    encfl;  // 32-bit big-endian float.
+    Sconv_enc    enc32le;  // 32-bit little-endian integer.
+    Sconv_enc    encflle;  // 32-bit little-endian float.
+    Sconv_encp   enc20;  // Packed 20-bit big-endian integer.
+    Sconv_enc    enchf;  // 16-bit big-endian IEEE half float.
+    Sconv_encp   enc12;  // Packed 12-bit big-endian integer.
+    Sconv_enci   enci24; // 24-bit host integer.
+    Sconv_dec    dec16;
+    Sconv_dec    dec24;
+    Sconv_dec    decfl;
+    Sconv_dec    dec32le;
+    Sconv_dec    decflle;
+    Sconv_decp   dec20;
+    Sconv_dec    dechf;
+    Sconv_decp   dec12;
+    Sconv_deci   deci24;
+    Sconv_peak   peak;
+};
+
+
+enum { SCONV_SCALAR, SCONV_SSE41, SCONV_AVX2, SCONV_NEON };
+
+
+// Currently selected kernels, initially the scalar ones.
+extern const Sconvtab *sconv;
+
+// Select the best kernels supported by the CPU, returns the
+// selected SCONV_xxx type. To be called once at startup.
+extern int sconv_init (void);
+
+// Select a specific kernel type, returns -1 if not supported.
+extern int sconv_select (int type);
+
+
+#endif
@@ -0,0 +1,223 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2013-2016 Fons Adriaensen <fons@linuxaudio.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+#include "shmring.h"
+
+
+#define MAGIC 0x7a6e6a72  // "znjr"
+#define HSIZE 4096        // Header size, the slots follow.
+
+
+static inline uint32_t load_acquire (const uint32_t *p)
+{
+    return __atomic_load_n (p, __ATOMIC_ACQUIRE);
+}
+
+
+static inline void store_release (uint32_t *p, uint32_t v)
+{
+    __atomic_store_n (p, v, __ATOMIC_RELEASE);
+}
+
+
+// The futex is in shared memory, so the private
+// futex operations can't be used.
+//
+static void futex_wait (uint32_t *p, uint32_t v)
+{
+#ifdef __linux__
+    struct timespec  T;
+
+    // Time out, so shutdown () can't be missed.
+    T.tv_sec = 0;
+    T.tv_nsec = 100000000;
+    syscall (SYS_futex, p, FUTEX_WAIT, v, &T, 0, 0);
+#else
+    usleep (1000);
+#endif
+}
+
+
+static void futex_wake (uint32_t *p)
+{
+#ifdef __linux__
+    syscall (SYS_futex, p, FUTEX_WAKE, 1, 0, 0, 0);
+#endif
+}
+
+
+Shmring::Shmring (void) :
+    _head (0),
+    _data (0),
+    _size (0),
+    _shut (false)
+{
+}
+
+
+Shmring::~Shmring (void)
+{
+    close ();
+}
+
+
+int Shmring::open (const char *name)
+{
+    int       fd;
+    uint32_t  m;
+    char      s [256];
+    void      *p;
+
+    close ();
+    // POSIX requires a single leading '/'.
+    snprintf (s, 256, "/%s", name);
+    fd = shm_open (s, O_RDWR | O_CREAT, 0600);
+    if (fd < 0) return -1;
+    // A new object is zero-filled, which is a valid empty ring.
+    _size = HSIZE + NSLOT * SLOTSIZE;
+    if (ftruncate (fd, _size))
+    {
+	::close (fd);
+	return -1;
+    }
+    p = mmap (0, _size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close (fd);
+    if (p == MAP_FAILED) return -1;
+    _head = (Header *) p;
+    _data = (unsigned char *) p + HSIZE;
+
+    // Check the ring was created with the same parameters.
+    m = 0;
+    if (   ! __atomic_compare_exchange_n (&_head->_magic, &m, MAGIC, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+        && (m != MAGIC))
+    {
+	close ();
+	return -1;
+    }
+    if (_head->_nslot == 0)
+    {
+	_head->_nslot = NSLOT;
+	_head->_slotsize = SLOTSIZE;
+    }
+    if ((_head->_nslot != NSLOT) || (_head->_slotsize != SLOTSIZE))
+    {
+	close ();
+	return -1;
+    }
+    _shut = false;
+    return 0;
+}
+
+
+void Shmring::close (void)
+{
+    if (_head) munmap (_head, _size);
+    _head = 0;
+    _data = 0;
+}
+
+
+int Shmring::write (const Netdata *D)
+{
+    uint32_t        n, k;
+    unsigned char  *p;
+
+    n = _head->_nwr;
+    if (n - load_acquire (&_head->_nrd) >= NSLOT) return -1;
+    p = slot (n);
+    k = D->dlen ();
+    if (k > MAXDATA) k = MAXDATA;
+    memcpy (p, &k, sizeof (uint32_t));
+    memcpy (p + 16, D->data (), k);
+    store_release (&_head->_nwr, n + 1);
+    // Wake the reader only if it waits. This pairs
+    // with the fence in wait ().
+    __atomic_thread_fence (__ATOMIC_SEQ_CST);
+    if (__atomic_load_n (&_head->_wait, __ATOMIC_RELAXED)) futex_wake (&_head->_nwr);
+    return 0;
+}
+
+
+void Shmring::attach (void)
+{
+    store_release (&_head->_nrd, load_acquire (&_head->_nwr));
+    _shut = false;
+}
+
+
+int Shmring::read (Netdata **P, int n)
+{
+    uint32_t        i, j, k;
+    unsigned char  *p;
+    int             m;
+
+    i = _head->_nrd;
+    j = load_acquire (&_head->_nwr);
+    // The writer is not synchronised with attach (), if it
+    // appears to be too far ahead only the last slots are valid.
+    if (j - i > NSLOT) i = j - NSLOT;
+    for (m = 0; (m < n) && (i != j); m++, i++)
+    {
+	p = slot (i);
+	memcpy (&k, p, sizeof (uint32_t));
+	if (k > (uint32_t) P [m]->size ()) k = P [m]->size ();
+	memcpy (P [m]->data (), p + 16, k);
+	// Empty packets would leave the previous
+	// data in place, so make them invalid.
+	if (k == 0) P [m]->data () [0] = 0;
+    }
+    store_release (&_head->_nrd, i);
+    return m;
+}
+
+
+int Shmring::wait (void)
+{
+    uint32_t  n;
+
+    while (! _shut)
+    {
+	n = load_acquire (&_head->_nwr);
+	if (n != _head->_nrd) return 0;
+	__atomic_store_n (&_head->_wait, 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence (__ATOMIC_SEQ_CST);
+	if (__atomic_load_n (&_head->_nwr, __ATOMIC_RELAXED) == n) futex_wait (&_head->_nwr, n);
+	__atomic_store_n (&_head->_wait, 0, __ATOMIC_RELAXED);
+    }
+    return -1;
+}
+
+
+void Shmring::shutdown (void)
+{
+    _shut = true;
+    if (_head) futex_wake (&_head->_nwr);
+}
@@ -0,0 +1,91 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2013-2016 Fons Adriaensen <fons@linuxaudio.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+#ifndef __SHMRING_H
+#define __SHMRING_H
+
+
+#include <stdint.h>
+#include "netdata.h"
+
+
+// Packet ring in POSIX shared memory, for a sender and a receiver on
+// the same host. The ring is created by whichever side opens it first,
+// and is not removed when closed. It has a single writer and a single
+// reader. The writer never blocks, packets that don't fit are lost as
+// they would be on the network. The reader can wait for packets, on
+// Linux using a futex which the writer wakes only if required.
+
+
+class Shmring
+{
+public:
+
+    Shmring (void);
+    ~Shmring (void);
+
+    // Number of slots, and the largest packet.
+    enum { NSLOT = 64, SLOTSIZE = 0x10000, MAXDATA = SLOTSIZE - 16 };
+
+    int  open (const char *name);
+    void close (void);
+
+    // Add a packet, returns -1 if the ring is full.
+    int  write (const Netdata *D);
+
+    // Discard all packets waiting, and enable wait ().
+    void attach (void);
+
+    // Copy waiting packets into P [], at most n, without blocking.
+    // Returns the number read.
+    int  read (Netdata **P, int n);
+
+    // Wait until there are packets to read. Returns -1 if
+    // shutdown () was called.
+    int  wait (void);
+
+    // Make wait () return, in this process.
+    void shutdown (void);
+
+private:
+
+    // Shared header, followed by the slots.
+    class Header
+    {
+    public:
+
+	uint32_t  _magic;
+	uint32_t  _nslot;
+	uint32_t  _slotsize;
+	uint32_t  _nwr;      // Also the futex.
+	uint32_t  _nrd;
+	uint32_t  _wait;     // Reader is waiting.
+    };
+
+    unsigned char *slot (uint32_t i) const { return _data + SLOTSIZE * (i & (NSLOT - 1)); }
+
+    Header         *_head;
+    unsigned char  *_data;
+    size_t          _size;
+    volatile bool   _shut;
+};
+
+
+#endif
@@ -0,0 +1,473 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2013-2016 Fons Adriaensen <fons@linuxaudio.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+#include <stdlib.h>
+#include <string.h>
+#include "uring.h"
+
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#endif
+
+
+// Multishot receive and provided buffer rings require Linux 6.0
+// headers. With older ones the stubs at the end are used.
+//
+#ifdef IORING_RECV_MULTISHOT
+
+
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+
+
+// Key of cancel requests.
+#define CANCEL_KEY (~(uint64_t) 0)
+
+
+static inline uint32_t load_acquire (const uint32_t *p)
+{
+    return __atomic_load_n (p, __ATOMIC_ACQUIRE);
+}
+
+
+static inline void store_release (uint32_t *p, uint32_t v)
+{
+    __atomic_store_n (p, v, __ATOMIC_RELEASE);
+}
+
+
+static int sys_setup (unsigned entries, struct io_uring_params *P)
+{
+    return syscall (__NR_io_uring_setup, entries, P);
+}
+
+
+static int sys_enter (int fd, unsigned nsubm, unsigned wait, unsigned flags)
+{
+    return syscall (__NR_io_uring_enter, fd, nsubm, wait, flags, 0, 0);
+}
+
+
+static int sys_register (int fd, unsigned opcode, void *arg, unsigned narg)
+{
+    return syscall (__NR_io_uring_register, fd, opcode, arg, narg);
+}
+
+
+Uring::Uring (void) :
+    _fd (-1),
+    _sqes (0),
+    _bring (0),
+    _baddr (0)
+{
+}
+
+
+Uring::~Uring (void)
+{
+    close ();
+}
+
+
+bool Uring::available (void)
+{
+    return true;
+}
+
+
+int Uring::open (int nentries)
+{
+    struct io_uring_params  P;
+    unsigned char          *p;
+
+    close ();
+    memset (&P, 0, sizeof (P));
+    _fd = sys_setup (nentries, &P);
+    if (_fd < 0) return -1;
+
+    _sq._size = P.sq_off.array + P.sq_entries * sizeof (uint32_t);
+    _cq._size = P.cq_off.cqes + P.cq_entries * sizeof (struct io_uring_cqe);
+    if (P.features & IORING_FEAT_SINGLE_MMAP)
+    {
+	// Both rings are in a single mapping.
+	if (_cq._size > _sq._size) _sq._size = _cq._size;
+	_cq._size = 0;
+    }
+    _sq._mmap = mmap (0, _sq._size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+    if (_sq._mmap == MAP_FAILED)
+    {
+	_sq._mmap = 0;
+	close ();
+	return -1;
+    }
+    _cq._mmap = _sq._mmap;
+    if (_cq._size)
+    {
+	_cq._mmap = mmap (0, _cq._size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING);
+	if (_cq._mmap == MAP_FAILED)
+	{
+	    _cq._mmap = 0;
+	    close ();
+	    return -1;
+	}
+    }
+    _sqsize = P.sq_entries * sizeof (struct io_uring_sqe);
+    _sqes = mmap (0, _sqsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+    if (_sqes == MAP_FAILED)
+    {
+	_sqes = 0;
+	close ();
+	return -1;
+    }
+
+    p = (unsigned char *) _sq._mmap;
+    _sq._head  = (uint32_t *)(p + P.sq_off.head);
+    _sq._tail  = (uint32_t *)(p + P.sq_off.tail);
+    _sq._array = (uint32_t *)(p + P.sq_off.array);
+    _sq._mask  = *(uint32_t *)(p + P.sq_off.ring_mask);
+    p = (unsigned char *) _cq._mmap;
+    _cq._head  = (uint32_t *)(p + P.cq_off.head);
+    _cq._tail  = (uint32_t *)(p + P.cq_off.tail);
+    _cq._data  = p + P.cq_off.cqes;
+    _cq._mask  = *(uint32_t *)(p + P.cq_off.ring_mask);
+    _nprep = 0;
+    return 0;
+}
+
+
+void Uring::close (void)
+{
+    if (_fd < 0) return;
+    unreg_bufring ();
+    if (_sqes) munmap (_sqes, _sqsize);
+    if (_cq._size && _cq._mmap) munmap (_cq._mmap, _cq._size);
+    if (_sq._mmap) munmap (_sq._mmap, _sq._size);
+    ::close (_fd);
+    _fd = -1;
+    _sqes = 0;
+    _sq._mmap = 0;
+    _cq._mmap = 0;
+}
+
+
+int Uring::reg_buffers (unsigned char **A, const int *L, int n)
+{
+    int            i, rv;
+    struct iovec  *V;
+
+    unreg_buffers ();
+    V = new struct iovec [n];
+    for (i = 0; i < n; i++)
+    {
+	V [i].iov_base = A [i];
+	V [i].iov_len = L [i];
+    }
+    rv = sys_register (_fd, IORING_REGISTER_BUFFERS, V, n);
+    delete[] V;
+    return (rv < 0) ? -1 : 0;
+}
+
+
+void Uring::unreg_buffers (void)
+{
+    sys_register (_fd, IORING_UNREGISTER_BUFFERS, 0, 0);
+}
+
+
+int Uring::reg_bufring (unsigned char **A, int n, int size)
+{
+    int                      i;
+    struct io_uring_buf_reg  R;
+
+    unreg_bufring ();
+    if ((n < 1) || (n > 0x8000) || (n & (n - 1))) return -1;
+    _brsize = n * sizeof (struct io_uring_buf);
+    _bring = mmap (0, _brsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (_bring == MAP_FAILED)
+    {
+	_bring = 0;
+	return -1;
+    }
+    memset (&R, 0, sizeof (R));
+    R.ring_addr = (uint64_t)(uintptr_t) _bring;
+    R.ring_entries = n;
+    R.bgid = 0;
+    if (sys_register (_fd, IORING_REGISTER_PBUF_RING, &R, 1) < 0)
+    {
+	munmap (_bring, _brsize);
+	_bring = 0;
+	return -1;
+    }
+    _baddr = new unsigned char * [n];
+    memcpy (_baddr, A, n * sizeof (unsigned char *));
+    _bsize = size;
+    _bmask = n - 1;
+    _btail = 0;
+    for (i = 0; i < n; i++) put_buffer (i);
+    return 0;
+}
+
+
+void Uring::unreg_bufring (void)
+{
+    struct io_uring_buf_reg  R;
+
+    if (! _bring) return;
+    memset (&R, 0, sizeof (R));
+    R.bgid = 0;
+    sys_register (_fd, IORING_UNREGISTER_PBUF_RING, &R, 1);
+    munmap (_bring, _brsize);
+    delete[] _baddr;
+    _bring = 0;
+    _baddr = 0;
+}
+
+
+void Uring::put_buffer (int bid)
+{
+    struct io_uring_buf  *R, *B;
+
+    // The ring's tail is the 'resv' field of the first entry. The
+    // header's io_uring_buf_ring has a different layout in C++.
+    R = (struct io_uring_buf *) _bring;
+    B = R + (_btail & _bmask);
+    B->addr = (uint64_t)(uintptr_t) _baddr [bid];
+    B->len = _bsize;
+    B->bid = bid;
+    __atomic_store_n (&R->resv, ++_btail, __ATOMIC_RELEASE);
+}
+
+
+void *Uring::get_sqe (void)
+{
+    uint32_t              t, i;
+    struct io_uring_sqe  *S;
+
+    t = *_sq._tail + _nprep;
+    if (t - load_acquire (_sq._head) > _sq._mask) return 0;
+    i = t & _sq._mask;
+    S = (struct io_uring_sqe *) _sqes + i;
+    memset (S, 0, sizeof (*S));
+    _sq._array [i] = i;
+    _nprep++;
+    return S;
+}
+
+
+int Uring::send_fixed (int fd, const unsigned char *data, int size, int index, uint64_t key)
+{
+    struct io_uring_sqe  *S;
+
+    // A write to a connected socket is a send ().
+    if ((S = (struct io_uring_sqe *) get_sqe ()) == 0) return -1;
+    S->opcode = IORING_OP_WRITE_FIXED;
+    S->fd = fd;
+    S->addr = (uint64_t)(uintptr_t) data;
+    S->len = size;
+    S->buf_index = index;
+    S->user_data = key;
+    return 0;
+}
+
+
+int Uring::recv_multi (int fd, uint64_t key)
+{
+    struct io_uring_sqe  *S;
+
+    if ((S = (struct io_uring_sqe *) get_sqe ()) == 0) return -1;
+    S->opcode = IORING_OP_RECV;
+    S->fd = fd;
+    S->ioprio = IORING_RECV_MULTISHOT;
+    S->flags = IOSQE_BUFFER_SELECT;
+    S->buf_group = 0;
+    S->user_data = key;
+    return 0;
+}
+
+
+int Uring::poll (int fd, int events, uint64_t key)
+{
+    struct io_uring_sqe  *S;
+
+    if ((S = (struct io_uring_sqe *) get_sqe ()) == 0) return -1;
+    S->opcode = IORING_OP_POLL_ADD;
+    S->fd = fd;
+    S->poll32_events = events;
+    S->user_data = key;
+    return 0;
+}
+
+
+int Uring::submit (int wait)
+{
+    int  rv;
+
+    store_release (_sq._tail, *_sq._tail + _nprep);
+    _nprep = 0;
+    do rv = sys_enter (_fd, *_sq._tail - load_acquire (_sq._head), wait, IORING_ENTER_GETEVENTS);
+    while ((rv < 0) && (errno == EINTR) && wait);
+    if ((rv < 0) && (errno != EINTR)) return -1;
+    return 0;
+}
+
+
+bool Uring::get_cqe (Cqe *C)
+{
+    uint32_t              h;
+    struct io_uring_cqe  *E;
+
+    h = *_cq._head;
+    if (h == load_acquire (_cq._tail)) return false;
+    E = (struct io_uring_cqe *) _cq._data + (h & _cq._mask);
+    C->_key = E->user_data;
+    C->_res = E->res;
+    C->_bid = (E->flags & IORING_CQE_F_BUFFER) ? (E->flags >> IORING_CQE_BUFFER_SHIFT) : -1;
+    C->_more = (E->flags & IORING_CQE_F_MORE) != 0;
+    store_release (_cq._head, h + 1);
+    return true;
+}
+
+
+void Uring::cancel (uint64_t key)
+{
+    struct io_uring_sqe  *S;
+    Cqe                   C;
+    bool                  done;
+    int                   res;
+
+    if ((S = (struct io_uring_sqe *) get_sqe ()) == 0) return;
+    S->opcode = IORING_OP_ASYNC_CANCEL;
+    S->addr = key;
+    S->user_data = CANCEL_KEY;
+    done = false;
+    res = 1;
+    while (true)
+    {
+	if (submit (1)) return;
+	while (get_cqe (&C))
+	{
+	    if (C._key == CANCEL_KEY) res = C._res;
+	    else if ((C._key == key) && ! C._more) done = true;
+	}
+	// If the request was found, wait for its final completion.
+	if (res == 1) continue;
+	if (done || ((res != 0) && (res != -EALREADY))) return;
+    }
+}
+
+
+#else
+
+
+Uring::Uring (void) :
+    _fd (-1)
+{
+}
+
+
+Uring::~Uring (void)
+{
+}
+
+
+bool Uring::available (void)
+{
+    return false;
+}
+
+
+int Uring::open (int nentries)
+{
+    return -1;
+}
+
+
+void Uring::close (void)
+{
+}
+
+
+int Uring::reg_buffers (unsigned char **A, const int *L, int n)
+{
+    return -1;
+}
+
+
+void Uring::unreg_buffers (void)
+{
+}
+
+
+int Uring::reg_bufring (unsigned char **A, int n, int size)
+{
+    return -1;
+}
+
+
+void Uring::unreg_bufring (void)
+{
+}
+
+
+void Uring::put_buffer (int bid)
+{
+}
+
+
+int Uring::send_fixed (int fd, const unsigned char *data, int size, int index, uint64_t key)
+{
+    return -1;
+}
+
+
+int Uring::recv_multi (int fd, uint64_t key)
+{
+    return -1;
+}
+
+
+int Uring::poll (int fd, int events, uint64_t key)
+{
+    return -1;
+}
+
+
+int Uring::submit (int wait)
+{
+    return -1;
+}
+
+
+bool Uring::get_cqe (Cqe *C)
+{
+    return false;
+}
+
+
+void Uring::cancel (uint64_t key)
+{
+}
+
+
+#endif
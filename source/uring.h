@@ -0,0 +1,125 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2013-2016 Fons Adriaensen <fons@linuxaudio.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+#ifndef __URING_H
+#define __URING_H
+
+
+#include <stdint.h>
+#include <sys/types.h>
+
+
+// A minimal io_uring, using the system calls directly. Requests
+// are identified by a 64-bit key chosen by the user, so a single
+// ring can serve any number of sockets.
+//
+// Sending uses registered buffers, receiving a multishot receive
+// that takes its buffers from a ring of provided buffers. Requests
+// are prepared first and then submitted with a single system call,
+// which can also wait for completions.
+//
+// Only available on Linux, elsewhere open () always fails.
+
+
+class Uring
+{
+public:
+
+    Uring (void);
+    ~Uring (void);
+
+    // Completion of a request.
+    class Cqe
+    {
+    public:
+
+	uint64_t  _key;
+	int       _res;   // Result, or minus the error number.
+	int       _bid;   // Provided buffer, or -1.
+	bool      _more;  // A multishot request remains active.
+    };
+
+    static bool available (void);
+
+    int  open (int nentries);
+    void close (void);
+
+    // Register buffers for send_fixed (), replacing any previous
+    // ones. The index of a buffer is its position in A.
+    int  reg_buffers (unsigned char **A, const int *L, int n);
+    void unreg_buffers (void);
+
+    // Register a ring of n provided buffers of the given size, for
+    // recv_multi (). The number must be a power of 2. All buffers
+    // are available initially, and must be returned by put_buffer ()
+    // after being used.
+    int  reg_bufring (unsigned char **A, int n, int size);
+    void unreg_bufring (void);
+    void put_buffer (int bid);
+
+    // Prepare requests. These return -1 if the submission queue is full.
+    int  send_fixed (int fd, const unsigned char *data, int size, int index, uint64_t key);
+    int  recv_multi (int fd, uint64_t key);
+    int  poll (int fd, int events, uint64_t key);
+
+    // Submit all prepared requests, and wait for at least 'wait'
+    // completions. Returns -1 on error.
+    int  submit (int wait);
+
+    // Get the next completion, returns false if there is none.
+    bool get_cqe (Cqe *C);
+
+    // Cancel request 'key', and wait until it has completed.
+    // All other completions until then are discarded.
+    void cancel (uint64_t key);
+
+private:
+
+    class Ring
+    {
+    public:
+
+	uint32_t  *_head;
+	uint32_t  *_tail;
+	uint32_t  *_array;
+	void      *_data;
+	uint32_t   _mask;
+	void      *_mmap;
+	size_t     _size;
+    };
+
+    void *get_sqe (void);
+
+    int            _fd;
+    Ring           _sq;
+    Ring           _cq;
+    void          *_sqes;
+    size_t         _sqsize;
+    uint32_t       _nprep;   // Prepared but not submitted.
+    void          *_bring;   // Provided buffer ring.
+    size_t         _brsize;
+    unsigned char **_baddr;
+    int            _bsize;
+    uint16_t       _btail;
+    uint32_t       _bmask;
+};
+
+
+#endif
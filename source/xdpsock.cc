@@ -0,0 +1,632 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2013-2016 Fons Adriaensen <fons@linuxaudio.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "xdpsock.h"
+
+
+#ifdef __linux__
+
+
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/if_xdp.h>
+#include <linux/bpf.h>
+
+#ifndef AF_XDP
+#define AF_XDP 44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP 283
+#endif
+
+
+static inline uint32_t load_acquire (const uint32_t *p)
+{
+    return __atomic_load_n (p, __ATOMIC_ACQUIRE);
+}
+
+
+static inline void store_release (uint32_t *p, uint32_t v)
+{
+    __atomic_store_n (p, v, __ATOMIC_RELEASE);
+}
+
+
+static int sys_bpf (int cmd, union bpf_attr *attr)
+{
+    return syscall (__NR_bpf, cmd, attr, sizeof (*attr));
+}
+
+
+// Internet checksum of the IPv4 header.
+//
+static uint16_t ipsum (const unsigned char *p, int n)
+{
+    uint32_t  s;
+    int       i;
+
+    for (i = 0, s = 0; i < n; i += 2) s += (p [i] << 8) | p [i + 1];
+    while (s >> 16) s = (s & 0xFFFF) + (s >> 16);
+    return ~s & 0xFFFF;
+}
+
+
+// Find the next hop to 'addr' on 'iface', using the routing table.
+// Addresses are in network byte order.
+//
+static uint32_t nexthop (const char *iface, uint32_t addr)
+{
+    FILE      *F;
+    char       line [256], name [32];
+    unsigned   dest, gway, flags, mask, best;
+    uint32_t   hop;
+
+    hop = addr;
+    best = 0;
+    if ((F = fopen ("/proc/net/route", "r")) == 0) return hop;
+    while (fgets (line, 256, F))
+    {
+	if (sscanf (line, "%31s %x %x %x %*d %*d %*d %x", name, &dest, &gway, &flags, &mask) != 5) continue;
+	if (strcmp (name, iface) || ((addr & mask) != dest)) continue;
+	if (ntohl (mask) < best) continue;
+	best = ntohl (mask);
+	// RTF_GATEWAY
+	hop = (flags & 2) ? gway : addr;
+    }
+    fclose (F);
+    return hop;
+}
+
+
+// Look up the MAC address of 'addr' on 'iface' in the ARP table.
+//
+static int arplookup (const char *iface, uint32_t addr, unsigned char *mac)
+{
+    FILE      *F;
+    char       line [256], ipad [64], hwad [64], name [32];
+    unsigned   flags, m [6];
+    int        i, rv;
+    in_addr    A;
+
+    A.s_addr = addr;
+    rv = -1;
+    if ((F = fopen ("/proc/net/arp", "r")) == 0) return rv;
+    while (fgets (line, 256, F))
+    {
+	if (sscanf (line, "%63s %*x %x %63s %*s %31s", ipad, &flags, hwad, name) != 4) continue;
+	// ATF_COM
+	if (strcmp (name, iface) || strcmp (ipad, inet_ntoa (A)) || !(flags & 2)) continue;
+	if (sscanf (hwad, "%x:%x:%x:%x:%x:%x", m, m + 1, m + 2, m + 3, m + 4, m + 5) != 6) continue;
+	for (i = 0; i < 6; i++) mac [i] = m [i];
+	rv = 0;
+    }
+    fclose (F);
+    return rv;
+}
+
+
+Xdpsock::Xdpsock (void) :
+    _fd (-1),
+    _mapfd (-1),
+    _progfd (-1),
+    _linkfd (-1),
+    _zcopy (false),
+    _umem (0),
+    _nfree (0),
+    _ipid (0)
+{
+    memset (&_fill, 0, sizeof (Ring));
+    memset (&_comp, 0, sizeof (Ring));
+    memset (&_rx, 0, sizeof (Ring));
+    memset (&_tx, 0, sizeof (Ring));
+}
+
+
+Xdpsock::~Xdpsock (void)
+{
+    close ();
+}
+
+
+bool Xdpsock::available (void)
+{
+    int fd;
+
+    fd = socket (AF_XDP, SOCK_RAW, 0);
+    if (fd < 0) return false;
+    ::close (fd);
+    return true;
+}
+
+
+void Xdpsock::close (void)
+{
+    // Closing the link detaches the XDP program.
+    if (_linkfd >= 0) ::close (_linkfd);
+    if (_progfd >= 0) ::close (_progfd);
+    if (_mapfd >= 0) ::close (_mapfd);
+    if (_fill._mmap) munmap (_fill._mmap, _fill._size);
+    if (_comp._mmap) munmap (_comp._mmap, _comp._size);
+    if (_rx._mmap) munmap (_rx._mmap, _rx._size);
+    if (_tx._mmap) munmap (_tx._mmap, _tx._size);
+    if (_fd >= 0) ::close (_fd);
+    if (_umem) munmap (_umem, NFRAME * FSIZE);
+    memset (&_fill, 0, sizeof (Ring));
+    memset (&_comp, 0, sizeof (Ring));
+    memset (&_rx, 0, sizeof (Ring));
+    memset (&_tx, 0, sizeof (Ring));
+    _fd = _mapfd = _progfd = _linkfd = -1;
+    _umem = 0;
+    _nfree = 0;
+}
+
+
+int Xdpsock::map_ring (Ring *R, int size, int esize, uint64_t pgoff, const void *offs)
+{
+    const xdp_ring_offset *O = (const xdp_ring_offset *) offs;
+    unsigned char         *p;
+
+    R->_size = O->desc + size * esize;
+    p = (unsigned char *) mmap (0, R->_size, PROT_READ | PROT_WRITE,
+                                MAP_SHARED | MAP_POPULATE, _fd, pgoff);
+    if (p == MAP_FAILED) return -1;
+    R->_mmap = p;
+    R->_prod = (uint32_t *)(p + O->producer);
+    R->_cons = (uint32_t *)(p + O->consumer);
+    R->_flags = (uint32_t *)(p + O->flags);
+    R->_desc = p + O->desc;
+    R->_mask = size - 1;
+    return 0;
+}
+
+
+// Create the socket and its UMEM, and bind it to a device queue.
+// Only the rings that are used in either direction are created.
+//
+int Xdpsock::open_sock (const char *iface, int queue, bool rx)
+{
+    int              i, size, ifindex;
+    socklen_t        len;
+    xdp_umem_reg     reg;
+    xdp_mmap_offsets offs;
+    sockaddr_xdp     addr;
+
+    ifindex = if_nametoindex (iface);
+    if (ifindex == 0) return -1;
+    _fd = socket (AF_XDP, SOCK_RAW, 0);
+    if (_fd < 0) return -1;
+    _umem = (unsigned char *) mmap (0, NFRAME * FSIZE, PROT_READ | PROT_WRITE,
+                                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (_umem == MAP_FAILED)
+    {
+	_umem = 0;
+	return -1;
+    }
+    memset (&reg, 0, sizeof (reg));
+    reg.addr = (uintptr_t) _umem;
+    reg.len = NFRAME * FSIZE;
+    reg.chunk_size = FSIZE;
+    size = NFRAME;
+    if (   setsockopt (_fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof (reg))
+	|| setsockopt (_fd, SOL_XDP, XDP_UMEM_FILL_RING, &size, sizeof (size))
+	|| setsockopt (_fd, SOL_XDP, XDP_UMEM_COMPLETION_RING, &size, sizeof (size))
+	|| setsockopt (_fd, SOL_XDP, rx ? XDP_RX_RING : XDP_TX_RING, &size, sizeof (size))) return -1;
+    len = sizeof (offs);
+    if (getsockopt (_fd, SOL_XDP, XDP_MMAP_OFFSETS, &offs, &len)) return -1;
+    if (   map_ring (&_fill, NFRAME, sizeof (uint64_t), XDP_UMEM_PGOFF_FILL_RING, &offs.fr)
+        || map_ring (&_comp, NFRAME, sizeof (uint64_t), XDP_UMEM_PGOFF_COMPLETION_RING, &offs.cr)) return -1;
+    if (rx)
+    {
+	if (map_ring (&_rx, NFRAME, sizeof (xdp_desc), XDP_PGOFF_RX_RING, &offs.rx)) return -1;
+	// All frames are used for receiving.
+	for (i = 0; i < NFRAME; i++) ((uint64_t *)(_fill._desc)) [i] = (uint64_t) i * FSIZE;
+	store_release (_fill._prod, NFRAME);
+    }
+    else
+    {
+	if (map_ring (&_tx, NFRAME, sizeof (xdp_desc), XDP_PGOFF_TX_RING, &offs.tx)) return -1;
+	// All frames are used for sending.
+	for (i = 0; i < NFRAME; i++) _free [i] = (uint64_t) i * FSIZE;
+	_nfree = NFRAME;
+    }
+
+    // Try zero-copy mode first.
+    memset (&addr, 0, sizeof (addr));
+    addr.sxdp_family = AF_XDP;
+    addr.sxdp_ifindex = ifindex;
+    addr.sxdp_queue_id = queue;
+    addr.sxdp_flags = XDP_ZEROCOPY | XDP_USE_NEED_WAKEUP;
+    _zcopy = true;
+    if (bind (_fd, (sockaddr *) &addr, sizeof (addr)))
+    {
+	addr.sxdp_flags = XDP_COPY | XDP_USE_NEED_WAKEUP;
+	_zcopy = false;
+	if (bind (_fd, (sockaddr *) &addr, sizeof (addr))) return -1;
+    }
+    return 0;
+}
+
+
+int Xdpsock::open_tx (const char *iface, int sockfd, int ttl, Netdata *prime)
+{
+    int           i, fd;
+    socklen_t     len;
+    sockaddr_in   src, dst;
+    ifreq         ifr;
+    uint32_t      hop, a;
+    unsigned char *h;
+
+    close ();
+    len = sizeof (src);
+    if (getsockname (sockfd, (sockaddr *) &src, &len) || (src.sin_family != AF_INET)) return -1;
+    len = sizeof (dst);
+    if (getpeername (sockfd, (sockaddr *) &dst, &len) || (dst.sin_family != AF_INET)) return -1;
+
+    h = _head;
+    memset (h, 0, 42);
+    fd = socket (AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) return -1;
+    memset (&ifr, 0, sizeof (ifr));
+    strncpy (ifr.ifr_name, iface, IFNAMSIZ - 1);
+    if (ioctl (fd, SIOCGIFHWADDR, &ifr))
+    {
+	::close (fd);
+	return -1;
+    }
+    memcpy (h + 6, ifr.ifr_hwaddr.sa_data, 6);
+    if (src.sin_addr.s_addr == INADDR_ANY)
+    {
+	if (ioctl (fd, SIOCGIFADDR, &ifr) == 0)
+	{
+	    src.sin_addr = ((sockaddr_in *)(&ifr.ifr_addr))->sin_addr;
+	}
+    }
+    ::close (fd);
+
+    a = ntohl (dst.sin_addr.s_addr);
+    if ((a >> 28) == 14)
+    {
+	// Multicast MAC address.
+	h [0] = 0x01;
+	h [1] = 0x00;
+	h [2] = 0x5E;
+	h [3] = (a >> 16) & 0x7F;
+	h [4] = (a >> 8) & 0xFF;
+	h [5] = a & 0xFF;
+    }
+    else
+    {
+	// Let the network stack resolve the next hop, waiting
+	// for up to one second.
+	hop = nexthop (iface, dst.sin_addr.s_addr);
+	for (i = 0; arplookup (iface, hop, h); i++)
+	{
+	    if (i == 100) return -1;
+	    if (i % 25 == 0) ::send (sockfd, prime->data (), prime->dlen (), 0);
+	    usleep (10000);
+	}
+    }
+    h [12] = 0x08;  // IPv4
+    h [13] = 0x00;
+    h += 14;
+    h [0] = 0x45;   // Version 4, no options.
+    h [6] = 0x40;   // Don't fragment.
+    h [8] = ttl;
+    h [9] = 17;     // UDP
+    memcpy (h + 12, &src.sin_addr, 4);
+    memcpy (h + 16, &dst.sin_addr, 4);
+    h += 20;
+    memcpy (h, &src.sin_port, 2);
+    memcpy (h + 2, &dst.sin_port, 2);
+
+    if (open_sock (iface, 0, false))
+    {
+	close ();
+	return -1;
+    }
+    return 0;
+}
+
+
+int Xdpsock::open_rx (const char *iface, int port, int queue)
+{
+    int            ifindex, key;
+    union bpf_attr attr;
+
+    close ();
+    ifindex = if_nametoindex (iface);
+    if (ifindex == 0) return -1;
+    if (open_sock (iface, queue, true))
+    {
+	close ();
+	return -1;
+    }
+    memset (&attr, 0, sizeof (attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof (int);
+    attr.value_size = sizeof (int);
+    attr.max_entries = queue + 1;
+    _mapfd = sys_bpf (BPF_MAP_CREATE, &attr);
+    if (_mapfd < 0)
+    {
+	close ();
+	return -1;
+    }
+    key = queue;
+    memset (&attr, 0, sizeof (attr));
+    attr.map_fd = _mapfd;
+    attr.key = (uintptr_t) &key;
+    attr.value = (uintptr_t) &_fd;
+    if (sys_bpf (BPF_MAP_UPDATE_ELEM, &attr) || load_prog (ifindex, port, queue))
+    {
+	close ();
+	return -1;
+    }
+    return 0;
+}
+
+
+#define INSN(c, d, s, o, i) { (uint8_t)(c), (uint8_t)(d), (uint8_t)(s), (int16_t)(o), (int32_t)(i) }
+
+
+// The XDP program. Packets are redirected to the socket if they are
+// IPv4 without options, not fragmented, and UDP to the given port.
+// Anything else, or if there is no socket for the device queue, is
+// passed to the network stack.
+//
+int Xdpsock::load_prog (int ifindex, int port, int queue)
+{
+    union bpf_attr attr;
+
+    const struct bpf_insn P [] =
+    {
+	INSN (BPF_LDX | BPF_W | BPF_MEM, 2, 1, 0, 0),            // r2 = data
+	INSN (BPF_LDX | BPF_W | BPF_MEM, 3, 1, 4, 0),            // r3 = data_end
+	INSN (BPF_ALU64 | BPF_MOV | BPF_X, 4, 2, 0, 0),          // r4 = r2 + 42
+	INSN (BPF_ALU64 | BPF_ADD | BPF_K, 4, 0, 0, 42),
+	INSN (BPF_JMP | BPF_JGT | BPF_X, 4, 3, 17, 0),           // if r4 > r3 pass
+	INSN (BPF_LDX | BPF_H | BPF_MEM, 5, 2, 12, 0),           // Ethernet type
+	INSN (BPF_JMP | BPF_JNE | BPF_K, 5, 0, 15, htons (0x0800)),
+	INSN (BPF_LDX | BPF_B | BPF_MEM, 5, 2, 14, 0),           // IP version, header size
+	INSN (BPF_JMP | BPF_JNE | BPF_K, 5, 0, 13, 0x45),
+	INSN (BPF_LDX | BPF_B | BPF_MEM, 5, 2, 23, 0),           // IP protocol
+	INSN (BPF_JMP | BPF_JNE | BPF_K, 5, 0, 11, 17),
+	INSN (BPF_LDX | BPF_H | BPF_MEM, 5, 2, 20, 0),           // Fragment offset, MF
+	INSN (BPF_ALU64 | BPF_AND | BPF_K, 5, 0, 0, htons (0x3FFF)),
+	INSN (BPF_JMP | BPF_JNE | BPF_K, 5, 0, 8, 0),
+	INSN (BPF_LDX | BPF_H | BPF_MEM, 5, 2, 36, 0),           // UDP destination port
+	INSN (BPF_JMP | BPF_JNE | BPF_K, 5, 0, 6, htons (port)),
+	INSN (BPF_LDX | BPF_W | BPF_MEM, 2, 1, 16, 0),           // r2 = rx_queue_index
+	INSN (BPF_LD | BPF_DW | BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, _mapfd),
+	INSN (0, 0, 0, 0, 0),
+	INSN (BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, XDP_PASS),   // Action if no socket.
+	INSN (BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),
+	INSN (BPF_JMP | BPF_EXIT, 0, 0, 0, 0),
+	INSN (BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_PASS),   // pass:
+	INSN (BPF_JMP | BPF_EXIT, 0, 0, 0, 0)
+    };
+
+    memset (&attr, 0, sizeof (attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = (uintptr_t) P;
+    attr.insn_cnt = sizeof (P) / sizeof (P [0]);
+    attr.license = (uintptr_t) "GPL";
+    _progfd = sys_bpf (BPF_PROG_LOAD, &attr);
+    if (_progfd < 0) return -1;
+
+    // Use the driver's XDP support if there is any.
+    memset (&attr, 0, sizeof (attr));
+    attr.link_create.prog_fd = _progfd;
+    attr.link_create.target_ifindex = ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+    _linkfd = sys_bpf (BPF_LINK_CREATE, &attr);
+    if (_linkfd < 0) return -1;
+    return 0;
+}
+
+
+// Return frames that have been sent to the free list.
+//
+void Xdpsock::reclaim (void)
+{
+    uint32_t  i, c, p;
+
+    c = *_comp._cons;
+    p = load_acquire (_comp._prod);
+    for (i = c; i != p; i++)
+    {
+	_free [_nfree++] = ((uint64_t *)(_comp._desc)) [i & _comp._mask];
+    }
+    store_release (_comp._cons, p);
+}
+
+
+int Xdpsock::send (Netdata **B, int n)
+{
+    int            i, k, d;
+    uint32_t       p, c;
+    unsigned char  *f;
+    xdp_desc       *T;
+
+    if (_fd < 0) return 0;
+    reclaim ();
+    p = *_tx._prod;
+    c = load_acquire (_tx._cons);
+    T = (xdp_desc *)(_tx._desc);
+    for (i = k = 0; i < n; i++)
+    {
+	if ((_nfree == 0) || (p - c > _tx._mask)) break;
+	d = B [i]->dlen ();
+	if (d > MAXDATA) continue;
+	f = _umem + _free [--_nfree];
+	memcpy (f, _head, 42);
+	memcpy (f + 42, B [i]->data (), d);
+	f [16] = (d + 28) >> 8;
+	f [17] = (d + 28) & 255;
+	f [18] = _ipid >> 8;
+	f [19] = _ipid & 255;
+	_ipid++;
+	f [24] = f [25] = 0;
+	d = ipsum (f + 14, 20);
+	f [24] = d >> 8;
+	f [25] = d & 255;
+	d = B [i]->dlen () + 8;
+	f [38] = d >> 8;
+	f [39] = d & 255;
+	// No UDP checksum, allowed for IPv4.
+	f [40] = f [41] = 0;
+	T [p & _tx._mask].addr = f - _umem;
+	T [p & _tx._mask].len = B [i]->dlen () + 42;
+	T [p & _tx._mask].options = 0;
+	p++;
+	k++;
+    }
+    store_release (_tx._prod, p);
+    if (k && (!_zcopy || (*_tx._flags & XDP_RING_NEED_WAKEUP)))
+    {
+	sendto (_fd, 0, 0, MSG_DONTWAIT, 0, 0);
+    }
+    return k;
+}
+
+
+int Xdpsock::recv (Netdata **P, int n)
+{
+    int            i, k, m, d, h;
+    uint32_t       p, c, f;
+    uint64_t       a;
+    unsigned char  *q;
+    xdp_desc       *R;
+
+    if (_fd < 0) return 0;
+    c = *_rx._cons;
+    p = load_acquire (_rx._prod);
+    k = p - c;
+    if (k > n) k = n;
+    if (k == 0) return 0;
+    R = (xdp_desc *)(_rx._desc);
+    f = *_fill._prod;
+    for (i = m = 0; i < k; i++)
+    {
+	a = R [(c + i) & _rx._mask].addr;
+	d = R [(c + i) & _rx._mask].len;
+	q = _umem + a;
+	// The program has checked the headers, except for the lengths.
+	h = 14 + 20 + 8;
+	if (d >= h)
+	{
+	    d = (q [38] << 8) + q [39] - 8;
+	    if (d > (int) R [(c + i) & _rx._mask].len - h) d = R [(c + i) & _rx._mask].len - h;
+	    if (d > P [m]->size ()) d = P [m]->size ();
+	    if (d > 0) memcpy (P [m]->data (), q + h, d);
+	    // Empty packets would leave the previous data.
+	    else P [m]->data () [0] = 0;
+	    m++;
+	}
+	// Give the frame back to the kernel.
+	((uint64_t *)(_fill._desc)) [f++ & _fill._mask] = a - a % FSIZE;
+    }
+    store_release (_rx._cons, c + k);
+    store_release (_fill._prod, f);
+    return m;
+}
+
+
+int Xdpsock::wait (int sockfd, int msecs)
+{
+    struct pollfd  F [2];
+
+    F [0].fd = _fd;
+    F [0].events = POLLIN;
+    F [1].fd = sockfd;
+    F [1].events = POLLIN;
+    if (poll (F, 2, msecs) < 0) return (errno == EINTR) ? 0 : -1;
+    if ((F [0].revents | F [1].revents) & (POLLERR | POLLNVAL)) return -1;
+    return 0;
+}
+
+
+#else
+
+
+Xdpsock::Xdpsock (void) :
+    _fd (-1)
+{
+}
+
+
+Xdpsock::~Xdpsock (void)
+{
+}
+
+
+bool Xdpsock::available (void)
+{
+    return false;
+}
+
+
+int Xdpsock::open_tx (const char *iface, int sockfd, int ttl, Netdata *prime)
+{
+    return -1;
+}
+
+
+int Xdpsock::open_rx (const char *iface, int port, int queue)
+{
+    return -1;
+}
+
+
+void Xdpsock::close (void)
+{
+}
+
+
+int Xdpsock::send (Netdata **B, int n)
+{
+    return 0;
+}
+
+
+int Xdpsock::recv (Netdata **P, int n)
+{
+    return 0;
+}
+
+
+int Xdpsock::wait (int sockfd, int msecs)
+{
+    return -1;
+}
+
+
+#endif
@@ -0,0 +1,115 @@
+// ----------------------------------------------------------------------------
+//
+//  Copyright (C) 2013-2016 Fons Adriaensen <fons@linuxaudio.org>
+//
+//  This program is free software; you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation; either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// ----------------------------------------------------------------------------
+
+
+#ifndef __XDPSOCK_H
+#define __XDPSOCK_H
+
+
+#include <stdint.h>
+#include "netdata.h"
+
+
+// AF_XDP transport for the UDP packets of a stream, bypassing the
+// network stack. Ethernet, IPv4 and UDP headers are created and
+// checked here. Zero-copy mode is used if the driver supports it,
+// otherwise copy mode, which works with any driver.
+//
+// For sending, all addresses are taken from a connected UDP socket,
+// which is also used to resolve the destination's MAC address.
+//
+// For receiving, a small XDP program is attached to the interface.
+// It redirects UDP packets for the given port that arrive on the
+// selected device queue. All other packets, including those for the
+// same port on other queues, are passed to the network stack.
+//
+// Only available on Linux, elsewhere open_tx () and open_rx ()
+// always fail.
+
+
+class Xdpsock
+{
+public:
+
+    Xdpsock (void);
+    ~Xdpsock (void);
+
+    // Largest UDP payload that fits into a frame.
+    enum { NFRAME = 4096, FSIZE = 2048, MAXDATA = FSIZE - 42 };
+
+    static bool available (void);
+
+    // The prime packet is sent on the UDP socket if the
+    // destination's MAC address must be resolved. The
+    // returned value is zero on success.
+    int  open_tx (const char *iface, int sockfd, int ttl, Netdata *prime);
+    int  open_rx (const char *iface, int port, int queue);
+    void close (void);
+
+    bool zerocopy (void) const { return _zcopy; }
+
+    // Send packets, returns the number sent.
+    int send (Netdata **B, int n);
+
+    // Copy received packets into P [], at most n, without blocking.
+    // Returns the number received.
+    int recv (Netdata **P, int n);
+
+    // Wait until there are received packets, or data on 'sockfd',
+    // for up to 'msecs'. Returns -1 on error.
+    int wait (int sockfd, int msecs);
+
+private:
+
+    class Ring
+    {
+    public:
+
+	uint32_t  *_prod;
+	uint32_t  *_cons;
+	uint32_t  *_flags;
+	void      *_desc;
+	uint32_t   _mask;
+	void      *_mmap;
+	size_t     _size;
+    };
+
+    int  open_sock (const char *iface, int queue, bool rx);
+    int  map_ring (Ring *R, int size, int esize, uint64_t pgoff, const void *offs);
+    int  load_prog (int ifindex, int port, int queue);
+    void reclaim (void);
+
+    int            _fd;
+    int            _mapfd;
+    int            _progfd;
+    int            _linkfd;
+    bool           _zcopy;
+    unsigned char *_umem;
+    Ring           _fill;
+    Ring           _comp;
+    Ring           _rx;
+    Ring           _tx;
+    uint64_t       _free [NFRAME];
+    int            _nfree;
+    unsigned char  _head [42];  // Ethernet, IPv4 and UDP headers.
+    uint16_t       _ipid;
+};
+
+
+#endif
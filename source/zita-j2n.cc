@@ -24,11 +24,16 @@
 #include <signal.h>
 #include <getopt.h>
 #include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
 #include "jacktx.h"
 #include "nettx.h"
 #include "lfqueue.h"
 #include "netdata.h"
 #include "zsockets.h"
+#include "sampconv.h"
+#include "opuscodec.h"
 #ifndef _WIN32
     #include <sys/mman.h>
 #endif
@@ -52,6 +57,19 @@ static const char   *dev_arg   = 0;
 static int           mtu_arg   = 1500;
 static int           hops_arg  = 1;
 static int           form_arg  = Netdata::FM_24BIT;
+static int           rate_arg  = 64;
+static bool          supp_arg  = false;
+static const char   *pace_arg  = 0;
+static int           lead_arg  = 1000;
+static const char   *xdp_arg   = 0;
+static bool          uring_opt = false;
+static const char   *shm_arg   = 0;
+static const char   *dest_arg [Nettx::MAXDEST];
+static int           ndest_arg = 0;
+static bool          ctrl_opt  = false;
+static int           mgrp_arg  = 0;
+static const char   *path_arg [Nettx::MAXPATH];
+static int           npath_arg = 0;
 
 
 static void help (void)
@@ -61,21 +79,41 @@ static void help (void)
     fprintf (stderr, "Send audio to zita-n2j.\n\n");
     fprintf (stderr, "Usage: %s <options> ip-address ip-port \n", APPNAME);
     fprintf (stderr, "       %s <options> ip-address ip-port interface\n", APPNAME);
+    fprintf (stderr, "       %s <options> --shm <name>\n", APPNAME);
     fprintf (stderr, "Options:\n");
     fprintf (stderr, "  --help              Display this text\n");
     fprintf (stderr, "  --jname <name>      Jack client name [%s]\n", APPNAME);
     fprintf (stderr, "  --jserv <name>      Jack server name\n");
     fprintf (stderr, "  --chan  <nchan>     Number of channels [%d]\n", chan_arg);
     fprintf (stderr, "  --16bit             Send 16-bit samples\n");
+    fprintf (stderr, "  --20bit             Send packed 20-bit samples\n");
     fprintf (stderr, "  --24bit             Send 24-bit samples (default)\n");
     fprintf (stderr, "  --float             Send floating point samples\n");
+    fprintf (stderr, "  --half              Send half precision floating point samples\n");
+    fprintf (stderr, "  --pfloat            Send planar little-endian floating point samples\n");
+    fprintf (stderr, "  --p32bit            Send planar little-endian 32-bit samples\n");
+    fprintf (stderr, "  --bfp12             Send block floating point, 12-bit mantissa\n");
+    fprintf (stderr, "  --bfp16             Send block floating point, 16-bit mantissa\n");
+    fprintf (stderr, "  --lossless          Send losslessly compressed 24-bit samples\n");
+    fprintf (stderr, "  --opus              Send Opus compressed audio\n");
+    fprintf (stderr, "  --rate  <kbit/s>    Opus bitrate per channel [%d]\n", rate_arg);
+    fprintf (stderr, "  --suppress          Don't send silent or unconnected channels\n");
+    fprintf (stderr, "  --pace  <mode>      Spread packets over the period: timer, fq, etf\n");
+    fprintf (stderr, "  --lead  <usecs>     Delay of the packets for etf pacing [%d]\n", lead_arg);
+    fprintf (stderr, "  --xdp   <device>    Send using AF_XDP on this device\n");
+    fprintf (stderr, "  --uring             Send using io_uring\n");
+    fprintf (stderr, "  --shm   <name>      Send to a shared memory ring on this host\n");
+    fprintf (stderr, "  --dest  <address>   Also send to address[:port]\n");
+    fprintf (stderr, "  --control           Read 'add' and 'del' commands for destinations from stdin\n");
+    fprintf (stderr, "  --mgroup <nchan>    Send groups of channels to consecutive multicast addresses\n");
+    fprintf (stderr, "  --stripe <address>  Stripe packets over this address[:port] as well\n");
     fprintf (stderr, "  --mtu   <size>      Maximum packet size [%d]\n", mtu_arg);
     fprintf (stderr, "  --hops  <hops>      Number of hops for multicast [%d]\n", hops_arg);
     exit (1);
 }
 
 
-enum { HELP, NAME, SERV, CHAN, BIT16, BIT24, FLT32, MTU, HOPS };
+enum { HELP, NAME, SERV, CHAN, BIT16, BIT20, BIT24, FLT16, FLT32, PFL32, PBI32, BFP12, BFP16, LL24, OPUS, RATE, SUPP, PACE, LEAD, XDP, URING, SHM, DEST, CTRL, MGRP, STRP, MTU, HOPS };
 
 
 static struct option options [] = 
@@ -87,8 +125,27 @@ static struct option options [] =
     { "mtu",   1, 0, MTU   },
     { "hops",  1, 0, HOPS  },
     { "16bit", 0, 0, BIT16 },
+    { "20bit", 0, 0, BIT20 },
     { "24bit", 0, 0, BIT24 },
     { "float", 0, 0, FLT32 },
+    { "half",  0, 0, FLT16 },
+    { "pfloat", 0, 0, PFL32 },
+    { "p32bit", 0, 0, PBI32 },
+    { "bfp12", 0, 0, BFP12 },
+    { "bfp16", 0, 0, BFP16 },
+    { "lossless", 0, 0, LL24 },
+    { "opus",  0, 0, OPUS  },
+    { "rate",  1, 0, RATE  },
+    { "suppress", 0, 0, SUPP },
+    { "pace",  1, 0, PACE  },
+    { "lead",  1, 0, LEAD  },
+    { "xdp",   1, 0, XDP   },
+    { "uring", 0, 0, URING },
+    { "shm",   1, 0, SHM   },
+    { "dest",  1, 0, DEST  },
+    { "control", 0, 0, CTRL },
+    { "mgroup", 1, 0, MGRP },
+    { "stripe", 1, 0, STRP },
     { 0, 0, 0, 0 }
 };
 
@@ -136,14 +193,83 @@ static void procoptions (int ac, char *av [])
 	case BIT16:
 	    form_arg = Netdata::FM_16BIT;
 	    break;
+	case BIT20:
+	    form_arg = Netdata::FM_20BIT;
+	    break;
 	case BIT24:
 	    form_arg = Netdata::FM_24BIT;
 	    break;
         case FLT32:
 	    form_arg = Netdata::FM_FLOAT;
 	    break;
+        case FLT16:
+	    form_arg = Netdata::FM_HALF;
+	    break;
+        case PFL32:
+	    form_arg = Netdata::FM_PFLOAT;
+	    break;
+        case PBI32:
+	    form_arg = Netdata::FM_P32BIT;
+	    break;
+        case BFP12:
+	    form_arg = Netdata::FM_BFP12;
+	    break;
+        case BFP16:
+	    form_arg = Netdata::FM_BFP16;
+	    break;
+        case LL24:
+	    form_arg = Netdata::FM_LL24;
+	    break;
+        case OPUS:
+	    form_arg = Netdata::FM_OPUS;
+	    break;
+	case RATE:
+	    rate_arg = getint ("rate");
+	    break;
+	case SUPP:
+	    supp_arg = true;
+	    break;
+	case PACE:
+	    pace_arg = optarg;
+	    break;
+	case LEAD:
+	    lead_arg = getint ("lead");
+	    break;
+	case XDP:
+	    xdp_arg = optarg;
+	    break;
+	case URING:
+	    uring_opt = true;
+	    break;
+	case SHM:
+	    shm_arg = optarg;
+	    break;
+	case DEST:
+	    if (ndest_arg == Nettx::MAXDEST - 1)
+	    {
+		fprintf (stderr, "Too many destinations.\n");
+		exit (1);
+	    }
+	    dest_arg [ndest_arg++] = optarg;
+	    break;
+	case CTRL:
+	    ctrl_opt = true;
+	    break;
+	case MGRP:
+	    mgrp_arg = getint ("mgroup");
+	    break;
+	case STRP:
+	    if (npath_arg == Nettx::MAXPATH - 1)
+	    {
+		fprintf (stderr, "Too many paths.\n");
+		exit (1);
+	    }
+	    path_arg [npath_arg++] = optarg;
+	    break;
  	}
     }
+    // No address is used with a shared memory ring.
+    if (shm_arg && (ac == optind)) return;
     if (ac < optind + 2) help ();
     if (ac > optind + 3) help ();
     addr_arg = av [optind++];
@@ -205,31 +331,255 @@ static int opensocket (Sockaddr *A)
 
 
 
+// Parse a destination, 'address' or 'address:port'. IPv6 addresses
+// must be in brackets if a port is given. The default port is that
+// of the first destination.
+//
+static int getdest (const char *s, int family, Sockaddr *A)
+{
+    const char  *p;
+    char         host [256];
+    int          k, port;
+
+    port = port_arg;
+    if (*s == '[')
+    {
+	if ((p = strchr (s, ']')) == 0) return -1;
+	k = p - s - 1;
+	if (p [1] == ':') port = atoi (p + 2);
+	else if (p [1]) return -1;
+	s++;
+    }
+    else
+    {
+	p = strchr (s, ':');
+	if (p && (p == strrchr (s, ':'))) port = atoi (p + 1);
+	else p = s + strlen (s);
+	k = p - s;
+    }
+    if ((k < 1) || (k > 255) || (port < 1) || (port > 65535)) return -1;
+    memcpy (host, s, k);
+    host [k] = 0;
+    if (A->set_addr (family, SOCK_DGRAM, 0, host)) return -1;
+    A->set_port (port);
+    return 0;
+}
+
+
+// Read commands from stdin without blocking. These are 'add <dest>'
+// and 'del <dest>', one per line, see getdest () for the format.
+//
+static void control (Nettx *nettx, int family)
+{
+    static char  line [256];
+    static int   k = 0;
+    static bool  eof = false;
+    char         c, cmd [8], arg [256];
+    int          rv;
+    Sockaddr     A;
+    pollfd       F;
+
+    F.fd = 0;
+    F.events = POLLIN;
+    while (! eof && (poll (&F, 1, 0) > 0))
+    {
+	if (read (0, &c, 1) != 1)
+	{
+	    eof = true;
+	    break;
+	}
+	if (c != '\n')
+	{
+	    if (k < 255) line [k++] = c;
+	    continue;
+	}
+	line [k] = 0;
+	k = 0;
+	if (   (sscanf (line, "%7s %255s", cmd, arg) != 2)
+	    || (strcmp (cmd, "add") && strcmp (cmd, "del")))
+	{
+	    fprintf (stderr, "Bad command: %s\n", line);
+	    continue;
+	}
+	if (getdest (arg, family, &A))
+	{
+	    fprintf (stderr, "Bad destination: %s\n", arg);
+	    continue;
+	}
+	if (cmd [0] == 'a') rv = nettx->add_dest (&A);
+	else rv = nettx->del_dest (&A);
+	if (rv) fprintf (stderr, "Failed: %s %s\n", cmd, arg);
+	else printf ("Done: %s %s\n", cmd, arg);
+    }
+}
+
+
+// Read the channel subscriptions sent by the receiver to any of the
+// sockets, and pass the last one to Jacktx if it has changed. If there
+// are none for five seconds, all channels are sent again.
+//
+static void subscription (const int *fds, int nfd, Jacktx *jacktx)
+{
+    static Netdata   P (256);
+    static uint64_t  S [Netdata::MAXCHAN / 64];
+    static int       age = -1;
+    uint64_t         T [Netdata::MAXCHAN / 64];
+    int              i, k, n;
+
+    n = 0;
+    for (i = 0; i < nfd; i++)
+    {
+	while ((k = recv (fds [i], P.data (), P.size (), MSG_DONTWAIT)) > 0)
+	{
+	    if (P.get_subscr (T, k) == 0) n++;
+	}
+    }
+    if (n)
+    {
+	if ((age < 0) || memcmp (S, T, sizeof (S)))
+	{
+	    memcpy (S, T, sizeof (S));
+	    jacktx->subscribe (S);
+	    for (i = k = 0; i < Netdata::MAXCHAN; i++) k += (S [i / 64] >> (i % 64)) & 1;
+	    printf ("Receiver subscribed to %d channels.\n", k);
+	}
+	age = 0;
+    }
+    else if ((age >= 0) && (++age == 10))
+    {
+	jacktx->subscribe (0);
+	printf ("Subscription expired, sending all channels.\n");
+	age = -1;
+    }
+}
+
+
+static int pacemode (int fd)
+{
+    int mode, clk;
+
+    if (! pace_arg) return Nettx::PACE_NONE;
+    if (! strcmp (pace_arg, "timer")) return Nettx::PACE_TIMER;
+    if (! strcmp (pace_arg, "fq"))
+    {
+	mode = Nettx::PACE_FQ;
+	clk = CLOCK_MONOTONIC;
+    }
+#ifdef CLOCK_TAI
+    else if (! strcmp (pace_arg, "etf"))
+    {
+	mode = Nettx::PACE_ETF;
+	clk = CLOCK_TAI;
+    }
+#endif
+    else
+    {
+	fprintf (stderr, "Unknown pacing mode '%s'.\n", pace_arg);
+	exit (1);
+    }
+    if (sock_set_txtime (fd, clk))
+    {
+	fprintf (stderr, "Warning: SO_TXTIME is not available, using timer pacing.\n");
+	mode = Nettx::PACE_TIMER;
+    }
+    return mode;
+}
+
+
 int main (int ac, char *av [])
 {
-    Sockaddr        A;
-    int             sockfd, psize, ppper, npack;
+    Sockaddr        A, D, G [Netdata::MAXGROUP];
+    bool            subs;
+    int             i, sockfd, mtu, psize, ppper, npack, fsize, flags, ngrp, gsize, npath;
+    int             ntxerr;
+    int             pathfd [Nettx::MAXPATH];
     Jacktx         *jacktx = 0;
     Nettx          *nettx = 0;
+    Opusenc        *openc = 0;
+    Xdpsock        *xdpsock = 0;
+    Uring          *uring = 0;
+    Shmring        *shmring = 0;
 
     procoptions (ac, av);
+    sconv_init ();
+    npath = 1;
 
     if ((chan_arg < 1) || (chan_arg > Netdata::MAXCHAN))
     {
 	fprintf (stderr, "Number of channels is out of range.\n");
 	exit (1);
     }
-    if (A.set_addr (AF_UNSPEC, SOCK_DGRAM, 0, addr_arg))
+    if ((lead_arg < 0) || (lead_arg > 100000))
     {
-	fprintf (stderr, "Address resolution failed.\n");
+	fprintf (stderr, "Lead time is out of range.\n");
 	exit (1);
     }
-    if ((port_arg < 1) || (port_arg > 65535))
+    if (shm_arg)
+    {
+	if (xdp_arg || uring_opt || pace_arg)
+	{
+	    fprintf (stderr, "Option --shm can't be combined with --xdp, --uring or --pace.\n");
+	    exit (1);
+	}
+    }
+    else
     {
-	fprintf (stderr, "Port number is out of range.\n");
+	if (A.set_addr (AF_UNSPEC, SOCK_DGRAM, 0, addr_arg))
+	{
+	    fprintf (stderr, "Address resolution failed.\n");
+	    exit (1);
+	}
+	if ((port_arg < 1) || (port_arg > 65535))
+	{
+	    fprintf (stderr, "Port number is out of range.\n");
+	    exit (1);
+	}
+	A.set_port (port_arg);
+    }
+    if (xdp_arg && uring_opt)
+    {
+	fprintf (stderr, "Options --xdp and --uring can't be combined.\n");
+	exit (1);
+    }
+    if ((ndest_arg || ctrl_opt) && (shm_arg || xdp_arg || uring_opt || pace_arg))
+    {
+	fprintf (stderr, "Options --dest and --control can't be combined with --shm, --xdp, --uring or --pace.\n");
 	exit (1);
     }
-    A.set_port (port_arg);
+    if (mgrp_arg)
+    {
+	if (shm_arg || xdp_arg || uring_opt || pace_arg || ndest_arg || ctrl_opt || (form_arg == Netdata::FM_OPUS))
+	{
+	    fprintf (stderr, "Option --mgroup can't be combined with --shm, --xdp, --uring, --pace,\n"
+		     "--dest, --control or --opus.\n");
+	    exit (1);
+	}
+	if (! A.is_multicast ())
+	{
+	    fprintf (stderr, "Option --mgroup requires a multicast address.\n");
+	    exit (1);
+	}
+	if (   (mgrp_arg < 1) || (mgrp_arg > Netdata::MAXPCHAN)
+	    || ((chan_arg + mgrp_arg - 1) / mgrp_arg > Netdata::MAXGROUP))
+	{
+	    fprintf (stderr, "Channel group size is out of range.\n");
+	    exit (1);
+	}
+    }
+    if (npath_arg)
+    {
+	if (shm_arg || xdp_arg || uring_opt || pace_arg || ndest_arg || ctrl_opt || mgrp_arg || (form_arg == Netdata::FM_OPUS))
+	{
+	    fprintf (stderr, "Option --stripe can't be combined with --shm, --xdp, --uring, --pace,\n"
+		     "--dest, --control, --mgroup or --opus.\n");
+	    exit (1);
+	}
+	if (A.is_multicast ())
+	{
+	    fprintf (stderr, "Option --stripe requires unicast addresses.\n");
+	    exit (1);
+	}
+    }
 
 #ifdef __linux__
     if (mlockall (MCL_CURRENT | MCL_FUTURE))
@@ -242,30 +592,219 @@ int main (int ac, char *av [])
     nettx  = new Nettx;
     usleep (100000);
 
-    sockfd = opensocket (&A);
-    psize = mtu_arg - ((A.family () == AF_INET6) ? 48 : 28);
-    ppper = Netdata::packetsperperiod (psize, jacktx->bsize (), form_arg, chan_arg);
-    npack = ppper * (int)(ceil (0.05 * jacktx->fsamp () / jacktx->bsize ()));
+    if (shm_arg)
+    {
+	shmring = new Shmring ();
+	if (shmring->open (shm_arg))
+	{
+	    fprintf (stderr, "Can't open shared memory ring '%s'.\n", shm_arg);
+	    exit (1);
+	}
+	printf ("Using shared memory ring '%s'.\n", shm_arg);
+	nettx->set_shm (shmring);
+	// Normally a period fits into a single packet.
+	sockfd = -1;
+	psize = Shmring::MAXDATA;
+    }
+    else
+    {
+	sockfd = opensocket (&A);
+	pathfd [0] = sockfd;
+	// Don't use packets larger than the path MTU.
+	mtu = sock_get_mtu (sockfd);
+	if ((mtu > 0) && (mtu < mtu_arg))
+	{
+	    printf ("Using path MTU %d.\n", mtu);
+	    mtu_arg = mtu;
+	}
+	for (i = 0; i < npath_arg; i++)
+	{
+	    if (getdest (path_arg [i], A.family (), &D) || D.is_multicast ())
+	    {
+		fprintf (stderr, "Bad stripe address: %s\n", path_arg [i]);
+		exit (1);
+	    }
+	    // Each path has its own socket, so it is routed
+	    // by its address. All must use the smallest MTU.
+	    if ((pathfd [npath] = sock_open_dgram (&D, 0)) < 0)
+	    {
+		fprintf (stderr, "Failed to open socket.\n");
+		exit (1);
+	    }
+	    mtu = sock_get_mtu (pathfd [npath++]);
+	    if ((mtu > 0) && (mtu < mtu_arg))
+	    {
+		printf ("Using path MTU %d.\n", mtu);
+		mtu_arg = mtu;
+	    }
+	}
+	psize = mtu_arg - ((A.family () == AF_INET6) ? 48 : 28);
+    }
+    if (xdp_arg && (psize > Xdpsock::MAXDATA)) psize = Xdpsock::MAXDATA;
+    if (mgrp_arg)
+    {
+	ngrp = (chan_arg + mgrp_arg - 1) / mgrp_arg;
+	gsize = mgrp_arg;
+    }
+    else
+    {
+	ngrp = Netdata::ngroups (chan_arg);
+	gsize = Netdata::groupsize (chan_arg);
+    }
+    if (form_arg == Netdata::FM_OPUS)
+    {
+	if (! Opusenc::available ())
+	{
+	    fprintf (stderr, "This program was built without Opus support.\n");
+	    exit (1);
+	}
+	if (chan_arg > Netdata::MAXPCHAN)
+	{
+	    fprintf (stderr, "Opus is limited to %d channels.\n", Netdata::MAXPCHAN);
+	    exit (1);
+	}
+	fsize = Opusenc::framesize (jacktx->fsamp (), jacktx->bsize ());
+	if (fsize == 0)
+	{
+	    fprintf (stderr, "Opus requires a sample rate of 8, 12, 16, 24 or 48 kHz,\n"
+		     "and a period of at least 2.5 ms.\n");
+	    exit (1);
+	}
+	if ((rate_arg < 6) || (rate_arg > 256))
+	{
+	    fprintf (stderr, "Opus bitrate is out of range.\n");
+	    exit (1);
+	}
+	// All channels must fit into one packet, leave some
+	// room as the size of each frame varies.
+	i = (int)(0.9 * 8e-3 * Netdata::opus_maxsize (psize) * jacktx->fsamp () / ((double) chan_arg * fsize));
+	if (i < 6)
+	{
+	    fprintf (stderr, "Packet size is too small for Opus with %d channels.\n", chan_arg);
+	    exit (1);
+	}
+	if (rate_arg > i)
+	{
+	    printf ("Opus bitrate reduced to %d kbit/s to fit the packet size.\n", i);
+	    rate_arg = i;
+	}
+	openc = new Opusenc;
+	if (openc->init (jacktx->fsamp (), chan_arg, fsize, 1000 * rate_arg))
+	{
+	    fprintf (stderr, "Failed to create Opus encoder.\n");
+	    exit (1);
+	}
+	// Complete Opus frames in one period.
+	ppper = (jacktx->bsize () + fsize - 1) / fsize;
+    }
+    else
+    {
+	// Packets contain a group of channels if there are more
+	// than MAXPCHAN, the optional fields reduce their size.
+	flags = supp_arg ? Netdata::FL_CMASK : 0;
+	if (ngrp > 1) flags |= Netdata::FL_GROUP;
+	if (npath_arg) flags |= Netdata::FL_SEQ;
+	ppper = Netdata::packetsperperiod (psize, jacktx->bsize (), form_arg, gsize, flags);
+    }
+    if (ppper < 1)
+    {
+	fprintf (stderr, "Packet size is too small for %d channels.\n", chan_arg);
+	exit (1);
+    }
+    npack = ppper * ngrp * (int)(ceil (0.05 * jacktx->fsamp () / jacktx->bsize ()));
     packq = new Lfq_packdata (npack, psize);
     timeq = new Lfq_timedata (4);
     infoq = new Lfq_int32 (16);
 
     descpack.init_audio_desc (0, form_arg, chan_arg, psize, jacktx->fsamp (), jacktx->bsize ());
-    nettx->start (packq, timeq, &descpack, sockfd, jacktx->rprio () + 5);
-    jacktx->start (packq, timeq, infoq, nettx, form_arg, ppper);
+    if (npath_arg)
+    {
+	descpack.set_npath (npath);
+	printf ("Striping over %d paths.\n", npath);
+	nettx->set_paths (pathfd, npath);
+    }
+    if (xdp_arg)
+    {
+	xdpsock = new Xdpsock ();
+	if (xdpsock->open_tx (xdp_arg, sockfd, A.is_multicast () ? hops_arg : 64, &descpack))
+	{
+	    fprintf (stderr, "Can't use AF_XDP on '%s' (IPv4 only).\n", xdp_arg);
+	    exit (1);
+	}
+	printf ("Using AF_XDP, %s mode.\n", xdpsock->zerocopy () ? "zero-copy" : "copy");
+	nettx->set_xdp (xdpsock);
+    }
+    if (uring_opt)
+    {
+	uring = new Uring ();
+	if (uring->open (256) || nettx->set_uring (uring, packq, &descpack))
+	{
+	    fprintf (stderr, "Warning: can't use io_uring, using sendmmsg ().\n");
+	    delete uring;
+	    uring = 0;
+	}
+	else printf ("Using io_uring.\n");
+    }
+    if (ndest_arg || ctrl_opt)
+    {
+	// The first address is also in the list.
+	nettx->add_dest (&A);
+	for (i = 0; i < ndest_arg; i++)
+	{
+	    if (getdest (dest_arg [i], A.family (), &D))
+	    {
+		fprintf (stderr, "Bad destination: %s\n", dest_arg [i]);
+		exit (1);
+	    }
+	    nettx->add_dest (&D);
+	}
+    }
+    if (mgrp_arg)
+    {
+	// Group g is sent to the address g above the first one.
+	for (i = 0; i < ngrp; i++)
+	{
+	    G [i] = A;
+	    G [i].add_addr (i);
+	}
+	printf ("Sending %d channel groups.\n", ngrp);
+	nettx->set_groups (G, ngrp, gsize);
+    }
+    nettx->start (packq, timeq, &descpack, sockfd, jacktx->rprio () + 5,
+                  pacemode (sockfd), (int)(1e6 * jacktx->bsize () / jacktx->fsamp ()), lead_arg);
+    // Channels are left out after half a second of silence.
+    jacktx->start (packq, timeq, infoq, nettx, form_arg, ppper, openc,
+                   supp_arg ? jacktx->fsamp () / 2 : 0, mgrp_arg, npath_arg > 0);
+
+    // Subscriptions are accepted from a single unicast receiver, which
+    // sends them to the address of a socket, of any path if striped.
+    // Opus can't leave out channels.
+    subs = !shm_arg && !A.is_multicast () && !ndest_arg && !ctrl_opt && (form_arg != Netdata::FM_OPUS);
 
     signal (SIGINT, siginthandler);
+    ntxerr = 0;
     while (! stop)
     {
 	usleep (500000);
-        nettx->trigger ();
+        nettx->trigger_desc ();
 	checkstatus ();
+	if (nettx->txerrors () != ntxerr)
+	{
+	    ntxerr = nettx->txerrors ();
+	    printf ("Warning: %d packets dropped by the qdisc, increase --lead.\n", ntxerr);
+	}
+	if (ctrl_opt) control (nettx, A.family ());
+	if (subs) subscription (pathfd, npath, jacktx);
     }
 
     nettx->stop ();
     usleep (100000);
     delete jacktx;
     delete nettx;
+    delete xdpsock;
+    delete uring;
+    delete shmring;
+    delete openc;
     delete packq;
     delete timeq;
     delete infoq;
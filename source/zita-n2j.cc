@@ -27,6 +27,8 @@
 #include "lfqueue.h"
 #include "netdata.h"
 #include "zsockets.h"
+#include "sampconv.h"
+#include "opuscodec.h"
 #include "netrx.h"
 #include "syncrx.h"
 #include "jackrx.h"
@@ -55,6 +57,16 @@ static int           buff_arg  = 10;
 static int           sync_arg  = 0;
 static int           filt_arg  = 0;
 static bool          info_opt  = false;
+static bool          ktime_opt = false;
+static int           busy_arg  = 0;
+static int           cpu_arg   = -1;
+static const char   *xdp_arg   = 0;
+static bool          uring_opt = false;
+static const char   *shm_arg   = 0;
+static int           mgrp_arg  = 0;
+static bool          subs_opt  = false;
+static int           glist [Netdata::MAXGROUP];
+static int           ngrp = 0;
 
 
 static void help (void)
@@ -64,6 +76,7 @@ static void help (void)
     fprintf (stderr, "Receive audio from zita-j2n.\n\n");
     fprintf (stderr, "Usage: %s <options> ip-address ip-port \n", APPNAME);
     fprintf (stderr, "       %s <options> ip-address ip-port interface\n", APPNAME);
+    fprintf (stderr, "       %s <options> --shm <name>\n", APPNAME);
     fprintf (stderr, "Options:\n");
     fprintf (stderr, "  --help              Display this text\n");
     fprintf (stderr, "  --jname <name>      Jack client name [%s]\n", APPNAME);
@@ -72,12 +85,20 @@ static void help (void)
     fprintf (stderr, "  --buff  <time>      Additional buffering (ms) [%d]\n", buff_arg);
 //    fprintf (stderr, "  --sync  <time>      Sync delay (ms) [%d]\n", sync_arg);
     fprintf (stderr, "  --filt  <delay>     Resampler filter delay [16..96]\n");
+    fprintf (stderr, "  --ktime             Use kernel receive timestamps\n");
+    fprintf (stderr, "  --busy  <time>      Poll for packets (us) [%d]\n", busy_arg);
+    fprintf (stderr, "  --cpu   <cpu>       Run receiver thread on this CPU\n");
+    fprintf (stderr, "  --xdp   <device>    Receive using AF_XDP on this device\n");
+    fprintf (stderr, "  --uring             Receive using io_uring\n");
+    fprintf (stderr, "  --shm   <name>      Receive from a shared memory ring on this host\n");
+    fprintf (stderr, "  --mgroup <nchan>    Join only the multicast groups with selected channels\n");
+    fprintf (stderr, "  --subscribe         Ask a unicast sender to send only the selected channels\n");
     fprintf (stderr, "  --info              Print additional info\n");
     exit (1);
 }
 
 
-enum { HELP, NAME, SERV, CHAN, BUFF, SYNC, FILT, INFO };
+enum { HELP, NAME, SERV, CHAN, BUFF, SYNC, FILT, KTIME, BUSY, CPU, XDP, URING, SHM, MGRP, SUBS, INFO };
 
 
 static struct option options [] = 
@@ -89,6 +110,14 @@ static struct option options [] =
     { "buff",  1, 0, BUFF  },
     { "sync",  1, 0, SYNC  },
     { "filt",  1, 0, FILT  },
+    { "ktime", 0, 0, KTIME },
+    { "busy",  1, 0, BUSY  },
+    { "cpu",   1, 0, CPU   },
+    { "xdp",   1, 0, XDP   },
+    { "uring", 0, 0, URING },
+    { "shm",   1, 0, SHM   },
+    { "mgroup", 1, 0, MGRP },
+    { "subscribe", 0, 0, SUBS },
     { "info",  0, 0, INFO  },
     { 0, 0, 0, 0 }
 };
@@ -137,11 +166,37 @@ static void procoptions (int ac, char *av [])
 	case FILT:
 	    filt_arg = getint ("filt");
 	    break;
+	case KTIME:
+	    ktime_opt = true;
+	    break;
+	case BUSY:
+	    busy_arg = getint ("busy");
+	    break;
+	case CPU:
+	    cpu_arg = getint ("cpu");
+	    break;
+	case XDP:
+	    xdp_arg = optarg;
+	    break;
+	case URING:
+	    uring_opt = true;
+	    break;
+	case SHM:
+	    shm_arg = optarg;
+	    break;
+	case MGRP:
+	    mgrp_arg = getint ("mgroup");
+	    break;
+	case SUBS:
+	    subs_opt = true;
+	    break;
 	case INFO:
 	    info_opt = true;
 	    break;
  	}
     }
+    // No address is used with a shared memory ring.
+    if (shm_arg && (ac == optind)) return;
     if (ac < optind + 2) help ();
     if (ac > optind + 3) help ();
     addr_arg = av [optind++];
@@ -150,6 +205,23 @@ static void procoptions (int ac, char *av [])
 }
 
 
+static void printbusy (Netrx *netrx)
+{
+    static double  tp0 = 0;
+    static int     np0 = 0, nr0 = 0;
+    double         tp;
+    int            np, nr;
+
+    // Called every two seconds.
+    netrx->get_busy (&tp, &np, &nr);
+    printf ("Busy poll: %5.1lf%% of time, %d of %d packets\n",
+            50 * (tp - tp0), np - np0, nr - nr0);
+    tp0 = tp;
+    np0 = np;
+    nr0 = nr;
+}
+
+
 int readlist (const char *s, int *list)
 {
     // Parse channel list. This must be a string consisting
@@ -260,21 +332,50 @@ static int opensocket (Sockaddr *A)
 }
 
 
+// Channel group g is received on the multicast address g above the
+// given one. Open the socket on the first group in 'glist', and join
+// the others.
+//
+static int opengroups (const Sockaddr *A)
+{
+    int       i, fd;
+    Sockaddr  G;
+
+    fd = -1;
+    for (i = 0; i < ngrp; i++)
+    {
+	G = *A;
+	G.add_addr (glist [i]);
+	if (i == 0) fd = opensocket (&G);
+	else if (sock_add_mcgroup (fd, &G, dev_arg))
+	{
+	    fprintf (stderr, "Failed to join multicast group %d.\n", glist [i]);
+	    exit (1);
+	}
+    }
+    return fd;
+}
+
+
 int main (int ac, char *av [])
 {
     Sockaddr     Arx, Atx, Asy;
     int          sockfd1, sockfd2, nchan, fsamp, filt;
-    int          tx_psmax, tx_nchan, tx_fsamp, tx_fsize;
+    int          tx_sform, tx_psmax, tx_nchan, tx_fsamp, tx_fsize, tx_npath;
     int          chlist [Netdata::MAXCHAN + 1];
-    int          k, k_buf, k_del;
+    int          g, k, k_buf, k_del;
     double       t_tx, t_rx, t_buf, t_del;
     Netdata      *packet = 0;
     Jackrx       *jackrx = 0;
     Syncrx       *syncrx = 0;
     Netrx        *netrx = 0;
+    Xdpsock      *xdpsock = 0;
+    Uring        *uring = 0;
+    Shmring      *shmring = 0;
     char         s [256];
 
     procoptions (ac, av);
+    sconv_init ();
     nchan = readlist (chan_arg, chlist);
     if (nchan < 1)
     {
@@ -286,6 +387,11 @@ int main (int ac, char *av [])
 	fprintf (stderr, "Buffer time is out of range.\n");
 	exit (1);
     }
+    if ((busy_arg < 0) || (busy_arg > 100000))
+    {
+	fprintf (stderr, "Busy poll time is out of range.\n");
+	exit (1);
+    }
     if (sync_arg && (sync_arg > buff_arg))
     {
 	fprintf (stderr, "Sync delay too high.\n");
@@ -296,21 +402,67 @@ int main (int ac, char *av [])
 	fprintf (stderr, "Filter delay is out of range.\n");
 	exit (1);
     }
-    if (   Arx.set_addr (AF_INET, SOCK_DGRAM, 0, addr_arg)
-        || Asy.set_addr (AF_INET, SOCK_DGRAM, 0, addr_arg))
+    if (shm_arg)
+    {
+	if (xdp_arg || uring_opt || ktime_opt)
+	{
+	    fprintf (stderr, "Option --shm can't be combined with --xdp, --uring or --ktime.\n");
+	    exit (1);
+	}
+    }
+    else
     {
-	fprintf (stderr, "Address resolution failed.\n");
+	if (   Arx.set_addr (AF_INET, SOCK_DGRAM, 0, addr_arg)
+	    || Asy.set_addr (AF_INET, SOCK_DGRAM, 0, addr_arg))
+	{
+	    fprintf (stderr, "Address resolution failed.\n");
+	    exit (1);
+	}
+	if ((port_arg < 1) || (port_arg > 65535))
+	{
+	    fprintf (stderr, "Port number is out of range.\n");
+	    exit (1);
+	}
+	Arx.set_port (port_arg);
+	Asy.set_port (port_arg + 1);
+    }
+    if (xdp_arg && uring_opt)
+    {
+	fprintf (stderr, "Options --xdp and --uring can't be combined.\n");
 	exit (1);
     }
-    if ((port_arg < 1) || (port_arg > 65535))
+    if (mgrp_arg)
+    {
+	if (shm_arg || ! Arx.is_multicast ())
+	{
+	    fprintf (stderr, "Option --mgroup requires a multicast address.\n");
+	    exit (1);
+	}
+	if ((mgrp_arg < 1) || (mgrp_arg > Netdata::MAXPCHAN))
+	{
+	    fprintf (stderr, "Channel group size is out of range.\n");
+	    exit (1);
+	}
+	// The channel list is in ascending order.
+	for (k = 0; k < nchan; k++)
+	{
+	    g = chlist [k] / mgrp_arg;
+	    if (g >= Netdata::MAXGROUP)
+	    {
+		fprintf (stderr, "Channel %d is not in a valid group.\n", chlist [k] + 1);
+		exit (1);
+	    }
+	    if (ngrp && (glist [ngrp - 1] == g)) continue;
+	    glist [ngrp++] = g;
+	}
+	printf ("Joining %d channel groups.\n", ngrp);
+    }
+    if (subs_opt && (shm_arg || Arx.is_multicast ()))
     {
-	fprintf (stderr, "Port number is out of range.\n");
+	fprintf (stderr, "Option --subscribe requires a unicast address.\n");
 	exit (1);
     }
 
-    Arx.set_port (port_arg);
-    Asy.set_port (port_arg + 1);
-
 #ifdef __linux__
     if (mlockall (MCL_CURRENT | MCL_FUTURE))
     {
@@ -322,6 +474,27 @@ int main (int ac, char *av [])
     jackrx = new Jackrx (name_arg, serv_arg, nchan, chlist);
 //    syncrx = new Syncrx ();
     netrx  = new Netrx ();
+    if (xdp_arg) xdpsock = new Xdpsock ();
+    if (shm_arg)
+    {
+	shmring = new Shmring ();
+	if (shmring->open (shm_arg))
+	{
+	    fprintf (stderr, "Can't open shared memory ring '%s'.\n", shm_arg);
+	    exit (1);
+	}
+	netrx->set_shm (shmring);
+    }
+    if (uring_opt)
+    {
+	uring = new Uring ();
+	if (uring->open (256))
+	{
+	    fprintf (stderr, "Warning: can't use io_uring, using recvmmsg ().\n");
+	    delete uring;
+	    uring = 0;
+	}
+    }
     commq = new Lfq_int32 (16);
     timeq = new Lfq_timedata (256);
 //    syncq = new Lfq_timedata (256);
@@ -331,12 +504,22 @@ int main (int ac, char *av [])
     while (! stop)
     {
         signal (SIGINT, SIG_DFL);
-        sockfd1 = opensocket (&Arx);
-        sockfd2 = opensocket (&Asy);
+	if (shmring)
+	{
+	    sockfd1 = sockfd2 = -1;
+	    shmring->attach ();
+	}
+	else
+	{
+	    sockfd1 = mgrp_arg ? opengroups (&Arx) : opensocket (&Arx);
+	    sockfd2 = opensocket (&Asy);
+	}
 	printf ("Waiting for info packet...\n");
         while (true)
         {
-	    if (sock_recvfm (sockfd1, packet->data (), packet->size (), &Atx) <= 0)
+	    if (shmring) k = shmring->wait () ? -1 : shmring->read (&packet, 1);
+	    else k = sock_recvfm (sockfd1, packet->data (), packet->size (), &Atx);
+	    if (k <= 0)
   	    {
   	        fprintf (stderr, "Fatal error on socket.\n");
 	        sock_close (sockfd1);
@@ -346,12 +529,21 @@ int main (int ac, char *av [])
 	    }
   	    if (packet->check_ptype () == Netdata::TY_ADESC)
 	    {
-                Atx.get_addr (s, 256);
+		if (shmring) snprintf (s, 256, "shared memory '%s'", shm_arg);
+		else Atx.get_addr (s, 256);
+ 	        tx_sform = packet->get_sform ();
+		if (! (Netdata::sampbits (tx_sform) || ((tx_sform == Netdata::FM_OPUS) && Opusdec::available ())))
+		{
+		    fprintf (stderr, "From %s : unsupported sample format %d.\n", s, tx_sform);
+		    continue;
+		}
  	        tx_psmax = packet->get_psmax ();
                 tx_nchan = packet->get_nchan ();
                 tx_fsamp = packet->get_fsamp ();
                 tx_fsize = packet->get_fsize ();
+                tx_npath = packet->get_npath ();
                 printf ("From %s : %d chan, %d Hz\n", s, tx_nchan, tx_fsamp);
+		if (tx_npath > 1) printf ("Striped over %d paths.\n", tx_npath);
 	        break;
 	    }
         }
@@ -380,18 +572,63 @@ int main (int ac, char *av [])
 
 //        if (sync_arg) syncrx->start (syncq, jackrx->rprio() + 5, sockfd2);
 
-        netrx->start (audioq, commq, timeq, chlist, 
-	   	      tx_psmax, tx_fsamp, tx_fsize, jackrx->rprio() + 5, sockfd1);
+        if (busy_arg && !shmring && sock_set_busy_poll (sockfd1, busy_arg))
+	{
+	    fprintf (stderr, "Warning: SO_BUSY_POLL failed, polling without it.\n");
+	}
+        netrx->set_busy (busy_arg, cpu_arg);
+	if (xdpsock)
+	{
+	    // Packets are redirected from the first device queue.
+	    if (xdpsock->open_rx (xdp_arg, port_arg, 0))
+	    {
+		fprintf (stderr, "Warning: can't use AF_XDP on '%s'.\n", xdp_arg);
+		netrx->set_xdp (0);
+	    }
+	    else
+	    {
+		printf ("Using AF_XDP, %s mode.\n", xdpsock->zerocopy () ? "zero-copy" : "copy");
+		netrx->set_xdp (xdpsock);
+	    }
+	}
+	if (uring)
+	{
+	    if (netrx->set_uring (uring, tx_psmax))
+	    {
+		fprintf (stderr, "Warning: can't use io_uring, using recvmmsg ().\n");
+	    }
+	    else printf ("Using io_uring.\n");
+	}
+	netrx->set_stripe (tx_npath, tx_psmax);
+        netrx->start (audioq, commq, timeq, chlist, tx_sform, tx_nchan,
+	   	      tx_psmax, tx_fsamp, tx_fsize, jackrx->rprio() + 5, sockfd1,
+		      ktime_opt);
 
         jackrx->start (audioq, commq, timeq, syncq, infoq,
                        (double) jackrx->fsamp () / tx_fsamp, k_del, filt);
 
+	// The subscription is sent from the data socket, so it is
+	// accepted by the sender's connected socket. It is repeated
+	// every second, the sender sends all channels again if it
+	// stops.
+	if (subs_opt) packet->init_subscr (chlist);
+
         signal (SIGINT, sigint_handler);
-        while (! (stop || checkstatus ())) usleep (250000);
+        for (k = 1; ! (stop || checkstatus ()); k++)
+	{
+	    if (subs_opt && (k % 4 == 1)) sock_sendto (sockfd1, packet->data (), packet->dlen (), &Atx);
+	    usleep (250000);
+	    if (busy_arg && info_opt && (k % 8 == 0)) printbusy (netrx);
+	}
 
-        sock_close (sockfd1);
-        sock_close (sockfd2);
+	if (shmring) shmring->shutdown ();
+	else
+	{
+	    sock_close (sockfd1);
+	    sock_close (sockfd2);
+	}
 	usleep (100000);
+	if (xdpsock) xdpsock->close ();
         delete audioq;
     }
 
@@ -400,6 +637,9 @@ int main (int ac, char *av [])
     delete syncq;
     delete infoq;
     delete netrx;
+    delete xdpsock;
+    delete uring;
+    delete shmring;
     delete syncrx;
     delete jackrx;
     delete packet;
@@ -33,6 +33,10 @@
 #include <net/if.h>
 #include <arpa/inet.h>
 #include <errno.h>
+#ifdef __linux__
+#include <netinet/udp.h>
+#include <linux/net_tstamp.h>
+#endif
 #include "zsockets.h"
 
 
@@ -104,6 +108,33 @@ void Sockaddr::set_port (int port)
 }
 
 
+// Add k to the address, for consecutive multicast groups. For IPv6
+// only the last 32 bits are used.
+//
+void Sockaddr::add_addr (int k)
+{
+    struct sockaddr *S = (struct sockaddr *) _data;
+    switch (S->sa_family)
+    {
+    case AF_INET:
+    {
+	struct sockaddr_in *S4 = (struct sockaddr_in *) _data;
+	S4->sin_addr.s_addr = htonl (ntohl (S4->sin_addr.s_addr) + k);
+	break;
+    }
+    case AF_INET6:
+    {
+	struct sockaddr_in6 *S6 = (struct sockaddr_in6 *) _data;
+	uint32_t v;
+	memcpy (&v, S6->sin6_addr.s6_addr + 12, sizeof (uint32_t));
+	v = htonl (ntohl (v) + k);
+	memcpy (S6->sin6_addr.s6_addr + 12, &v, sizeof (uint32_t));
+	break;
+    }
+    }	
+}
+
+
 int Sockaddr::get_addr (char *address, int len) const
 {
     struct sockaddr *S = (struct sockaddr *) _data;
@@ -394,7 +425,6 @@ int sock_open_mcrecv (Sockaddr *addr, const char *iface)
     }
     if (fam == AF_INET6)
     {
-        struct ipv6_mreq  mcreq;
 	struct sockaddr_in6 W6, *A6;
 
 	A6 = (struct sockaddr_in6 *) addr->sa_ptr ();
@@ -406,22 +436,9 @@ int sock_open_mcrecv (Sockaddr *addr, const char *iface)
             close (fd);
 	    return -1;
 	}
-        memcpy (&mcreq.ipv6mr_multiaddr, &(A6->sin6_addr), sizeof(struct in6_addr));
-        mcreq.ipv6mr_interface = if_nametoindex (iface);
-#ifdef __APPLE__
-        if (setsockopt (fd, IPPROTO_IPV6, IPV6_JOIN_GROUP, (char*) &mcreq, sizeof (mcreq)))
-#else
-        if (setsockopt (fd, IPPROTO_IPV6, IPV6_ADD_MEMBERSHIP, (char*) &mcreq, sizeof (mcreq)))
-#endif
-	{
-	    close (fd);
-	    return -1;
-	}
     }
     else
     {
-        struct ifreq     ifreq;
-        struct ip_mreq   mcreq;
 	struct sockaddr_in W4, *A4;
 
         A4 = (struct sockaddr_in *) addr->sa_ptr ();
@@ -433,23 +450,64 @@ int sock_open_mcrecv (Sockaddr *addr, const char *iface)
             close (fd);
 	    return -1;
 	}
+    }
+    if (sock_add_mcgroup (fd, addr, iface))
+    {
+	close (fd);
+	return -1;
+    }
+    return fd;	
+}
+
+
+// Join another multicast group on a socket opened by sock_open_mcrecv ().
+// On Linux the socket then receives only the groups it has joined, and
+// not those joined by other sockets bound to the same port.
+//
+int sock_add_mcgroup (int fd, Sockaddr *addr, const char *iface)
+{
+    int                  ipar;
+    sa_family_t          fam;
+
+    fam = addr->family ();
+    ipar = 0;
+    if (fam == AF_INET6)
+    {
+        struct ipv6_mreq  mcreq;
+	struct sockaddr_in6 *A6;
+
+	A6 = (struct sockaddr_in6 *) addr->sa_ptr ();
+        memcpy (&mcreq.ipv6mr_multiaddr, &(A6->sin6_addr), sizeof(struct in6_addr));
+        mcreq.ipv6mr_interface = if_nametoindex (iface);
+#ifdef __APPLE__
+        if (setsockopt (fd, IPPROTO_IPV6, IPV6_JOIN_GROUP, (char*) &mcreq, sizeof (mcreq))) return -1;
+#else
+        if (setsockopt (fd, IPPROTO_IPV6, IPV6_ADD_MEMBERSHIP, (char*) &mcreq, sizeof (mcreq))) return -1;
+#endif
+#ifdef IPV6_MULTICAST_ALL
+	setsockopt (fd, IPPROTO_IPV6, IPV6_MULTICAST_ALL, &ipar, sizeof (int));
+#endif
+    }
+    else if (fam == AF_INET)
+    {
+        struct ifreq     ifreq;
+        struct ip_mreq   mcreq;
+	struct sockaddr_in *A4;
+
+        A4 = (struct sockaddr_in *) addr->sa_ptr ();
         strncpy (ifreq.ifr_name, iface, 16);
         ifreq.ifr_name [15] = 0;
         ifreq.ifr_addr.sa_family = AF_INET;
-        if (ioctl (fd, SIOCGIFADDR, &ifreq))
-	{
-	    close (fd);
-	    return -1;
-	}
+        if (ioctl (fd, SIOCGIFADDR, &ifreq)) return -1;
         mcreq.imr_multiaddr.s_addr = A4->sin_addr.s_addr;
         mcreq.imr_interface.s_addr = ((struct sockaddr_in *)(&ifreq.ifr_addr))->sin_addr.s_addr;
-        if (setsockopt (fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, (char*) &mcreq, sizeof (mcreq)))
-	{
-	    close (fd);
-	    return -1;
-	}
+        if (setsockopt (fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, (char*) &mcreq, sizeof (mcreq))) return -1;
+#ifdef IP_MULTICAST_ALL
+	setsockopt (fd, IPPROTO_IP, IP_MULTICAST_ALL, &ipar, sizeof (int));
+#endif
     }
-    return fd;	
+    else return -1;
+    return 0;
 }
 
 
@@ -487,6 +545,115 @@ int sock_set_read_buffer (int fd, size_t size)
 }
 
 
+// Return the path MTU of a connected datagram socket,
+// or -1 if this is not available.
+//
+int sock_get_mtu (int fd)
+{
+#ifdef __linux__
+    int                      mtu;
+    socklen_t                len;
+    struct sockaddr_storage  addr;
+
+    len = sizeof (addr);
+    if (getsockname (fd, (sockaddr *) &addr, &len)) return -1;
+    len = sizeof (mtu);
+    if (addr.ss_family == AF_INET6)
+    {
+	if (getsockopt (fd, IPPROTO_IPV6, IPV6_MTU, &mtu, &len)) return -1;
+    }
+    else
+    {
+	if (getsockopt (fd, IPPROTO_IP, IP_MTU, &mtu, &len)) return -1;
+    }
+    return mtu;
+#else
+    return -1;
+#endif
+}
+
+
+// Set the default UDP segmentation offload size, zero disables
+// segmentation. Fails if the kernel doesn't support this.
+//
+int sock_set_udp_segment (int fd, int size)
+{
+#if defined (__linux__) && defined (UDP_SEGMENT)
+    return setsockopt (fd, SOL_UDP, UDP_SEGMENT, (char*) &size, sizeof (size));
+#else
+    return -1;
+#endif
+}
+
+
+// Enable or disable receiving coalesced UDP datagrams.
+// Fails if the kernel doesn't support this.
+//
+int sock_set_udp_gro (int fd, bool flag)
+{
+#if defined (__linux__) && defined (UDP_GRO)
+    int ipar = flag ? 1 : 0;
+
+    return setsockopt (fd, SOL_UDP, UDP_GRO, (char*) &ipar, sizeof (ipar));
+#else
+    return -1;
+#endif
+}
+
+
+// Enable or disable receive timestamps in nanoseconds,
+// as SCM_TIMESTAMPNS control messages.
+//
+int sock_set_timestamp (int fd, bool flag)
+{
+#if defined (__linux__) && defined (SO_TIMESTAMPNS)
+    int ipar = flag ? 1 : 0;
+
+    return setsockopt (fd, SOL_SOCKET, SO_TIMESTAMPNS, (char*) &ipar, sizeof (ipar));
+#else
+    return -1;
+#endif
+}
+
+
+// Enable transmit times given as SCM_TXTIME control messages,
+// using the given clock. These require the fq or etf qdisc.
+// Packets dropped by the qdisc are reported on the error queue.
+//
+int sock_set_txtime (int fd, int clockid)
+{
+#if defined (__linux__) && defined (SO_TXTIME)
+    struct sock_txtime  txt;
+
+    txt.clockid = clockid;
+    txt.flags = SOF_TXTIME_REPORT_ERRORS;
+    return setsockopt (fd, SOL_SOCKET, SO_TXTIME, (char*) &txt, sizeof (txt));
+#else
+    return -1;
+#endif
+}
+
+
+// Make the kernel poll the device queue for up to the given time
+// when waiting for data on this socket, and prefer this to using
+// interrupts if supported. Raising the time above the system's
+// default requires CAP_NET_ADMIN.
+//
+int sock_set_busy_poll (int fd, int usecs)
+{
+#if defined (__linux__) && defined (SO_BUSY_POLL)
+    int ipar = 1;
+
+#ifdef SO_PREFER_BUSY_POLL
+    setsockopt (fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, (char*) &ipar, sizeof (ipar));
+#endif
+    return setsockopt (fd, SOL_SOCKET, SO_BUSY_POLL, (char*) &usecs, sizeof (usecs));
+#else
+    return -1;
+#endif
+}
+
+
 int sock_write (int fd, void* data, size_t size, size_t min)
 {
     int    n;
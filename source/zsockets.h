@@ -38,6 +38,7 @@ public:
     void reset (int family = AF_UNSPEC);
     int  set_addr (int family, int socktype, int protocol, const char *address);
     void set_port (int port);
+    void add_addr (int k);
     int  get_addr (char *address, int len) const;
     int  get_port (void) const;
 
@@ -59,6 +60,7 @@ extern int sock_open_passive (Sockaddr *local, int qlen);
 extern int sock_open_dgram (Sockaddr *remote, Sockaddr *local);
 extern int sock_open_mcsend (Sockaddr *addr, const char *iface, int loop, int hops);
 extern int sock_open_mcrecv (Sockaddr *addr, const char *iface);
+extern int sock_add_mcgroup (int fd, Sockaddr *addr, const char *iface);
 extern int sock_accept (int fd, Sockaddr *remote, Sockaddr *local);
 extern int sock_close (int fd);
 
@@ -66,6 +68,12 @@ extern int sock_set_close_on_exec (int fd, bool flag);
 extern int sock_set_no_delay (int fd, bool flag);
 extern int sock_set_write_buffer (int fd, size_t size);
 extern int sock_set_read_buffer (int fd, size_t size);
+extern int sock_get_mtu (int fd);
+extern int sock_set_udp_segment (int fd, int size);
+extern int sock_set_udp_gro (int fd, bool flag);
+extern int sock_set_timestamp (int fd, bool flag);
+extern int sock_set_txtime (int fd, int clockid);
+extern int sock_set_busy_poll (int fd, int usecs);
 
 extern int sock_write (int fd, void* data, size_t size, size_t min);
 extern int sock_read (int fd, void* data, size_t size, size_t min);